@@ -66,6 +66,48 @@ Accessibility::Accessibility(
 }
 
 
+Accessibility::Accessibility(
+        int numnodes,
+        const vector<unsigned int> &heads,
+        const vector<unsigned int> &tails,
+        const vector< vector<double> > &edgeweights,
+        bool twoway,
+        const string &chCachePath,
+        bool customizable,
+        bool reorderNodes)
+    : Accessibility(numnodes, vector< vector<long> >(),
+                    vector< vector<double> >(), twoway) {
+    // the graphs share the nodes and edges, only their weights differ, so
+    // their hierarchies are built in parallel
+    vector<Graphalg *> graphs(edgeweights.size());
+    #pragma omp parallel for schedule(dynamic) if(edgeweights.size() > 1)
+    for (int i = 0 ; i < edgeweights.size() ; i++) {
+        graphs[i] = new Graphalg(numnodes, heads, tails, edgeweights[i],
+                                 twoway, chCachePath, customizable,
+                                 reorderNodes);
+    }
+    for (int i = 0 ; i < graphs.size() ; i++) {
+        this->addGraphalg(graphs[i]);
+    }
+}
+
+
+void Accessibility::updateEdgeWeights(const vector<double> &edgeweights,
+                                      int graphno) {
+    this->ga[graphno]->UpdateEdgeWeights(edgeweights);
+
+    // redo the precomputed range queries with the new weights
+    if (dmsradius > 0) {
+        #pragma omp parallel for schedule(guided)
+        for (int i = 0 ; i < numnodes ; i++) {
+            dms[graphno][i].clear();
+            ga[graphno]->Range(i, dmsradius, omp_get_thread_num(),
+                               dms[graphno][i]);
+        }
+    }
+}
+
+
 void Accessibility::addGraphalg(MTC::accessibility::Graphalg *g) {
     std::shared_ptr<MTC::accessibility::Graphalg>ptr(g);
     this->ga.push_back(ptr);
@@ -107,14 +149,32 @@ vector<vector<int>>
 Accessibility::Routes(vector<long> sources, vector<long> targets, int graphno) {
 
     int n = std::min(sources.size(), targets.size()); // in case lists don't match
+    vector<vector<NodeID>> paths = this->ga[graphno]->Routes(
+        vector<NodeID>(sources.begin(), sources.begin() + n),
+        vector<NodeID>(targets.begin(), targets.begin() + n));
+
     vector<vector<int>> routes(n);
+    #pragma omp parallel for schedule(guided)
+    for (int i = 0 ; i < n ; i++) {
+        routes[i] = vector<int> (paths[i].begin(), paths[i].end());
+    }
+    return routes;
+}
 
-    #pragma omp parallel
-    #pragma omp for schedule(guided)
+
+vector<vector<int>>
+Accessibility::EdgeRoutes(vector<long> sources, vector<long> targets,
+                          int graphno) {
+
+    int n = std::min(sources.size(), targets.size()); // in case lists don't match
+    vector<vector<NodeID>> paths = this->ga[graphno]->EdgeRoutes(
+        vector<NodeID>(sources.begin(), sources.begin() + n),
+        vector<NodeID>(targets.begin(), targets.begin() + n));
+
+    vector<vector<int>> routes(n);
+    #pragma omp parallel for schedule(guided)
     for (int i = 0 ; i < n ; i++) {
-        vector<NodeID> ret = this->ga[graphno]->Route(sources[i], targets[i], 
-            omp_get_thread_num());
-        routes[i] = vector<int> (ret.begin(), ret.end());
+        routes[i] = vector<int> (paths[i].begin(), paths[i].end());
     }
     return routes;
 }
@@ -130,17 +190,9 @@ vector<double>
 Accessibility::Distances(vector<long> sources, vector<long> targets, int graphno) {                       
     
     int n = std::min(sources.size(), targets.size()); // in case lists don't match
-    vector<double> distances(n);
-    
-    #pragma omp parallel
-    #pragma omp for schedule(guided)
-    for (int i = 0 ; i < n ; i++) {
-        distances[i] = this->ga[graphno]->Distance(
-            sources[i], 
-            targets[i], 
-            omp_get_thread_num());
-    }
-    return distances;
+    return this->ga[graphno]->Distances(
+        vector<NodeID>(sources.begin(), sources.begin() + n),
+        vector<NodeID>(targets.begin(), targets.begin() + n));
 }
 
 
@@ -25,6 +25,24 @@ class Accessibility {
         vector< vector<double> >  edgeweights,
         bool twoway);
 
+    // edges given as flat arrays of head and tail nodes (one graph per
+    // vector of edge weights). With a chCachePath the contraction
+    // hierarchies are reused across runs, customizable graphs take new
+    // weights through updateEdgeWeights and reorderNodes renumbers the
+    // nodes of the hierarchies for faster queries (see Graphalg)
+    Accessibility(
+        int numnodes,
+        const vector<unsigned int> &heads,
+        const vector<unsigned int> &tails,
+        const vector< vector<double> > &edgeweights,
+        bool twoway,
+        const string &chCachePath = "",
+        bool customizable = false,
+        bool reorderNodes = false);
+
+    // replace the edge weights of a customizable graph
+    void updateEdgeWeights(const vector<double> &edgeweights, int graphno = 0);
+
     // initialize the category number with POIs at the node_id locations
     void initializeCategory(const double maxdist, const int maxitems, string category, vector<long> node_idx);
 
@@ -55,6 +73,11 @@ class Accessibility {
     vector<vector<int>> Routes(vector<long> sources, vector<long> targets,  
                              int graphno = 0);
 
+    // shortest paths between list of origins and destinations as edge
+    // indices (position of the edge in the input)
+    vector<vector<int>> EdgeRoutes(vector<long> sources, vector<long> targets,
+                                   int graphno = 0);
+
     // shortest path distance between two points
     double Distance(int src, int tgt, int graphno = 0);
     
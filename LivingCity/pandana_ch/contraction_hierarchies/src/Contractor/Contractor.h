@@ -34,6 +34,7 @@ or see http://www.gnu.org/licenses/agpl.txt.
 #include <set>
 #include <stack>
 #include <limits>
+#include <random>
 #ifdef _OPENMP
 #include <omp.h>
 #else
@@ -162,16 +163,22 @@ public:
             forwardEdge.data.shortcut = backwardEdge.data.shortcut = false;
             forwardEdge.data.originalEdges = backwardEdge.data.originalEdges = 1;
             forwardEdge.data.distance = backwardEdge.data.distance = std::numeric_limits< int >::max();
-            //remove parallel edges
+            //remove parallel edges, each direction keeps the name of its shortest edge
             while ( i < edges.size() && edges[i].source == source && edges[i].target == target ) {
-                if ( edges[i].data.forward )
-                    forwardEdge.data.distance = std::min( edges[i].data.distance, forwardEdge.data.distance );
-                if ( edges[i].data.backward )
-                    backwardEdge.data.distance = std::min( edges[i].data.distance, backwardEdge.data.distance );
+                if ( edges[i].data.forward && edges[i].data.distance < forwardEdge.data.distance ) {
+                    forwardEdge.data.distance = edges[i].data.distance;
+                    forwardEdge.data.middleName.nameID = edges[i].data.middleName.nameID;
+                }
+                if ( edges[i].data.backward && edges[i].data.distance < backwardEdge.data.distance ) {
+                    backwardEdge.data.distance = edges[i].data.distance;
+                    backwardEdge.data.middleName.nameID = edges[i].data.middleName.nameID;
+                }
                 i++;
             }
-            //merge edges (s,t) and (t,s) into bidirectional edge
-            if ( forwardEdge.data.distance == backwardEdge.data.distance ) {
+            //merge edges (s,t) and (t,s) into bidirectional edge if they are the same input edge, so paths
+            //keep the name of the edge in each direction
+            if ( forwardEdge.data.distance == backwardEdge.data.distance &&
+                 forwardEdge.data.middleName.nameID == backwardEdge.data.middleName.nameID ) {
                 if ( (int)forwardEdge.data.distance != std::numeric_limits< int >::max() ) {
                     forwardEdge.data.backward = true;
                     edges[edge++] = forwardEdge;
@@ -233,7 +240,9 @@ public:
 #pragma omp parallel for schedule ( guided )
         for ( int x = 0; x < ( int ) numberOfNodes; ++x )
             remainingNodes[x].first = x;
-        std::random_shuffle( remainingNodes.begin(), remainingNodes.end() );
+        //own generator: contractions running in parallel give the same order as alone
+        std::mt19937 random( 5489u );
+        std::shuffle( remainingNodes.begin(), remainingNodes.end(), random );
         for ( int x = 0; x < ( int ) numberOfNodes; ++x )
             nodeData[remainingNodes[x].first].bias = x;
 
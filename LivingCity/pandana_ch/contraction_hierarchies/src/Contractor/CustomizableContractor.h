@@ -0,0 +1,245 @@
+/*
+    open source routing machine
+    Copyright (C) Dennis Luxen, others 2010
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU AFFERO General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+or see http://www.gnu.org/licenses/agpl.txt.
+ */
+
+#ifndef CUSTOMIZABLECONTRACTOR_H_INCLUDED
+#define CUSTOMIZABLECONTRACTOR_H_INCLUDED
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+//Customizable contraction hierarchy. The node order and the shortcut topology only depend on the
+//graph structure: nodes are contracted by minimum degree and every pair of higher neighbours of a
+//contracted node is connected, without witness searches. The weights of all arcs are then computed
+//for a metric (Customize) by relaxing the lower triangles of every arc, which can be repeated for new
+//edge weights without contracting again. The resulting graph is queried like a regular CH.
+class CustomizableContractor {
+
+private:
+    struct _ArcMetric {
+        //0: lower to higher ranked node, 1: higher to lower ranked node
+        unsigned distance[2];
+        bool shortcut[2];
+        //middle node of a shortcut, name of an original edge
+        NodeID middle[2];
+    };
+
+public:
+
+    template< class InputEdge >
+    CustomizableContractor( const int nodes, const std::vector< InputEdge >& inputEdges ) : _numberOfNodes(nodes) {
+        //undirected neighbours without loops and parallel edges
+        std::vector< std::vector< NodeID > > neighbours( nodes );
+        for ( typename std::vector< InputEdge >::const_iterator i = inputEdges.begin(), e = inputEdges.end(); i != e; ++i ) {
+            if ( i->source() == i->target() )
+                continue;
+            neighbours[i->source()].push_back( i->target() );
+            neighbours[i->target()].push_back( i->source() );
+        }
+        for ( int node = 0; node < nodes; ++node ) {
+            std::sort( neighbours[node].begin(), neighbours[node].end() );
+            neighbours[node].resize( std::unique( neighbours[node].begin(), neighbours[node].end() ) - neighbours[node].begin() );
+        }
+
+        _ComputeOrder( neighbours );
+
+        //arcs to the input edges
+        _inputArc.resize( inputEdges.size() );
+        for ( unsigned i = 0; i < inputEdges.size(); ++i ) {
+            const NodeID source = inputEdges[i].source();
+            const NodeID target = inputEdges[i].target();
+            if ( source == target ) {
+                _inputArc[i] = SPECIAL_EDGEID;
+                continue;
+            }
+            _inputArc[i] = _rank[source] < _rank[target] ? _FindArc( source, target ) : _FindArc( target, source );
+            assert( _inputArc[i] != SPECIAL_EDGEID );
+        }
+        _metric.resize( _arcHead.size() );
+    }
+
+    //compute the arc weights for the edges given to the constructor with new weights (same order)
+    template< class InputEdge >
+    void Customize( const std::vector< InputEdge >& inputEdges ) {
+        CHASSERT( inputEdges.size() == _inputArc.size(), "Customization needs the edges of the contracted graph" );
+        const unsigned infinity = std::numeric_limits< int >::max();
+        for ( unsigned arc = 0; arc < _metric.size(); ++arc ) {
+            for ( int direction = 0; direction < 2; ++direction ) {
+                _metric[arc].distance[direction] = infinity;
+                _metric[arc].shortcut[direction] = false;
+                _metric[arc].middle[direction] = SPECIAL_NODEID;
+            }
+        }
+
+        //original edges, parallel edges keep the smallest weight
+        for ( unsigned i = 0; i < inputEdges.size(); ++i ) {
+            if ( _inputArc[i] == SPECIAL_EDGEID )
+                continue;
+            _ArcMetric& metric = _metric[_inputArc[i]];
+            const unsigned distance = std::max( ( int ) inputEdges[i].weight(), 1 );
+            const bool upward = _rank[inputEdges[i].source()] < _rank[inputEdges[i].target()];
+            if ( inputEdges[i].isForward() )
+                _Relax( metric, upward ? 0 : 1, distance, false, inputEdges[i].name() );
+            if ( inputEdges[i].isBackward() )
+                _Relax( metric, upward ? 1 : 0, distance, false, inputEdges[i].name() );
+        }
+
+        //lower triangles: the arcs of a node are final once all lower ranked nodes are processed
+        for ( NodeID position = 0; position < _numberOfNodes; ++position ) {
+            const NodeID node = _order[position];
+            for ( EdgeID first = _firstArc[node]; first < _firstArc[node + 1]; ++first ) {
+                const _ArcMetric& toFirst = _metric[first];
+                for ( EdgeID second = _firstArc[node]; second < _firstArc[node + 1]; ++second ) {
+                    if ( second == first || _rank[_arcHead[first]] > _rank[_arcHead[second]] )
+                        continue;
+                    //arc from the lower to the higher of the two neighbours
+                    const _ArcMetric& toSecond = _metric[second];
+                    _ArcMetric& metric = _metric[_FindArc( _arcHead[first], _arcHead[second] )];
+                    if ( toFirst.distance[1] != infinity && toSecond.distance[0] != infinity )
+                        _Relax( metric, 0, toFirst.distance[1] + toSecond.distance[0], true, node );
+                    if ( toSecond.distance[1] != infinity && toFirst.distance[0] != infinity )
+                        _Relax( metric, 1, toSecond.distance[1] + toFirst.distance[0], true, node );
+                }
+            }
+        }
+    }
+
+    //arcs in the format of the query graph, stored at their lower ranked node
+    template< class Edge >
+    void GetEdges( std::vector< Edge >& edges ) {
+        const unsigned infinity = std::numeric_limits< int >::max();
+        for ( NodeID node = 0; node < _numberOfNodes; ++node ) {
+            for ( EdgeID arc = _firstArc[node]; arc < _firstArc[node + 1]; ++arc ) {
+                const _ArcMetric& metric = _metric[arc];
+                Edge edge;
+                edge.source = node;
+                edge.target = _arcHead[arc];
+                edge.data.type = -1;
+                //merge both directions into a bidirectional edge
+                if ( metric.distance[0] == metric.distance[1] && metric.shortcut[0] == metric.shortcut[1] &&
+                     metric.middle[0] == metric.middle[1] ) {
+                    if ( metric.distance[0] == infinity )
+                        continue;
+                    edge.data.distance = metric.distance[0];
+                    edge.data.shortcut = metric.shortcut[0];
+                    edge.data.middleName.middle = metric.middle[0];
+                    edge.data.forward = edge.data.backward = true;
+                    edges.push_back( edge );
+                    continue;
+                }
+                for ( int direction = 0; direction < 2; ++direction ) {
+                    if ( metric.distance[direction] == infinity )
+                        continue;
+                    edge.data.distance = metric.distance[direction];
+                    edge.data.shortcut = metric.shortcut[direction];
+                    edge.data.middleName.middle = metric.middle[direction];
+                    edge.data.forward = direction == 0;
+                    edge.data.backward = direction == 1;
+                    edges.push_back( edge );
+                }
+            }
+        }
+        std::sort( edges.begin(), edges.end() );
+    }
+
+    unsigned GetNumberOfArcs() const {
+        return _arcHead.size();
+    }
+
+private:
+
+    //minimum degree order on the graph with fill-in; the higher neighbours of every node become its arcs
+    void _ComputeOrder( std::vector< std::vector< NodeID > >& neighbours ) {
+        _rank.assign( _numberOfNodes, SPECIAL_NODEID );
+        _order.reserve( _numberOfNodes );
+        std::vector< std::vector< NodeID > > upward( _numberOfNodes );
+        typedef std::pair< unsigned, NodeID > DegreeNode;
+        std::priority_queue< DegreeNode, std::vector< DegreeNode >, std::greater< DegreeNode > > queue;
+        for ( NodeID node = 0; node < _numberOfNodes; ++node )
+            queue.push( DegreeNode( neighbours[node].size(), node ) );
+
+        std::vector< NodeID > merged;
+        while ( !queue.empty() ) {
+            const DegreeNode top = queue.top();
+            queue.pop();
+            const NodeID node = top.second;
+            //skip contracted nodes and outdated degrees
+            if ( _rank[node] != SPECIAL_NODEID || top.first != neighbours[node].size() )
+                continue;
+            _rank[node] = _order.size();
+            _order.push_back( node );
+
+            //the remaining neighbours form a clique
+            const std::vector< NodeID >& clique = neighbours[node];
+            for ( unsigned i = 0; i < clique.size(); ++i ) {
+                std::vector< NodeID >& adjacent = neighbours[clique[i]];
+                merged.clear();
+                std::set_union( adjacent.begin(), adjacent.end(), clique.begin(), clique.end(), std::back_inserter( merged ) );
+                adjacent.clear();
+                for ( unsigned j = 0; j < merged.size(); ++j ) {
+                    if ( merged[j] != node && merged[j] != clique[i] )
+                        adjacent.push_back( merged[j] );
+                }
+                queue.push( DegreeNode( adjacent.size(), clique[i] ) );
+            }
+            upward[node].swap( neighbours[node] );
+        }
+
+        _firstArc.resize( _numberOfNodes + 1 );
+        _firstArc[0] = 0;
+        for ( NodeID node = 0; node < _numberOfNodes; ++node )
+            _firstArc[node + 1] = _firstArc[node] + upward[node].size();
+        _arcHead.reserve( _firstArc.back() );
+        for ( NodeID node = 0; node < _numberOfNodes; ++node )
+            _arcHead.insert( _arcHead.end(), upward[node].begin(), upward[node].end() );
+    }
+
+    //arc from lower to higher (heads are sorted by node id)
+    EdgeID _FindArc( const NodeID lower, const NodeID higher ) const {
+        const std::vector< NodeID >::const_iterator begin = _arcHead.begin() + _firstArc[lower];
+        const std::vector< NodeID >::const_iterator end = _arcHead.begin() + _firstArc[lower + 1];
+        const std::vector< NodeID >::const_iterator arc = std::lower_bound( begin, end, higher );
+        return ( arc != end && *arc == higher ) ? EdgeID( arc - _arcHead.begin() ) : SPECIAL_EDGEID;
+    }
+
+    void _Relax( _ArcMetric& metric, const int direction, const unsigned distance, const bool shortcut, const NodeID middle ) {
+        if ( distance < metric.distance[direction] ) {
+            metric.distance[direction] = distance;
+            metric.shortcut[direction] = shortcut;
+            metric.middle[direction] = middle;
+        }
+    }
+
+    NodeID _numberOfNodes;
+    //contraction position of every node and the nodes by position
+    std::vector< NodeID > _rank;
+    std::vector< NodeID > _order;
+    //arcs of node v are _firstArc[v] to _firstArc[v+1], _arcHead is the higher ranked node
+    std::vector< EdgeID > _firstArc;
+    std::vector< NodeID > _arcHead;
+    std::vector< _ArcMetric > _metric;
+    //arc of every input edge
+    std::vector< EdgeID > _inputArc;
+};
+
+#endif // CUSTOMIZABLECONTRACTOR_H_INCLUDED
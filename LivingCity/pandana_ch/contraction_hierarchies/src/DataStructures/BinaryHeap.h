@@ -55,6 +55,47 @@ template <typename NodeID, typename Key> class ArrayStorage
     Key *positions;
 };
 
+// Positions stamped with the search they were written in: Clear only starts a
+// new search and positions of earlier searches read as not inserted, without
+// the heap looking them up in its inserted nodes
+template <typename NodeID, typename Key> class TimestampStorage
+{
+  public:
+    explicit TimestampStorage(size_t size) : entries(size), timestamp(1) {}
+
+    Key &operator[](NodeID node)
+    {
+        Entry &entry = entries[node];
+        if (entry.timestamp != timestamp)
+        {
+            entry.timestamp = timestamp;
+            entry.key = std::numeric_limits<Key>::max();
+        }
+        return entry.key;
+    }
+
+    void Clear()
+    {
+        if (++timestamp == 0)
+        {
+            std::fill(entries.begin(), entries.end(), Entry());
+            timestamp = 1;
+        }
+    }
+
+  private:
+    struct Entry
+    {
+        Entry() : timestamp(0), key(0) {}
+
+        unsigned timestamp;
+        Key key;
+    };
+
+    std::vector<Entry> entries;
+    unsigned timestamp;
+};
+
 template <typename NodeID, typename Key> class MapStorage
 {
   public:
@@ -88,11 +129,14 @@ template <typename NodeID, typename Key> class UnorderedMapStorage
     //std::unordered_map<NodeID, Key> nodes;
 };
 
+// Arity is the number of children of a heap node; a 4-ary heap is shallower
+// and compares the children of a node within one or two cache lines
 template <typename NodeID,
           typename Key,
           typename Weight,
           typename Data,
-          typename IndexStorage = ArrayStorage<NodeID, NodeID>>
+          typename IndexStorage = ArrayStorage<NodeID, NodeID>,
+          unsigned Arity = 2>
 class BinaryHeap
 {
   private:
@@ -233,18 +277,26 @@ class BinaryHeap
     std::vector<HeapElement> heap;
     IndexStorage node_index;
 
+    // the root is heap[1], heap[0] is a sentinel
+    static Key FirstChild(Key key) { return Arity * (key - 1) + 2; }
+
+    static Key Parent(Key key) { return (key - 2) / Arity + 1; }
+
     void Downheap(Key key)
     {
         const Key droppingIndex = heap[key].index;
         const Weight weight = heap[key].weight;
-        Key nextKey = key << 1;
-        while (nextKey < static_cast<Key>(heap.size()))
+        const Key size = static_cast<Key>(heap.size());
+        Key nextKey = FirstChild(key);
+        while (nextKey < size)
         {
-            const Key nextKeyOther = nextKey + 1;
-            if ((nextKeyOther < static_cast<Key>(heap.size())) &&
-                (heap[nextKey].weight > heap[nextKeyOther].weight))
+            const Key lastChild = std::min<Key>(nextKey + Arity, size);
+            for (Key nextKeyOther = nextKey + 1; nextKeyOther < lastChild; ++nextKeyOther)
             {
-                nextKey = nextKeyOther;
+                if (heap[nextKey].weight > heap[nextKeyOther].weight)
+                {
+                    nextKey = nextKeyOther;
+                }
             }
             if (weight <= heap[nextKey].weight)
             {
@@ -253,7 +305,7 @@ class BinaryHeap
             heap[key] = heap[nextKey];
             inserted_nodes[heap[key].index].key = key;
             key = nextKey;
-            nextKey <<= 1;
+            nextKey = FirstChild(key);
         }
         heap[key].index = droppingIndex;
         heap[key].weight = weight;
@@ -264,14 +316,12 @@ class BinaryHeap
     {
         const Key risingIndex = heap[key].index;
         const Weight weight = heap[key].weight;
-        Key nextKey = key >> 1;
-        while (heap[nextKey].weight > weight)
+        while (key > 1 && heap[Parent(key)].weight > weight)
         {
-            assert(nextKey != 0);
+            const Key nextKey = Parent(key);
             heap[key] = heap[nextKey];
             inserted_nodes[heap[key].index].key = key;
             key = nextKey;
-            nextKey >>= 1;
         }
         heap[key].index = risingIndex;
         heap[key].weight = weight;
@@ -283,7 +333,7 @@ class BinaryHeap
 #ifndef NDEBUG
         for (Key i = 2; i < (Key)heap.size(); ++i)
         {
-            assert(heap[i].weight >= heap[i >> 1].weight);
+            assert(heap[i].weight >= heap[Parent(i)].weight);
         }
 #endif
     }
@@ -20,10 +20,107 @@
 
 #ifndef SIMPLECHQUERY_H_INCLUDED
 #define SIMPLECHQUERY_H_INCLUDED
+
+//a node settled by the backward search from a target in a many-to-many query
+struct ManyToManyEntry {
+    NodeID node;
+    //index of the target in the list of distinct targets
+    unsigned target;
+    unsigned distance;
+    //next node towards the target
+    NodeID parent;
+};
+
+//backward search spaces of all targets grouped by node: the entries of node v are
+//entries[offsets[v]] to entries[offsets[v+1]], sorted by target index
+struct ManyToManyBuckets {
+    std::vector<unsigned> offsets;
+    std::vector<ManyToManyEntry> entries;
+
+    const ManyToManyEntry * Find(const NodeID node, const unsigned target) const {
+        const ManyToManyEntry * begin = entries.data() + offsets[node];
+        const ManyToManyEntry * end = entries.data() + offsets[node + 1];
+        const ManyToManyEntry * entry = std::lower_bound(begin, end, target,
+            [](const ManyToManyEntry & e, unsigned t) { return e.target < t; });
+        return (entry != end && entry->target == target) ? entry : NULL;
+    }
+};
+
+//the halves of every shortcut of a query graph, so paths are unpacked without searching the graph for
+//each half again. Arc 2*e is edge e from the node it is stored at to its target, arc 2*e+1 the other
+//way round; a shortcut arc from source to target consists of the arcs source -> middle and middle ->
+//target, an original arc keeps the node it leads to
+template<class EdgeDataT, class GraphT>
+class ShortcutTable {
+public:
+    explicit ShortcutTable(const GraphT * g) : _graph(g), _halves(4 * g->GetNumberOfEdges(), SPECIAL_EDGEID) {
+        for(NodeID node = 0; node < _graph->GetNumberOfNodes(); ++node) {
+            for(typename GraphT::EdgeIterator edge = _graph->BeginEdges(node); edge < _graph->EndEdges(node); ++edge) {
+                const NodeID target = _graph->GetTarget(edge);
+                const EdgeDataT & data = _graph->GetEdgeData(edge);
+                if(!data.shortcut) {
+                    _halves[4 * edge] = target;
+                    _halves[4 * edge + 2] = node;
+                    continue;
+                }
+                const NodeID middle = data.middleName.middle;
+                if(data.forward) {
+                    _halves[4 * edge] = FindArc(node, middle);
+                    _halves[4 * edge + 1] = FindArc(middle, target);
+                }
+                if(data.backward) {
+                    _halves[4 * edge + 2] = FindArc(target, middle);
+                    _halves[4 * edge + 3] = FindArc(middle, node);
+                }
+            }
+        }
+    }
+
+    //shortest arc from source to target, SPECIAL_EDGEID if there is none
+    unsigned FindArc(const NodeID source, const NodeID target) const {
+        unsigned arc = SPECIAL_EDGEID;
+        EdgeWeight smallestWeight = UINT_MAX;
+        for(typename GraphT::EdgeIterator edge = _graph->BeginEdges(source); edge < _graph->EndEdges(source); ++edge) {
+            const EdgeDataT & data = _graph->GetEdgeData(edge);
+            if(_graph->GetTarget(edge) == target && data.forward && data.distance < smallestWeight) {
+                arc = 2 * edge;
+                smallestWeight = data.distance;
+            }
+        }
+        if(arc != SPECIAL_EDGEID) {
+            return arc;
+        }
+        for(typename GraphT::EdgeIterator edge = _graph->BeginEdges(target); edge < _graph->EndEdges(target); ++edge) {
+            const EdgeDataT & data = _graph->GetEdgeData(edge);
+            if(_graph->GetTarget(edge) == source && data.backward && data.distance < smallestWeight) {
+                arc = 2 * edge + 1;
+                smallestWeight = data.distance;
+            }
+        }
+        return arc;
+    }
+
+    //append the original arcs of arc to path: the nodes they lead to or, with edgeNames, their names
+    void Unpack(const unsigned arc, std::vector<NodeID> & path, const bool edgeNames) const {
+        assert(arc != SPECIAL_EDGEID); //no edge found. This should not happen at all!
+        const EdgeDataT & data = _graph->GetEdgeData(arc >> 1);
+        if(data.shortcut) {
+            Unpack(_halves[2 * arc], path, edgeNames);
+            Unpack(_halves[2 * arc + 1], path, edgeNames);
+        } else {
+            path.push_back(edgeNames ? NodeID(data.middleName.nameID) : _halves[2 * arc]);
+        }
+    }
+
+private:
+    const GraphT * _graph;
+    std::vector<unsigned> _halves;
+};
+
 template<class EdgeDataT, class GraphT, class HeapT>
 class SimpleCHQuery {
 public:
-    SimpleCHQuery(GraphT * g, GraphT * r) : _graph(g), _range(r) {
+    SimpleCHQuery(GraphT * g, GraphT * r, const ShortcutTable<EdgeDataT, GraphT> * s) : _graph(g), _range(r), _shortcuts(s) {
         _forwardHeap = new HeapT(_graph->GetNumberOfNodes());
         _backwardHeap = new HeapT(_graph->GetNumberOfNodes());
         _rangeHeap = new HeapT(_range->GetNumberOfNodes());
@@ -56,7 +153,8 @@ public:
         return _upperbound;
     }
 
-    unsigned int ComputeRoute(const NodeID start, const NodeID target, vector<NodeID> & path) {
+    //shortest path from start to target appended to path as its nodes or, with edgeNames, the names of its edges
+    unsigned int ComputeRoute(const NodeID start, const NodeID target, vector<NodeID> & path, const bool edgeNames = false) {
         // double time = get_timestamp();
         NodeID middle = ( NodeID ) 0;
         unsigned int _upperbound = std::numeric_limits<unsigned int>::max();
@@ -80,31 +178,95 @@ public:
         }
 
         NodeID pathNode = middle;
-        deque< NodeID > packedPath;
-
+        _packedPath.clear();
+        _packedPath.push_back( middle );
         while ( pathNode != start ) {
             pathNode = _forwardHeap->GetData( pathNode ).parent;
-            packedPath.push_front( pathNode );
+            _packedPath.push_back( pathNode );
         }
-        //        NodeID realStart = pathNode;
-        packedPath.push_back( middle );
+        std::reverse( _packedPath.begin(), _packedPath.end() );
         pathNode = middle;
 
         while ( pathNode != target ){
             pathNode = _backwardHeap->GetData( pathNode ).parent;
-            packedPath.push_back( pathNode );
+            _packedPath.push_back( pathNode );
         }
 
-        path.push_back( packedPath[0] );
-        for(deque<NodeID>::size_type i = 0; i < packedPath.size()-1; i++) {
-            _UnpackEdge(packedPath[i], packedPath[i+1], path);
-        }
+        _UnpackPath( path, edgeNames );
+        return _upperbound;
+    }
 
-        packedPath.clear();
 
-        return _upperbound;
+    //settle the upward backward search space of target, entries are appended to space
+    void BackwardSearchSpace(const NodeID target, const unsigned targetIndex, std::vector<ManyToManyEntry> & space) {
+        _backwardHeap->Clear();
+        _backwardHeap->Insert(target, 0, target);
+        while(_backwardHeap->Size() > 0) {
+            NodeID node;
+            unsigned distance;
+            if(_UpwardStep(_backwardHeap, false, &node, &distance)) {
+                ManyToManyEntry entry = {node, targetIndex, distance, _backwardHeap->GetData(node).parent};
+                space.push_back(entry);
+            }
+        }
     }
 
+    //forward search from start scanning the buckets; computes the distance to every target in targetIndices
+    //(UINT_MAX if unreachable) and, if paths is given, the unpacked path to each of them (edge names with
+    //edgeNames, see ComputeRoute). best and middle are scratch arrays with one element per distinct target
+    void ManyToManyRoutes(const NodeID start, const std::vector<unsigned> & targetIndices, const std::vector<NodeID> & targets,
+                          const ManyToManyBuckets & buckets, std::vector<unsigned> & best, std::vector<NodeID> & middle,
+                          std::vector<unsigned> & distances, std::vector<std::vector<NodeID> > * paths,
+                          const bool edgeNames = false) {
+        for(unsigned i = 0; i < targetIndices.size(); ++i) {
+            best[targetIndices[i]] = std::numeric_limits<unsigned int>::max();
+        }
+        _forwardHeap->Clear();
+        _forwardHeap->Insert(start, 0, start);
+        while(_forwardHeap->Size() > 0) {
+            NodeID node;
+            unsigned distance;
+            if(!_UpwardStep(_forwardHeap, true, &node, &distance)) {
+                continue;
+            }
+            for(unsigned e = buckets.offsets[node]; e < buckets.offsets[node + 1]; ++e) {
+                const ManyToManyEntry & entry = buckets.entries[e];
+                const unsigned newDistance = distance + entry.distance;
+                if(newDistance < best[entry.target]) {
+                    best[entry.target] = newDistance;
+                    middle[entry.target] = node;
+                }
+            }
+        }
+
+        distances.resize(targetIndices.size());
+        if(paths) {
+            paths->assign(targetIndices.size(), std::vector<NodeID>());
+        }
+        for(unsigned i = 0; i < targetIndices.size(); ++i) {
+            const unsigned target = targetIndices[i];
+            distances[i] = best[target];
+            if(!paths || best[target] == std::numeric_limits<unsigned int>::max()) {
+                continue;
+            }
+            //packed path: forward search tree up to the middle node, then the bucket parents down to the target
+            _packedPath.clear();
+            NodeID pathNode = middle[target];
+            _packedPath.push_back( pathNode );
+            while ( pathNode != start ) {
+                pathNode = _forwardHeap->GetData( pathNode ).parent;
+                _packedPath.push_back( pathNode );
+            }
+            std::reverse( _packedPath.begin(), _packedPath.end() );
+            pathNode = middle[target];
+            while ( pathNode != targets[target] ) {
+                pathNode = buckets.Find( pathNode, target )->parent;
+                _packedPath.push_back( pathNode );
+            }
+
+            _UnpackPath( (*paths)[i], edgeNames );
+        }
+    }
 
     void RangeQuery(const NodeID start, const unsigned int maxDistance, std::vector<std::pair<NodeID, unsigned> > & resultNodes) {
         _rangeHeap->Clear();
@@ -229,49 +391,62 @@ private:
         }
     }
 
-    bool _UnpackEdge( const NodeID source, const NodeID target, std::vector< NodeID >& path ) {
-        assert(source != target);
-        //find edge first.
-        typename GraphT::EdgeIterator smallestEdge = SPECIAL_EDGEID;
-        EdgeWeight smallestWeight = UINT_MAX;
-        for(typename GraphT::EdgeIterator eit = _graph->BeginEdges(source); eit < _graph->EndEdges(source); eit++) {
-            const EdgeWeight weight = _graph->GetEdgeData(eit).distance;
-            {
-                if(_graph->GetTarget(eit) == target && weight < smallestWeight && _graph->GetEdgeData(eit).forward) {
-                    smallestEdge = eit; smallestWeight = weight;
+    //settle the next node of an upward search without a meeting test; returns false if the node is stalled
+    bool _UpwardStep(HeapT * heap, const bool forwardDirection, NodeID * settled, unsigned int * settledDistance) {
+        const NodeID node = heap->DeleteMin();
+        const unsigned int distance = heap->GetKey( node );
+        *settled = node;
+        *settledDistance = distance;
+
+        for ( typename GraphT::EdgeIterator edge = _graph->BeginEdges( node ); edge < _graph->EndEdges(node); edge++ ) {
+            const NodeID to = _graph->GetTarget(edge);
+            const EdgeWeight edgeWeight = _graph->GetEdgeData(edge).distance;
+
+            //Stalling
+            bool backwardDirectionFlag = (!forwardDirection) ? _graph->GetEdgeData(edge).forward : _graph->GetEdgeData(edge).backward;
+            if(backwardDirectionFlag && heap->WasInserted( to )) {
+                if(heap->GetKey( to ) + edgeWeight < distance) {
+                    return false;
                 }
             }
         }
-        if(smallestEdge == SPECIAL_EDGEID) {
-            for(typename GraphT::EdgeIterator eit = _graph->BeginEdges(target); eit < _graph->EndEdges(target); eit++) {
-                const EdgeWeight weight = _graph->GetEdgeData(eit).distance;
-                {
-                    if(_graph->GetTarget(eit) == source && weight < smallestWeight && _graph->GetEdgeData(eit).backward) {
-                        smallestEdge = eit; smallestWeight = weight;
-                    }
+        for ( typename GraphT::EdgeIterator edge = _graph->BeginEdges( node ); edge < _graph->EndEdges(node); edge++ ) {
+            const NodeID to = _graph->GetTarget(edge);
+            const EdgeWeight edgeWeight = _graph->GetEdgeData(edge).distance;
+
+            assert( edgeWeight > 0 );
+            const unsigned int toDistance = distance + edgeWeight;
+
+            bool forwardDirectionFlag = (forwardDirection ? _graph->GetEdgeData(edge).forward : _graph->GetEdgeData(edge).backward );
+            if(forwardDirectionFlag) {
+                if ( !heap->WasInserted( to ) ) {
+                    heap->Insert( to, toDistance, node );
+                }
+                else if ( toDistance < heap->GetKey( to ) ) {
+                    heap->GetData( to ).parent = node;
+                    heap->DecreaseKey( to, toDistance );
                 }
             }
         }
+        return true;
+    }
 
-        assert(smallestWeight != SPECIAL_EDGEID); //no edge found. This should not happen at all!
-
-        const EdgeDataT& ed = _graph->GetEdgeData(smallestEdge);
-        if(ed.shortcut)
-        {//unpack
-            const NodeID middle = ed.middleName.middle;
-            _UnpackEdge(source, middle, path);
-            _UnpackEdge(middle, target, path);
-            return false;
-        } else {
-            assert(!ed.shortcut);
-            path.push_back(target);
-            return true;
+    //unpack _packedPath into path, see ComputeRoute
+    void _UnpackPath( std::vector< NodeID >& path, const bool edgeNames ) {
+        if( !edgeNames ) {
+            path.push_back( _packedPath[0] );
+        }
+        for( unsigned i = 0; i + 1 < _packedPath.size(); ++i ) {
+            _shortcuts->Unpack( _shortcuts->FindArc( _packedPath[i], _packedPath[i+1] ), path, edgeNames );
         }
     }
 
 
     GraphT * _graph;
     GraphT * _range;
+    const ShortcutTable<EdgeDataT, GraphT> * _shortcuts;
+    //nodes of the shortest path in the hierarchy, before unpacking the shortcuts
+    std::vector<NodeID> _packedPath;
     HeapT * _forwardHeap;
     HeapT * _backwardHeap;
     HeapT * _rangeHeap;
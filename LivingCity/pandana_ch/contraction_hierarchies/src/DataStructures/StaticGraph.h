@@ -21,6 +21,9 @@ or see http://www.gnu.org/licenses/agpl.txt.
 #ifndef STATICGRAPH_H_INCLUDED
 #define STATICGRAPH_H_INCLUDED
 
+#include <cstdint>
+#include <cstring>
+#include <ostream>
 #include <vector>
 #ifdef _GLIBCXX_PARALLEL
 #include <parallel/algorithm>
@@ -80,6 +83,73 @@ public:
         }
     }
 
+    //construct from a graph written by Serialize, data is advanced past it.
+    //data must hold at least SerializedSize bytes (checked by the caller)
+    explicit StaticGraph( const char *&data ) {
+        uint64_t numNodeEntries, numEdgeEntries;
+        std::memcpy( &_numNodes, data, sizeof( _numNodes ) );
+        data += sizeof( _numNodes );
+        std::memcpy( &_numEdges, data, sizeof( _numEdges ) );
+        data += sizeof( _numEdges );
+        std::memcpy( &numNodeEntries, data, sizeof( numNodeEntries ) );
+        data += sizeof( numNodeEntries );
+        std::memcpy( &numEdgeEntries, data, sizeof( numEdgeEntries ) );
+        data += sizeof( numEdgeEntries );
+        _nodes.resize( numNodeEntries );
+        std::memcpy( _nodes.data(), data, numNodeEntries * sizeof( _StrNode ) );
+        data += numNodeEntries * sizeof( _StrNode );
+        _edges.resize( numEdgeEntries );
+        std::memcpy( _edges.data(), data, numEdgeEntries * sizeof( _StrEdge ) );
+        data += numEdgeEntries * sizeof( _StrEdge );
+    }
+
+    //write the node and edge arrays as raw records
+    void Serialize( std::ostream &out ) const {
+        const uint64_t numNodeEntries = _nodes.size();
+        const uint64_t numEdgeEntries = _edges.size();
+        out.write( reinterpret_cast< const char * >( &_numNodes ), sizeof( _numNodes ) );
+        out.write( reinterpret_cast< const char * >( &_numEdges ), sizeof( _numEdges ) );
+        out.write( reinterpret_cast< const char * >( &numNodeEntries ), sizeof( numNodeEntries ) );
+        out.write( reinterpret_cast< const char * >( &numEdgeEntries ), sizeof( numEdgeEntries ) );
+        out.write( reinterpret_cast< const char * >( _nodes.data() ), numNodeEntries * sizeof( _StrNode ) );
+        out.write( reinterpret_cast< const char * >( _edges.data() ), numEdgeEntries * sizeof( _StrEdge ) );
+    }
+
+    //size of a serialized graph starting at data, 0 if it does not fit in size bytes
+    static size_t SerializedSize( const char *data, size_t size ) {
+        const size_t header = sizeof( NodeIterator ) + sizeof( EdgeIterator ) + 2 * sizeof( uint64_t );
+        if ( size < header )
+            return 0;
+        uint64_t numNodeEntries, numEdgeEntries;
+        data += sizeof( NodeIterator ) + sizeof( EdgeIterator );
+        std::memcpy( &numNodeEntries, data, sizeof( numNodeEntries ) );
+        std::memcpy( &numEdgeEntries, data + sizeof( numNodeEntries ), sizeof( numEdgeEntries ) );
+        if ( numNodeEntries > size / sizeof( _StrNode ) || numEdgeEntries > size / sizeof( _StrEdge ) )
+            return 0;
+        const size_t total = header + numNodeEntries * sizeof( _StrNode ) + numEdgeEntries * sizeof( _StrEdge );
+        return total <= size ? total : 0;
+    }
+
+    //edges of the graph as given to the constructor, e.g. to build it again with other node ids
+    void GetEdges( std::vector< InputEdge > &edges ) const {
+        edges.clear();
+        edges.reserve( _edges.size() );
+        for ( NodeIterator node = 0; node < _numNodes; ++node ) {
+            for ( EdgeIterator i = BeginEdges( node ), e = EndEdges( node ); i != e; ++i ) {
+                InputEdge edge;
+                edge.source = node;
+                edge.target = _edges[i].target;
+                edge.data = _edges[i].data;
+                edges.push_back( edge );
+            }
+        }
+    }
+
+    //size of an edge record, stored to detect layout changes of EdgeData
+    static size_t EdgeRecordSize() {
+        return sizeof( _StrEdge );
+    }
+
     unsigned GetNumberOfNodes() const {
         return _numNodes;
     }
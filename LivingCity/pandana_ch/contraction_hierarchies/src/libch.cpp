@@ -20,26 +20,56 @@ or see http://www.gnu.org/licenses/agpl.txt.
 
 #include "libch.h"
 #include "POIIndex/POIIndex.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
 #ifdef _OPENMP
+#include <omp.h>
 #include "Util/HyperThreading.h"
 #endif
 namespace CH {
 
+namespace {
+const char kPreprocessingMagic[8] = {'C', 'H', 'G', 'R', 'A', 'P', 'H', '\0'};
+//bump when the file layout changes
+const uint32_t kPreprocessingVersion = 3;
+
+struct PreprocessingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t edgeRecordSize;
+    uint64_t key;
+};
+
+//use the many-to-many search if at least this fraction of the distinct sources x distinct targets matrix is requested
+const double kManyToManyMinDensity = 0.25;
+}
+
 inline ostream& operator<< (ostream& os, const Edge& e) {
     os << "[" << e.name() << "]= (" << e.source() << (e.backward ? "<" : "") << "-" << (e.forward ? ">" : "") << e.target() << ")|" << e.weight();
     return os;
 }
     ContractionHierarchies::ContractionHierarchies() : numberOfThreads(1){
         contractor  = NULL;
+        customizableContractor = NULL;
         staticGraph = NULL;
         rangeGraph = NULL;
+        shortcutTable = NULL;
     }
 
     ContractionHierarchies::ContractionHierarchies(unsigned _n) : numberOfThreads(_n){
         CHASSERT(numberOfThreads != 0, "At least one query thread must be given");
         contractor  = NULL;
+        customizableContractor = NULL;
         staticGraph = NULL;
 		rangeGraph = NULL;
+		shortcutTable = NULL;
 //#ifdef _OPENMP
 //        omp_set_num_threads(12);
 //#endif
@@ -56,6 +86,8 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
         
         //delete all objects, clean up space
         CHDELETE (contractor );
+        CHDELETE (customizableContractor);
+        CHDELETE (shortcutTable);
         CHDELETE (staticGraph);
         CHDELETE (rangeGraph);
 
@@ -86,7 +118,6 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 			this->edgeList.push_back(ev[i]);
 		}
 		CHASSERT(ev.size() == this->edgeList.size(), "edge lists sizes differ");
-		this->contractor = new Contractor( this->nodeVector.size(), this->edgeList );
         this->rangeGraph = BuildRangeGraph(this->nodeVector.size(), this->edgeList);        
 	}
 
@@ -96,6 +127,7 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 
 	void ContractionHierarchies::RunPreprocessing() {
 		//build CH
+		this->contractor = new Contractor( this->nodeVector.size(), this->edgeList );
 		this->contractor->Run();
 
 		//clean CH
@@ -110,16 +142,234 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 		delete cleanup;
 
 		//build query object
-		this->staticGraph = new QueryGraph(this->nodeVector.size(), cleanedEdgeList);
-		for(unsigned i = 0; i < numberOfThreads; ++i) {
-		    queryObjects.push_back(new SimpleCHQuery<EdgeData, QueryGraph, Heap>(this->staticGraph, this->rangeGraph));
-		}
+		SetQueryGraph(cleanedEdgeList);
 		//std::cout << "finished constructing query objects" << std::endl;
 		//deconstruct contractor?
 		CHDELETE(this->contractor);
 		//std::cout << "destructed contractor" << std::endl;
 	}
 
+	void ContractionHierarchies::RunCustomizablePreprocessing() {
+		CHASSERT(this->edgeList.size(), "EdgeList unset");
+		this->customizableContractor = new CustomizableContractor( this->nodeVector.size(), this->edgeList );
+		this->customizableContractor->Customize( this->edgeList );
+
+		std::vector< InputEdge> customizedEdgeList;
+		this->customizableContractor->GetEdges( customizedEdgeList );
+		SetQueryGraph(customizedEdgeList);
+	}
+
+	void ContractionHierarchies::UpdateEdgeWeights(const vector<EdgeWeight> & weights) {
+		CHASSERT(this->customizableContractor != NULL, "Customizable preprocessing not finished");
+		CHASSERT(weights.size() == this->edgeList.size(), "One weight per edge is needed");
+		for(unsigned i = 0; i < weights.size(); i++) {
+			this->edgeList[i]._weight = weights[i];
+		}
+		CHDELETE(this->rangeGraph);
+		this->rangeGraph = BuildRangeGraph(this->nodeVector.size(), this->edgeList);
+
+		this->customizableContractor->Customize( this->edgeList );
+		std::vector< InputEdge> customizedEdgeList;
+		this->customizableContractor->GetEdges( customizedEdgeList );
+		SetQueryGraph(customizedEdgeList);
+		//the indices refer to the old graph
+		poiIndexMap.clear();
+	}
+
+	void ContractionHierarchies::SetQueryGraph(std::vector< InputEdge > & edges) {
+		for(unsigned i = 0; i < queryObjects.size(); i++) {
+			delete queryObjects[i];
+		}
+		queryObjects.clear();
+		CHDELETE(this->shortcutTable);
+		CHDELETE(this->staticGraph);
+
+		RenumberEdges(edges);
+		this->staticGraph = new QueryGraph(this->nodeVector.size(), edges);
+		SetQueryObjects();
+	}
+
+	void ContractionHierarchies::SetQueryObjects() {
+		this->shortcutTable = new QueryShortcutTable(this->staticGraph);
+		for(unsigned i = 0; i < numberOfThreads; ++i) {
+		    queryObjects.push_back(new SimpleCHQuery<EdgeData, QueryGraph, Heap>(this->staticGraph, this->rangeGraph,
+		                                                                         this->shortcutTable));
+		}
+	}
+
+	void ContractionHierarchies::RenumberEdges(std::vector< InputEdge > & edges) const {
+		if(this->nodeOrder.empty())
+			return;
+		for(unsigned i = 0; i < edges.size(); ++i) {
+			edges[i].source = this->nodeOrder[edges[i].source];
+			edges[i].target = this->nodeOrder[edges[i].target];
+			if(edges[i].data.shortcut) {
+				edges[i].data.middleName.middle = this->nodeOrder[edges[i].data.middleName.middle];
+			}
+		}
+	}
+
+	void ContractionHierarchies::ReorderNodes() {
+		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
+		CHASSERT(this->nodeOrder.empty(), "Nodes already reordered");
+		const unsigned numberOfNodes = this->staticGraph->GetNumberOfNodes();
+
+		//the query graph only keeps the edges upwards in the hierarchy; collect the nodes below every node
+		vector<unsigned> firstBelow(numberOfNodes + 1, 0);
+		for(NodeID node = 0; node < numberOfNodes; ++node) {
+			for(EdgeID edge = staticGraph->BeginEdges(node); edge < staticGraph->EndEdges(node); ++edge) {
+				++firstBelow[staticGraph->GetTarget(edge) + 1];
+			}
+		}
+		for(NodeID node = 0; node < numberOfNodes; ++node) {
+			firstBelow[node + 1] += firstBelow[node];
+		}
+		vector<NodeID> below(firstBelow.back());
+		vector<unsigned> position(firstBelow.begin(), firstBelow.end() - 1);
+		for(NodeID node = 0; node < numberOfNodes; ++node) {
+			for(EdgeID edge = staticGraph->BeginEdges(node); edge < staticGraph->EndEdges(node); ++edge) {
+				below[position[staticGraph->GetTarget(edge)]++] = node;
+			}
+		}
+
+		//depth-first from the top nodes: every node is numbered right after a node above it, so the nodes
+		//of an upward search are mostly close to each other
+		vector<NodeID> order(numberOfNodes, SPECIAL_NODEID);
+		vector<NodeID> nodes;
+		nodes.reserve(numberOfNodes);
+		vector<NodeID> stack;
+		for(NodeID top = 0; top < numberOfNodes; ++top) {
+			if(staticGraph->BeginEdges(top) != staticGraph->EndEdges(top)) {
+				continue;
+			}
+			stack.push_back(top);
+			while(!stack.empty()) {
+				const NodeID node = stack.back();
+				stack.pop_back();
+				if(order[node] != SPECIAL_NODEID) {
+					continue;
+				}
+				order[node] = nodes.size();
+				nodes.push_back(node);
+				for(unsigned i = firstBelow[node + 1]; i > firstBelow[node]; --i) {
+					if(order[below[i - 1]] == SPECIAL_NODEID) {
+						stack.push_back(below[i - 1]);
+					}
+				}
+			}
+		}
+		CHASSERT(nodes.size() == numberOfNodes, "Query graph is not a hierarchy");
+
+		std::vector< InputEdge > rangeEdges, queryEdges;
+		this->rangeGraph->GetEdges(rangeEdges);
+		this->staticGraph->GetEdges(queryEdges);
+		this->nodeOrder.swap(order);
+		this->orderedNodes.swap(nodes);
+		RenumberEdges(rangeEdges);
+		CHDELETE(this->rangeGraph);
+		this->rangeGraph = new QueryGraph(numberOfNodes, rangeEdges);
+		SetQueryGraph(queryEdges);
+		//the indices refer to the old graph
+		poiIndexMap.clear();
+	}
+
+	bool ContractionHierarchies::SavePreprocessing(const std::string &filename, uint64_t key) const {
+		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
+		PreprocessingHeader header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, kPreprocessingMagic, sizeof(kPreprocessingMagic));
+		header.version = kPreprocessingVersion;
+		header.edgeRecordSize = QueryGraph::EdgeRecordSize();
+		header.key = key;
+
+		//write to a temporary file first so a reader never maps a partial file; graphs with the same key
+		//may be saved in parallel, so every writer has its own
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".tmp%p", (const void *)this);
+		const std::string tmpname = filename + suffix;
+		std::ofstream out(tmpname, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		this->staticGraph->Serialize(out);
+		this->rangeGraph->Serialize(out);
+		//node order of ReorderNodes (empty if not reordered)
+		const uint64_t orderSize = this->nodeOrder.size();
+		out.write(reinterpret_cast<const char *>(&orderSize), sizeof(orderSize));
+		out.write(reinterpret_cast<const char *>(this->nodeOrder.data()), orderSize * sizeof(NodeID));
+		out.close();
+		if (!out || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+			std::remove(tmpname.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	bool ContractionHierarchies::LoadPreprocessing(const std::string &filename, uint64_t key) {
+		CHASSERT(this->nodeVector.size(), "NodeVector unset");
+		CHASSERT(this->staticGraph == NULL, "Preprocessing already finished");
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(PreprocessingHeader)) {
+			close(fd);
+			return false;
+		}
+		void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED)
+			return false;
+
+		const char *data = static_cast<const char *>(map);
+		const char *end = data + info.st_size;
+		PreprocessingHeader header;
+		std::memcpy(&header, data, sizeof(header));
+		data += sizeof(header);
+		bool valid = std::memcmp(header.magic, kPreprocessingMagic, sizeof(kPreprocessingMagic)) == 0 &&
+		             header.version == kPreprocessingVersion &&
+		             header.edgeRecordSize == QueryGraph::EdgeRecordSize() && header.key == key;
+		//query graph followed by range graph and node order
+		const size_t staticSize = valid ? QueryGraph::SerializedSize(data, end - data) : 0;
+		const size_t rangeSize = staticSize ? QueryGraph::SerializedSize(data + staticSize, end - data - staticSize) : 0;
+		uint64_t orderSize = 0;
+		if (rangeSize && (size_t)(end - data) - staticSize - rangeSize >= sizeof(orderSize)) {
+			std::memcpy(&orderSize, data + staticSize + rangeSize, sizeof(orderSize));
+			valid = (orderSize == 0 || orderSize == this->nodeVector.size()) &&
+			        orderSize * sizeof(NodeID) <= (size_t)(end - data) - staticSize - rangeSize - sizeof(orderSize);
+		} else {
+			valid = false;
+		}
+		if (valid) {
+			this->staticGraph = new QueryGraph(data);
+			this->rangeGraph = new QueryGraph(data);
+			data += sizeof(orderSize);
+			this->nodeOrder.resize(orderSize);
+			std::memcpy(this->nodeOrder.data(), data, orderSize * sizeof(NodeID));
+			this->orderedNodes.assign(orderSize, SPECIAL_NODEID);
+			for (NodeID node = 0; node < orderSize; ++node) {
+				if (this->nodeOrder[node] < orderSize)
+					this->orderedNodes[this->nodeOrder[node]] = node;
+			}
+			valid = this->staticGraph->GetNumberOfNodes() == this->nodeVector.size() &&
+			        this->rangeGraph->GetNumberOfNodes() == this->nodeVector.size() &&
+			        std::find(this->orderedNodes.begin(), this->orderedNodes.end(), SPECIAL_NODEID) ==
+			        this->orderedNodes.end();
+			if (!valid) {
+				CHDELETE(this->staticGraph);
+				CHDELETE(this->rangeGraph);
+				this->nodeOrder.clear();
+				this->orderedNodes.clear();
+			}
+		}
+		munmap(map, info.st_size);
+		if (!valid)
+			return false;
+
+		SetQueryObjects();
+		return true;
+	}
+
 	QueryGraph * ContractionHierarchies::BuildRangeGraph(const int nodes, const std::vector< Edge >& inputEdges) {
 	    QueryGraph * _graph;
         std::vector< InputEdge > edges;
@@ -209,6 +459,7 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
         //INFO("Range graph removed " << edges.size() - edge << " edges of " << edges.size());
         assert(edge <= edges.size());
         edges.resize( edge );
+        RenumberEdges( edges );
         _graph = new QueryGraph( nodes, edges );
         std::vector< InputEdge >().swap( edges );
         return _graph;
@@ -281,6 +532,154 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 		return queryObjects[threadID]->ComputeRoute(start, target, ResultingPath);
 	}
 
+    void ContractionHierarchies::computeShortestPaths(const vector<NodeID> & sources, const vector<NodeID> & targets,
+                                                      vector<vector<NodeID> > * paths, vector<unsigned> * distances,
+                                                      bool edgePaths){
+		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
+		CHASSERT(sources.size() == targets.size(), "Sources and targets differ in size");
+		const unsigned numberOfPairs = sources.size();
+		if(paths) {
+			paths->assign(numberOfPairs, vector<NodeID>());
+		}
+		if(distances) {
+			distances->assign(numberOfPairs, UINT_MAX);
+		}
+
+		//distinct valid sources and targets in order of appearance
+		const NodeID invalid(UINT_MAX);
+		vector<NodeID> sourceIndex(numberOfPairs, invalid), targetIndex(numberOfPairs, invalid);
+		vector<NodeID> distinctSources, distinctTargets;
+		vector<vector<unsigned> > pairsOfSource;
+		std::unordered_map<NodeID, NodeID> sourceIds, targetIds;
+		unsigned numberOfValidPairs = 0;
+		for(unsigned i = 0; i < numberOfPairs; ++i) {
+			if(sources[i] >= nodeVector.size() || targets[i] >= nodeVector.size()) {
+				continue;
+			}
+			++numberOfValidPairs;
+			std::pair<std::unordered_map<NodeID, NodeID>::iterator, bool> s =
+				sourceIds.insert(std::make_pair(sources[i], NodeID(distinctSources.size())));
+			if(s.second) {
+				distinctSources.push_back(sources[i]);
+				pairsOfSource.push_back(vector<unsigned>());
+			}
+			sourceIndex[i] = s.first->second;
+			pairsOfSource[sourceIndex[i]].push_back(i);
+			std::pair<std::unordered_map<NodeID, NodeID>::iterator, bool> t =
+				targetIds.insert(std::make_pair(targets[i], NodeID(distinctTargets.size())));
+			if(t.second) {
+				distinctTargets.push_back(targets[i]);
+			}
+			targetIndex[i] = t.first->second;
+		}
+
+		//buckets need fewer searches than pairwise routing and a dense matrix, or the
+		//forward searches scan bucket entries of targets no source asked for
+		const double matrixSize = double(distinctSources.size()) * double(distinctTargets.size());
+		if(distinctSources.size() + distinctTargets.size() < 2 * numberOfValidPairs &&
+		   numberOfValidPairs >= kManyToManyMinDensity * matrixSize) {
+			computeManyToMany(sources, targetIndex, distinctTargets, pairsOfSource, paths, distances, edgePaths);
+			return;
+		}
+
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided) num_threads(numberOfThreads)
+#endif
+		for(int i = 0; i < (int)numberOfPairs; ++i) {
+			if(sourceIndex[i] == invalid) {
+				continue;
+			}
+#ifdef _OPENMP
+			const unsigned threadID = omp_get_thread_num();
+#else
+			const unsigned threadID = 0;
+#endif
+			vector<NodeID> path;
+			const unsigned distance = queryObjects[threadID]->ComputeRoute(sources[i], targets[i], path, edgePaths);
+			if(distances) {
+				(*distances)[i] = distance;
+			}
+			if(paths) {
+				(*paths)[i].swap(path);
+			}
+		}
+	}
+
+	void ContractionHierarchies::computeManyToMany(const vector<NodeID> & sources, const vector<NodeID> & targetIndex,
+	                                               const vector<NodeID> & distinctTargets, const vector<vector<unsigned> > & pairsOfSource,
+	                                               vector<vector<NodeID> > * paths, vector<unsigned> * distances,
+	                                               bool edgePaths){
+		//backward search space of every target
+		vector<vector<ManyToManyEntry> > spaces(distinctTargets.size());
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(guided) num_threads(numberOfThreads)
+#endif
+		for(int t = 0; t < (int)distinctTargets.size(); ++t) {
+#ifdef _OPENMP
+			const unsigned threadID = omp_get_thread_num();
+#else
+			const unsigned threadID = 0;
+#endif
+			queryObjects[threadID]->BackwardSearchSpace(distinctTargets[t], t, spaces[t]);
+		}
+
+		//group the entries by node; filling in target order keeps every bucket sorted by target
+		ManyToManyBuckets buckets;
+		buckets.offsets.assign(nodeVector.size() + 1, 0);
+		for(unsigned t = 0; t < spaces.size(); ++t) {
+			for(unsigned e = 0; e < spaces[t].size(); ++e) {
+				++buckets.offsets[spaces[t][e].node + 1];
+			}
+		}
+		for(unsigned v = 0; v < nodeVector.size(); ++v) {
+			buckets.offsets[v + 1] += buckets.offsets[v];
+		}
+		buckets.entries.resize(buckets.offsets.back());
+		vector<unsigned> position(buckets.offsets.begin(), buckets.offsets.end() - 1);
+		for(unsigned t = 0; t < spaces.size(); ++t) {
+			for(unsigned e = 0; e < spaces[t].size(); ++e) {
+				buckets.entries[position[spaces[t][e].node]++] = spaces[t][e];
+			}
+			vector<ManyToManyEntry>().swap(spaces[t]);
+		}
+
+		//one forward search per source
+#ifdef _OPENMP
+		#pragma omp parallel num_threads(numberOfThreads)
+#endif
+		{
+#ifdef _OPENMP
+			const unsigned threadID = omp_get_thread_num();
+#else
+			const unsigned threadID = 0;
+#endif
+			vector<unsigned> best(distinctTargets.size());
+			vector<NodeID> middle(distinctTargets.size());
+			vector<unsigned> sourceTargets, sourceDistances;
+			vector<vector<NodeID> > sourcePaths;
+#ifdef _OPENMP
+			#pragma omp for schedule(guided)
+#endif
+			for(int s = 0; s < (int)pairsOfSource.size(); ++s) {
+				const vector<unsigned> & pairs = pairsOfSource[s];
+				sourceTargets.resize(pairs.size());
+				for(unsigned p = 0; p < pairs.size(); ++p) {
+					sourceTargets[p] = targetIndex[pairs[p]];
+				}
+				queryObjects[threadID]->ManyToManyRoutes(sources[pairs[0]], sourceTargets, distinctTargets, buckets,
+				                                         best, middle, sourceDistances, paths ? &sourcePaths : NULL, edgePaths);
+				for(unsigned p = 0; p < pairs.size(); ++p) {
+					if(distances) {
+						(*distances)[pairs[p]] = sourceDistances[p];
+					}
+					if(paths) {
+						(*paths)[pairs[p]].swap(sourcePaths[p]);
+					}
+				}
+			}
+		}
+	}
+
     void ContractionHierarchies::computeReachableNodesWithin(const Node &s, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes){
         computeReachableNodesWithin(s, maxDistance, ResultingNodes, 0);
     }
@@ -21,6 +21,7 @@ or see http://www.gnu.org/licenses/agpl.txt.
 #define LIBCH_H_INCLUDED
 
 #include <cassert>
+#include <cstdint>
 #include <ostream>
 #include <iostream>
 #include <string>
@@ -30,6 +31,7 @@ or see http://www.gnu.org/licenses/agpl.txt.
 #include "BasicDefinitions.h"
 #include "Contractor/ContractionCleanup.h"
 #include "Contractor/Contractor.h"
+#include "Contractor/CustomizableContractor.h"
 #include "DataStructures/SimpleCHQuery.h"
 #include "DataStructures/StaticGraph.h"
 #include "POIIndex/POIIndex.h"
@@ -41,12 +43,15 @@ struct _HeapData {
     _HeapData( NodeID p ) : parent(p) { }
 };
 
-typedef BinaryHeap< NodeID, NodeID, EdgeWeight, _HeapData, ArrayStorage<NodeID, NodeID> > Heap;
+//query heaps are cleared twice per route: timestamped positions skip the nodes of earlier searches, and
+//the 4-ary heap is shallower than a binary one
+typedef BinaryHeap< NodeID, NodeID, EdgeWeight, _HeapData, TimestampStorage<NodeID, NodeID>, 4 > Heap;
 
 typedef ContractionCleanup::Edge::EdgeData EdgeData;
 typedef StaticGraph<EdgeData>::InputEdge InputEdge;
 typedef StaticGraph< EdgeData > QueryGraph;
 typedef vector<SimpleCHQuery<EdgeData, QueryGraph, Heap> > QueryObjectVector;
+typedef ShortcutTable<EdgeData, QueryGraph> QueryShortcutTable;
 
 typedef CH::POIIndex< QueryGraph > CHPOIIndex;
 typedef std::string POIKeyType;
@@ -117,10 +122,36 @@ typedef std::vector<std::pair<NodeID, unsigned> > ReachedNode;
 		void SetNodeVector( const vector<Node> & nv);
 		void SetEdgeVector( const vector<Edge> & e);
 		void RunPreprocessing();
+		//metric-independent contraction (see CustomizableContractor) followed by a customization for the
+		//weights of the edge vector; afterwards UpdateEdgeWeights replaces the weights without contracting again
+		void RunCustomizablePreprocessing();
+		//new weights for the edges of SetEdgeVector (same order). Needs RunCustomizablePreprocessing;
+		//POI indices are dropped and have to be created again
+		void UpdateEdgeWeights(const vector<EdgeWeight> & weights);
+		//write the query and range graphs; key identifies the input graph (e.g. a hash of its edges)
+		bool SavePreprocessing(const std::string &filename, uint64_t key) const;
+		//map graphs written by SavePreprocessing instead of setting the edges and running the preprocessing.
+		//returns false if the file is missing, of another version or written for another key
+		bool LoadPreprocessing(const std::string &filename, uint64_t key);
+		//renumber the nodes of the query and range graphs in a depth-first order of the hierarchy, so a search
+		//touches nearby node, edge and heap records. Afterwards every query and POI takes and returns the new
+		//ids (see GetNodeOrder); POI indices are dropped and have to be created again
+		void ReorderNodes();
+		//id of every node of SetNodeVector in the query graphs, empty if the nodes are not reordered
+		const vector<NodeID> & GetNodeOrder() const { return nodeOrder; }
+		//node of SetNodeVector of every id in the query graphs, empty if the nodes are not reordered
+		const vector<NodeID> & GetOrderedNodes() const { return orderedNodes; }
         int computeLengthofShortestPath(const Node &s, const Node& t);
         int computeLengthofShortestPath(const Node &s, const Node& t, unsigned threadID);
         int computeShortestPath(const Node &s, const Node& t, vector<NodeID> & ResultingPath);
         int computeShortestPath(const Node &s, const Node& t, vector<NodeID> & ResultingPath, unsigned threadID);
+        //shortest paths (if paths is not NULL) and distances of the pairs (sources[i], targets[i]), computed in
+        //parallel. If the pairs are dense in the matrix of distinct sources x distinct targets, one backward search
+        //per target fills buckets that are scanned by one forward search per source; otherwise each pair is routed.
+        //Unreachable or invalid pairs get an empty path and a distance of UINT_MAX. With edgePaths the paths are
+        //the names of their edges (Edge::name) instead of their nodes
+        void computeShortestPaths(const vector<NodeID> & sources, const vector<NodeID> & targets,
+                                  vector<vector<NodeID> > * paths, vector<unsigned> * distances, bool edgePaths = false);
         int computeVerificationLengthofShortestPath(const Node &s, const Node& t);
         void computeReachableNodesWithin(const Node &s, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes);
         void computeReachableNodesWithin(const Node &s, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes, unsigned threadID);
@@ -147,12 +178,25 @@ typedef std::vector<std::pair<NodeID, unsigned> > ReachedNode;
 	private:
 		unsigned numberOfThreads;
 		QueryGraph * BuildRangeGraph(const int nodes, const std::vector< Edge >& inputEdges);
+		//replace the query graph and the query objects, edges are given between nodes of SetNodeVector
+		void SetQueryGraph(std::vector< InputEdge > & edges);
+		//build the shortcut table and one query object per thread for staticGraph and rangeGraph
+		void SetQueryObjects();
+		//map the nodes of the edges (and shortcut middle nodes) to their ids of ReorderNodes
+		void RenumberEdges(std::vector< InputEdge > & edges) const;
+		void computeManyToMany(const vector<NodeID> & sources, const vector<NodeID> & targetIndex,
+		                       const vector<NodeID> & distinctTargets, const vector<vector<unsigned> > & pairsOfSource,
+		                       vector<vector<NodeID> > * paths, vector<unsigned> * distances, bool edgePaths);
 		vector<Node> nodeVector;
 		vector<Edge> edgeList;
+		vector<NodeID> nodeOrder;
+		vector<NodeID> orderedNodes;
 
 		Contractor* contractor;
+		CustomizableContractor* customizableContractor;
 		QueryGraph * staticGraph;
 		QueryGraph * rangeGraph;
+		QueryShortcutTable * shortcutTable;
 		vector<SimpleCHQuery<EdgeData, QueryGraph, Heap> *> queryObjects;
         CHPOIIndexMap poiIndexMap;
 	};
@@ -1,11 +1,53 @@
 #include "graphalg.h"
 #include <math.h>
+#include <cstdio>
 
 namespace MTC {
 namespace accessibility {
+
+namespace {
+vector<unsigned int> edgeColumn(const vector< vector<long> > &edges, int i) {
+    vector<unsigned int> column(edges.size());
+    for (size_t e = 0 ; e < edges.size() ; e++) {
+        column[e] = edges[e][i];
+    }
+    return column;
+}
+
+// FNV-1a hash of the CH input, used to key the preprocessing file
+uint64_t hashGraph(int numnodes, const vector<CH::Edge> &edges,
+                   bool reorderNodes) {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](uint64_t value) {
+        for (int i = 0 ; i < 8 ; i++) {
+            hash ^= (value >> (8 * i)) & 0xFF;
+            hash *= 1099511628211ull;
+        }
+    };
+    mix(numnodes);
+    mix(reorderNodes);
+    for (const auto &e : edges) {
+        mix(e.source());
+        mix(e.target());
+        mix(e.name());
+        mix(e.weight());
+        mix(e.isForward() | (e.isBackward() << 1));
+    }
+    return hash;
+}
+}  // namespace
+
 Graphalg::Graphalg(
         int numnodes, vector< vector<long> > edges, vector<double> edgeweights,
-        bool twoway) {
+        bool twoway)
+    : Graphalg(numnodes, edgeColumn(edges, 0), edgeColumn(edges, 1),
+               edgeweights, twoway) {}
+
+Graphalg::Graphalg(
+        int numnodes, const vector<unsigned int> &heads,
+        const vector<unsigned int> &tails, const vector<double> &edgeweights,
+        bool twoway, const std::string &cachePath, bool customizable,
+        bool reorderNodes) {
     this->numnodes = numnodes;
 
     int num = omp_get_max_threads();
@@ -30,26 +72,80 @@ Graphalg::Graphalg(
     ch.SetNodeVector(nv);
 
     vector<CH::Edge> ev;
+    ev.reserve(heads.size());
 
-    for (int i = 0 ; i < edges.size() ; i++) {
-        CH::Edge e(edges[i][0], edges[i][1], i,
+    for (int i = 0 ; i < heads.size() ; i++) {
+        CH::Edge e(heads[i], tails[i], i,
             edgeweights[i]*DISTANCEMULTFACT, true, twoway);
         ev.push_back(e);
     }
 
+    if (customizable) {
+        FILE_LOG(logINFO) << "Setting CH edge vector of size "
+                          << ev.size() << "\n";
+        ch.SetEdgeVector(ev);
+        ch.RunCustomizablePreprocessing();
+        if (reorderNodes) {
+            ch.ReorderNodes();
+        }
+        return;
+    }
+
+    // reuse the preprocessing of an earlier run on the same graph
+    std::string cacheFile;
+    uint64_t key = 0;
+    if (!cachePath.empty()) {
+        key = hashGraph(numnodes, ev, reorderNodes);
+        char name[32];
+        snprintf(name, sizeof(name), "ch_%016llx.bin",
+                 static_cast<unsigned long long>(key));
+        cacheFile = cachePath + name;
+        if (ch.LoadPreprocessing(cacheFile, key)) {
+            FILE_LOG(logINFO) << "Loaded contraction hierarchies from "
+                              << cacheFile << "\n";
+            return;
+        }
+    }
+
     FILE_LOG(logINFO) << "Setting CH edge vector of size "
                       << ev.size() << "\n";
     
     ch.SetEdgeVector(ev);
     ch.RunPreprocessing();
+    if (reorderNodes) {
+        ch.ReorderNodes();
+    }
+
+    if (!cacheFile.empty() && !ch.SavePreprocessing(cacheFile, key)) {
+        FILE_LOG(logINFO) << "Could not write contraction hierarchies to "
+                          << cacheFile << "\n";
+    }
+}
+
+
+void Graphalg::UpdateEdgeWeights(const vector<double> &edgeweights) {
+    vector<EdgeWeight> weights(edgeweights.size());
+    for (int i = 0 ; i < edgeweights.size() ; i++) {
+        weights[i] = edgeweights[i]*DISTANCEMULTFACT;
+    }
+    ch.UpdateEdgeWeights(weights);
+}
+
+
+vector<NodeID> Graphalg::chNodes(const vector<NodeID> &nodes) const {
+    vector<NodeID> ids(nodes.size());
+    for (int i = 0 ; i < nodes.size() ; i++) {
+        ids[i] = chNode(nodes[i]);
+    }
+    return ids;
 }
 
 
 std::vector<NodeID> Graphalg::Route(int src, int tgt, int threadNum) {
     std::vector<NodeID> ResultingPath;
 
-    CH::Node src_node(src, 0, 0);
-    CH::Node tgt_node(tgt, 0, 0);
+    CH::Node src_node(chNode(src), 0, 0);
+    CH::Node tgt_node(chNode(tgt), 0, 0);
 
     ch.computeShortestPath(
         src_node,
@@ -57,13 +153,16 @@ std::vector<NodeID> Graphalg::Route(int src, int tgt, int threadNum) {
         ResultingPath,
         threadNum);
 
+    for (int i = 0 ; i < ResultingPath.size() ; i++) {
+        ResultingPath[i] = graphNode(ResultingPath[i]);
+    }
     return ResultingPath;
 }
 
 
 double Graphalg::Distance(int src, int tgt, int threadNum) {
-    CH::Node src_node(src, 0, 0);
-    CH::Node tgt_node(tgt, 0, 0);
+    CH::Node src_node(chNode(src), 0, 0);
+    CH::Node tgt_node(chNode(tgt), 0, 0);
 
     unsigned int length = ch.computeLengthofShortestPath(
         src_node,
@@ -74,9 +173,48 @@ double Graphalg::Distance(int src, int tgt, int threadNum) {
 }
 
 
+std::vector<std::vector<NodeID> > Graphalg::Routes(
+    const std::vector<NodeID> &sources, const std::vector<NodeID> &targets) {
+    std::vector<std::vector<NodeID> > ResultingPaths;
+    ch.computeShortestPaths(chNodes(sources), chNodes(targets),
+                            &ResultingPaths, NULL);
+
+    for (int i = 0 ; i < ResultingPaths.size() ; i++) {
+        for (int j = 0 ; j < ResultingPaths[i].size() ; j++) {
+            ResultingPaths[i][j] = graphNode(ResultingPaths[i][j]);
+        }
+    }
+    return ResultingPaths;
+}
+
+
+std::vector<std::vector<NodeID> > Graphalg::EdgeRoutes(
+    const std::vector<NodeID> &sources, const std::vector<NodeID> &targets) {
+    std::vector<std::vector<NodeID> > ResultingPaths;
+    ch.computeShortestPaths(chNodes(sources), chNodes(targets),
+                            &ResultingPaths, NULL, true);
+    return ResultingPaths;
+}
+
+
+std::vector<double> Graphalg::Distances(
+    const std::vector<NodeID> &sources, const std::vector<NodeID> &targets) {
+    std::vector<unsigned> lengths;
+    ch.computeShortestPaths(chNodes(sources), chNodes(targets), NULL,
+                            &lengths);
+
+    std::vector<double> distances(lengths.size());
+    for (int i = 0 ; i < lengths.size() ; i++) {
+        distances[i] = static_cast<double>(lengths[i]) /
+            static_cast<double>(DISTANCEMULTFACT);
+    }
+    return distances;
+}
+
+
 void Graphalg::Range(int src, double maxdist, int threadNum,
                      DistanceVec &ResultingNodes) {
-    CH::Node src_node(src, 0, 0);
+    CH::Node src_node(chNode(src), 0, 0);
 
     std::vector<std::pair<NodeID, unsigned> > tmp;
 
@@ -88,7 +226,7 @@ void Graphalg::Range(int src, double maxdist, int threadNum,
 
     for (int i = 0 ; i < tmp.size() ; i++) {
         std::pair<NodeID, float> node;
-        node.first = tmp[i].first;
+        node.first = graphNode(tmp[i].first);
         node.second = tmp[i].second/DISTANCEMULTFACT;
         ResultingNodes.push_back(node);
     }
@@ -103,14 +241,14 @@ Graphalg::NearestPOI(const POIKeyType &category, int src, double maxdist, int nu
     std::vector<CH::BucketEntry> ResultingNodes;
     ch.getNearestWithUpperBoundOnDistanceAndLocations(
         category,
-        src,
+        chNode(src),
         maxdist*DISTANCEMULTFACT,
         number,
         ResultingNodes,
         threadNum);
 
     for (int i = 0 ; i < ResultingNodes.size() ; i++) {
-        dm[ResultingNodes[i].node] =
+        dm[graphNode(ResultingNodes[i].node)] =
             static_cast<float>(ResultingNodes[i].distance) /
             static_cast<float>(DISTANCEMULTFACT);
     }
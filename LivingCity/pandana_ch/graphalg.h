@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <map>
+#include <string>
 #include <utility>
 #include "shared.h"
 #include "contraction_hierarchies/src/libch.h"
@@ -25,10 +26,41 @@ class Graphalg {
         vector< vector<long> > edges, vector<double> edgeweights,
         bool twoway);
 
+    // edges given as flat arrays of head and tail nodes. With a cachePath
+    // the preprocessed graphs are saved to / loaded from a file in that
+    // directory named after a hash of the edges. A customizable graph
+    // accepts new edge weights through UpdateEdgeWeights (it is not cached).
+    // reorderNodes renumbers the nodes of the hierarchy for faster queries
+    // (see CH::ContractionHierarchies::ReorderNodes), node ids given to and
+    // returned by Graphalg stay the same
+    Graphalg(
+        int numnodes,
+        const vector<unsigned int> &heads, const vector<unsigned int> &tails,
+        const vector<double> &edgeweights, bool twoway,
+        const std::string &cachePath = "", bool customizable = false,
+        bool reorderNodes = false);
+
+    // new weights for the edges given to the constructor (same order); keeps
+    // the contraction order and shortcuts and only recomputes their weights
+    void UpdateEdgeWeights(const vector<double> &edgeweights);
+
     std::vector<NodeID> Route(int src, int tgt, int threadNum = 0);
 
     double Distance(int src, int tgt, int threadNum = 0);
 
+    // batch versions of Route and Distance for the pairs (sources[i],
+    // targets[i]), sharing searches between repeated sources and targets
+    std::vector<std::vector<NodeID> > Routes(
+        const std::vector<NodeID> &sources, const std::vector<NodeID> &targets);
+
+    std::vector<double> Distances(
+        const std::vector<NodeID> &sources, const std::vector<NodeID> &targets);
+
+    // Routes as the edges of the paths (their index in the edges given to
+    // the constructor) instead of their nodes
+    std::vector<std::vector<NodeID> > EdgeRoutes(
+        const std::vector<NodeID> &sources, const std::vector<NodeID> &targets);
+
     void Range(int src, double maxdist, int threadNum,
                DistanceVec &ResultingNodes);
 
@@ -36,7 +68,7 @@ class Graphalg {
                            int number, int threadNum = 0);
 
     void addPOIToIndex(const POIKeyType &category, int i) {
-        ch.addPOIToIndex(category, i);
+        ch.addPOIToIndex(category, chNode(i));
     }
 
     void initPOIIndex(const POIKeyType &category, double maxdist, int maxitems) {
@@ -45,6 +77,22 @@ class Graphalg {
 
     int numnodes;
     CH::ContractionHierarchies ch;
+
+ private:
+    // id of a node in the (possibly reordered) hierarchy, invalid nodes
+    // are passed on for ch to reject
+    NodeID chNode(int node) const {
+        const vector<NodeID> &order = ch.GetNodeOrder();
+        return node >= 0 && node < order.size() ? order[node] : node;
+    }
+
+    vector<NodeID> chNodes(const vector<NodeID> &nodes) const;
+
+    // node of an id in the hierarchy
+    NodeID graphNode(NodeID id) const {
+        const vector<NodeID> &nodes = ch.GetOrderedNodes();
+        return id < nodes.size() ? nodes[id] : id;
+    }
 };
 }  // namespace accessibility
 }  // namespace MTC
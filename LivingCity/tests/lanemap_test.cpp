@@ -1,6 +1,9 @@
 #include "catch.hpp"
 #include "lanemap.h"
 #include "network.h"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <random>
 using namespace LC;
 
 TEST_CASE("CHECK LANEMAP", "[lanemap]") {
@@ -13,7 +16,7 @@ TEST_CASE("CHECK LANEMAP", "[lanemap]") {
     auto &edge_data = lanemap->edgesData();
     auto &eid2mid = lanemap->eid2mid();
 
-    REQUIRE(edge_data.size() == 24);
+    REQUIRE(edge_data.size() == 12);
     REQUIRE(eid2mid.size() == 12);
 
     auto i0 = eid2mid.at(0);
@@ -23,11 +26,35 @@ TEST_CASE("CHECK LANEMAP", "[lanemap]") {
     auto i6 = eid2mid.at(6);
     auto e6 = edge_data.at(i6);
     REQUIRE(e6.length == 1000);
+
+    // the same ids as a vector in edge id order
+    auto &edge_mids = lanemap->edge_mids();
+    REQUIRE(edge_mids.size() == 12);
+    for (const auto &eid_mid : eid2mid) {
+      REQUIRE(edge_mids.at(eid_mid.first) == eid_mid.second);
+    }
   }
   SECTION("Check Lanemap") {
+    // one cell per started 1024 m of every lane
+    auto &edge_data = lanemap->edgesData();
+    auto &cell_offsets = lanemap->cell_offsets();
+    REQUIRE(cell_offsets.size() == 12 + 1);
+    for (std::size_t mid = 0; mid < edge_data.size(); ++mid) {
+      REQUIRE(cell_offsets[mid + 1] - cell_offsets[mid] ==
+              edge_data[mid].num_lanes *
+                  std::ceil(edge_data[mid].length / 1024));
+    }
+    REQUIRE(cell_offsets.back() == 24);
+
     auto &lanemap_array = lanemap->lanemap_array();
     REQUIRE(lanemap_array.size() == 24 * 1024 * 2);
     REQUIRE(lanemap_array.at(399) == 0xFF);
+
+    // one occupancy bit per byte, all free
+    auto &occupancy = lanemap->occupancy_array();
+    REQUIRE(occupancy.size() * 32 == lanemap_array.size());
+    REQUIRE(std::count(occupancy.begin(), occupancy.end(), 0ull) ==
+            occupancy.size());
   }
 
   SECTION("Check Intersections") {
@@ -40,12 +67,106 @@ TEST_CASE("CHECK LANEMAP", "[lanemap]") {
     REQUIRE(intersection2.num_queue == 3 * 4);
     std::cout << "start; end for intersection 2: " << std::endl;
 
+    auto &movements = lanemap->movements();
     for (int j = 0; j < intersection2.num_queue; ++j) {
-      auto start_mid = intersection2.start_edge[j];
-      auto end_mid = intersection2.end_edge[j];
+      auto &movement = movements.at(intersection2.movement_offset + j);
+      auto start_mid = movement.start_edge;
+      auto end_mid = movement.end_edge;
       std::cout << mid2eid.at(start_mid) << ";" << mid2eid.at(end_mid)
                 << std::endl;
+      REQUIRE(movement.queue.capacity >= MOVEMENT_QUEUE_CAP);
+      REQUIRE(movement.queue.size == 0);
+    }
+  }
+
+  SECTION("Check queue pool") {
+    auto &intersections = lanemap->intersections();
+    auto &movements = lanemap->movements();
+    unsigned num_movements = 0;
+    for (const auto &intersection : intersections) {
+      REQUIRE(intersection.movement_offset == num_movements);
+      num_movements += intersection.num_queue;
+    }
+    REQUIRE(movements.size() == num_movements);
+
+    // three agents start at intersection 1, one at intersection 0
+    std::vector<Agent> agents(4);
+    agents[0].init_intersection = 0;
+    for (int i = 1; i < 4; ++i) {
+      agents[i].init_intersection = 1;
+    }
+    lanemap->init_queues(agents);
+
+    auto &last = movements.back().queue;
+    unsigned slots = last.offset + last.capacity;
+    for (const auto &intersection : intersections) {
+      REQUIRE(intersection.init_queue.offset == slots);
+      REQUIRE(intersection.init_queue.capacity == INIT_QUEUE_CAP);
+      slots += intersection.init_queue.capacity;
+    }
+    REQUIRE(lanemap->queue_pool().size() == slots);
+  }
+
+}
+
+// Opt-in, it builds a 3 GB lanemap: ./microsim_test "[benchmark]"
+TEST_CASE("Memory of the edge tables on a metro grid", "[.][benchmark]") {
+  // 400 x 400 intersections, two-way streets of 1-4 lanes, lognormal lengths
+  // around 180 m (638400 edges)
+  const std::string networkPath = "./test_results/metro_grid/";
+  boost::filesystem::create_directories(networkPath);
+  const unsigned n = 400;
+  std::mt19937 rng(2020);
+  std::lognormal_distribution<double> length(std::log(180.0), 0.6);
+  std::uniform_int_distribution<int> lanes(1, 4);
+  {
+    std::ofstream nodes(networkPath + "nodes.csv");
+    nodes << "osmid,x,y,ref,highway,index\n";
+    for (unsigned v = 0; v < n * n; ++v) {
+      nodes << v << "," << (v % n) * 0.002 << "," << (v / n) * 0.002
+            << ",NA,NA," << v << "\n";
+    }
+    std::ofstream edges(networkPath + "edges.csv");
+    edges << "uniqueid,osmid_u,osmid_v,edge_length,lanes,speed_mph,u,v\n";
+    unsigned eid = 0;
+    for (unsigned v = 0; v < n * n; ++v) {
+      for (const unsigned w : {v + 1, v + n}) {
+        if ((w == v + 1 && v % n == n - 1) || w >= n * n) {
+          continue;
+        }
+        const double meters = std::min(std::max(length(rng), 10.0), 5000.0);
+        const int num_lanes = lanes(rng);
+        for (const auto &uv : {std::make_pair(v, w), std::make_pair(w, v)}) {
+          edges << eid++ << "," << uv.first << "," << uv.second << ","
+                << meters << "," << num_lanes << ",30," << uv.first << ","
+                << uv.second << "\n";
+        }
+      }
     }
   }
+  auto network = std::make_shared<Network>(networkPath, false);
+  Lanemap lanemap(network->street_graph());
+  const auto &edge_data = lanemap.edgesData();
+  const auto &cell_offsets = lanemap.cell_offsets();
+  const std::size_t num_edges = edge_data.size();
+  const std::size_t num_cells = cell_offsets.back();
+  REQUIRE(num_edges == 2 * 2 * n * (n - 1));
 
-}
\ No newline at end of file
+  // before the edge tables were indexed by edge: the host table was sized
+  // 6 x edges, the device one held an EdgeData per lane cell
+  const double mb = 1024.0 * 1024.0;
+  const double old_host = 6.0 * num_edges * sizeof(EdgeData) / mb;
+  const double old_device = double(num_cells) * sizeof(EdgeData) / mb;
+  const double now = (double(num_edges) * sizeof(EdgeData) +
+                      double(cell_offsets.size()) * sizeof(uint)) /
+                     mb;
+  std::cout << num_edges << " edges, " << num_cells << " lane cells\n"
+            << "host edge table: " << old_host << " MB (6 x edges) -> " << now
+            << " MB (edges + cell offsets)\n"
+            << "device edge table: " << old_device << " MB (per cell) -> "
+            << now << " MB\n"
+            << "lanemap: " << lanemap.lanemap_array().size() / mb << " MB"
+            << std::endl;
+  REQUIRE(now < old_device);
+  REQUIRE(now < old_host);
+}
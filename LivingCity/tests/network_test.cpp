@@ -1,5 +1,6 @@
 #include "catch.hpp"
 #include "network.h"
+#include "pandana_ch/accessibility.h"
 
 TEST_CASE("CHECK THE NETWORK", "[NETWORK]") {
   double tolerance = 1e-6;
@@ -83,4 +84,197 @@ TEST_CASE("CHECK THE NETWORK", "[NETWORK]") {
     REQUIRE(network->edge_id(3, 4) == 10);
     REQUIRE(network->edge_id(4, 3) == 11);
   }
+
+  SECTION("Check binary network cache") {
+    // first load writes the cache, second load maps it
+    LC::Network parsed(networkPath, true);
+    LC::Network cached(networkPath, true);
+    LC::Network uncached(networkPath, false);
+
+    REQUIRE(cached.num_edges() == uncached.num_edges());
+    REQUIRE(cached.num_vertices() == uncached.num_vertices());
+    REQUIRE(cached.edge_vertices() == uncached.edge_vertices());
+    REQUIRE(cached.edge_weights() == uncached.edge_weights());
+    REQUIRE(cached.edge_id(3, 4) == 10);
+    REQUIRE(cached.street_graph()->nodeIndex_to_osmid_ ==
+            uncached.street_graph()->nodeIndex_to_osmid_);
+  }
+
+  SECTION("Check CSR adjacency") {
+    auto graph = network->street_graph();
+    REQUIRE(graph->nvertices() == 5);
+    REQUIRE(graph->nedges() == 12);
+
+    // out edges of vertex 2 are sorted by target
+    REQUIRE(graph->out_degree(2) == 4);
+    std::vector<abm::graph::vertex_t> targets;
+    for (auto e = graph->out_begin(2); e < graph->out_end(2); ++e) {
+      REQUIRE(graph->source(e) == 2);
+      targets.emplace_back(graph->target(e));
+    }
+    REQUIRE((targets == std::vector<abm::graph::vertex_t>{0, 1, 3, 4}));
+
+    // in edges of vertex 4 come from 2 and 3
+    REQUIRE(graph->in_end(4) - graph->in_begin(4) == 2);
+    REQUIRE(graph->source(graph->in_edge(graph->in_begin(4))) == 2);
+    REQUIRE(graph->source(graph->in_edge(graph->in_begin(4) + 1)) == 3);
+
+    const auto edge = graph->find_edge(3, 4);
+    REQUIRE(graph->edge_id(edge) == 10);
+    REQUIRE(graph->edge_index(10) == edge);
+    REQUIRE(graph->length(edge) == 2000);
+    REQUIRE(graph->find_edge(0, 1) == abm::graph::kInvalidEdge);
+  }
+  SECTION("Check many-to-many routes") {
+    MTC::accessibility::Accessibility graph_ch(
+        network->num_vertices(), network->heads(), network->tails(),
+        network->edge_weights(), false);
+
+    // every pair of the 5 x 5 matrix, batched routes use the bucket search
+    std::vector<long> sources, targets;
+    for (long s = 0; s < 5; ++s) {
+      for (long t = 0; t < 5; ++t) {
+        sources.emplace_back(s);
+        targets.emplace_back(t);
+      }
+    }
+    const auto routes = graph_ch.Routes(sources, targets);
+    const auto distances = graph_ch.Distances(sources, targets);
+    REQUIRE(routes.size() == 25);
+    REQUIRE(distances.size() == 25);
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+      REQUIRE(routes[i] == graph_ch.Route(sources[i], targets[i]));
+      REQUIRE(distances[i] ==
+              Approx(graph_ch.Distance(sources[i], targets[i])));
+    }
+
+    // sparse requests are routed pair by pair
+    const auto route = graph_ch.Routes({0, 7}, {4, 1});
+    REQUIRE(route[0] == graph_ch.Route(0, 4));
+    REQUIRE(route[1].empty());
+  }
+  SECTION("Check edge routes") {
+    MTC::accessibility::Accessibility graph_ch(
+        network->num_vertices(), network->heads(), network->tails(),
+        network->edge_weights(), false);
+    MTC::accessibility::Accessibility customizable(
+        network->num_vertices(), network->heads(), network->tails(),
+        network->edge_weights(), false, "", true, true);
+
+    std::vector<long> sources, targets;
+    for (long s = 0; s < 5; ++s) {
+      for (long t = 0; t < 5; ++t) {
+        sources.emplace_back(s);
+        targets.emplace_back(t);
+      }
+    }
+    const auto routes = graph_ch.Routes(sources, targets);
+    const auto edge_routes = graph_ch.EdgeRoutes(sources, targets);
+    REQUIRE(edge_routes.size() == 25);
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+      // one edge per hop, in the direction of the route
+      REQUIRE(edge_routes[i].size() + 1 == routes[i].size());
+      for (std::size_t j = 0; j < edge_routes[i].size(); ++j) {
+        REQUIRE(edge_routes[i][j] ==
+                network->edge_id(routes[i][j], routes[i][j + 1]));
+      }
+    }
+    REQUIRE(customizable.EdgeRoutes(sources, targets) == edge_routes);
+
+    // 3 -> 2 and 2 -> 3 have the same length but are different edges
+    REQUIRE((graph_ch.EdgeRoutes({0}, {4})[0] == std::vector<int>{4, 7, 8}));
+    REQUIRE((graph_ch.EdgeRoutes({2}, {3})[0] == std::vector<int>{6}));
+  }
+  SECTION("Check customizable contraction hierarchy") {
+    auto weights = network->edge_weights();
+    MTC::accessibility::Accessibility customizable(
+        network->num_vertices(), network->heads(), network->tails(), weights,
+        false, "", true);
+
+    std::vector<long> sources, targets;
+    for (long s = 0; s < 5; ++s) {
+      for (long t = 0; t < 5; ++t) {
+        sources.emplace_back(s);
+        targets.emplace_back(t);
+      }
+    }
+    for (int round = 0; round < 2; ++round) {
+      if (round > 0) {
+        // congest every other edge and customize again
+        for (std::size_t e = 0; e < weights[0].size(); e += 2) {
+          weights[0][e] *= 5;
+        }
+        customizable.updateEdgeWeights(weights[0]);
+      }
+      MTC::accessibility::Accessibility contracted(
+          network->num_vertices(), network->heads(), network->tails(),
+          weights, false);
+      const auto distances = customizable.Distances(sources, targets);
+      REQUIRE(distances == contracted.Distances(sources, targets));
+      const auto routes = customizable.Routes(sources, targets);
+      for (std::size_t i = 0; i < routes.size(); ++i) {
+        if (sources[i] != targets[i]) {
+          REQUIRE(routes[i].front() == sources[i]);
+          REQUIRE(routes[i].back() == targets[i]);
+        }
+      }
+    }
+  }
+  SECTION("Check reordered contraction hierarchy") {
+    auto weights = network->edge_weights();
+    MTC::accessibility::Accessibility contracted(
+        network->num_vertices(), network->heads(), network->tails(), weights,
+        false);
+    MTC::accessibility::Accessibility reordered(
+        network->num_vertices(), network->heads(), network->tails(), weights,
+        false, "", false, true);
+    MTC::accessibility::Accessibility customizable(
+        network->num_vertices(), network->heads(), network->tails(), weights,
+        false, "", true, true);
+
+    // node ids are translated back, queries are answered as before
+    std::vector<long> sources, targets;
+    for (long s = 0; s < 5; ++s) {
+      for (long t = 0; t < 5; ++t) {
+        sources.emplace_back(s);
+        targets.emplace_back(t);
+      }
+    }
+    const auto distances = contracted.Distances(sources, targets);
+    const auto routes = contracted.Routes(sources, targets);
+    REQUIRE(reordered.Distances(sources, targets) == distances);
+    REQUIRE(reordered.Routes(sources, targets) == routes);
+    REQUIRE(customizable.Distances(sources, targets) == distances);
+    for (std::size_t i = 0; i < sources.size(); ++i) {
+      REQUIRE(reordered.Route(sources[i], targets[i]) == routes[i]);
+      REQUIRE(reordered.Distance(sources[i], targets[i]) ==
+              Approx(distances[i]));
+    }
+    MTC::accessibility::Graphalg contracted_graph(
+        network->num_vertices(), network->heads(), network->tails(),
+        weights[0], false);
+    MTC::accessibility::Graphalg reordered_graph(
+        network->num_vertices(), network->heads(), network->tails(),
+        weights[0], false, "", false, true);
+    for (int node = 0; node < 5; ++node) {
+      MTC::accessibility::DistanceVec expected, range;
+      contracted_graph.Range(node, 10000, 0, expected);
+      reordered_graph.Range(node, 10000, 0, range);
+      REQUIRE(!range.empty());
+      std::sort(expected.begin(), expected.end());
+      std::sort(range.begin(), range.end());
+      REQUIRE(range == expected);
+    }
+
+    // new weights keep the node order
+    for (std::size_t e = 0; e < weights[0].size(); e += 2) {
+      weights[0][e] *= 5;
+    }
+    customizable.updateEdgeWeights(weights[0]);
+    MTC::accessibility::Accessibility congested(
+        network->num_vertices(), network->heads(), network->tails(), weights,
+        false);
+    REQUIRE(customizable.Distances(sources, targets) ==
+            congested.Distances(sources, targets));
+  }
 }
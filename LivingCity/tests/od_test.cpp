@@ -1,5 +1,8 @@
+#include "agent_soa.h"
 #include "catch.hpp"
 #include "od.h"
+#include <cstdio>
+#include <fstream>
 #include <memory>
 
 TEST_CASE("CHECK THE OD", "[OD]") {
@@ -36,4 +39,87 @@ TEST_CASE("CHECK THE OD", "[OD]") {
     REQUIRE(agent3.end_intersection == 4);
     REQUIRE(agent3.time_departure == 400);
   }
-}
\ No newline at end of file
+
+  SECTION("Check hot agent arrays") {
+    auto agents = od->agents();
+    LC::AgentsHotBuffer hot;
+    hot.scatter(agents);
+    REQUIRE(hot.size() == 4);
+    REQUIRE((hot.departures() == std::vector<unsigned int>{0, 1, 2, 3}));
+
+    auto view = hot.view();
+    REQUIRE(view.time_departure[2] == 350);
+    REQUIRE(view.active[2] == 0);
+    LC::IDMParametersCar param;
+    REQUIRE(view.a[2] == Approx(param.a).epsilon(tolerance));
+    REQUIRE(view.s_0[2] == Approx(param.s_0).epsilon(tolerance));
+    view.active[2] = 1;
+    view.v[2] = 5.5;
+    view.num_steps[2] = 7;
+    view.cum_length[2] = 12.5;
+
+    hot.gather(agents);
+    REQUIRE(agents.at(2).active == 1);
+    REQUIRE(agents.at(2).v == Approx(5.5).epsilon(tolerance));
+    REQUIRE(agents.at(2).num_steps == 7);
+    REQUIRE(agents.at(2).cum_length == Approx(12.5).epsilon(tolerance));
+    REQUIRE(agents.at(2).init_intersection == 1);
+  }
+
+  SECTION("Check optional type column") {
+    const std::string typedFileName = "od_typed.csv";
+    {
+      std::ofstream file(typedFileName);
+      file << "type,dep_time,destination,origin\n0,300,4,1\n0,0,4,0\n";
+    }
+    LC::OD typed(typedFileName, false);
+    std::remove(typedFileName.c_str());
+    REQUIRE(typed.num_agents() == 2);
+    REQUIRE(typed.agents().at(0).agent_type == LC::CAR);
+    REQUIRE(typed.agents().at(0).init_intersection == 1);
+    REQUIRE(typed.agents().at(0).end_intersection == 4);
+    REQUIRE(typed.agents().at(0).time_departure == 300);
+    LC::IDMParametersCar param;
+    REQUIRE(typed.agents().at(1).a == Approx(param.a).epsilon(tolerance));
+    REQUIRE(typed.agents().at(1).T == Approx(param.T).epsilon(tolerance));
+  }
+
+  SECTION("Check od file parsed in several chunks") {
+    // larger than the single thread limit of the parser, with CRLF line
+    // endings and no newline after the last row
+    const std::string bigFileName = "od_chunks.csv";
+    const unsigned num_rows = 100000;
+    {
+      std::ofstream file(bigFileName, std::ios::binary);
+      file << "origin,destination,dep_time,type\r\n";
+      for (unsigned i = 0; i < num_rows; ++i) {
+        file << i << "," << i + 1 << "," << i % 1000 << ",0";
+        if (i + 1 < num_rows) {
+          file << "\r\n";
+        }
+      }
+    }
+    LC::OD chunked(bigFileName, false);
+    std::remove(bigFileName.c_str());
+    REQUIRE(chunked.num_agents() == num_rows);
+    // every row is read once and in file order, across the chunk boundaries
+    const auto &agents = chunked.agents();
+    bool in_order = true;
+    for (unsigned i = 0; i < num_rows; ++i) {
+      in_order &= agents[i].init_intersection == i &&
+                  agents[i].end_intersection == i + 1 &&
+                  agents[i].time_departure == i % 1000 &&
+                  agents[i].agent_type == LC::CAR;
+    }
+    REQUIRE(in_order);
+  }
+
+  SECTION("Check binary od cache") {
+    LC::OD parsed(odFileName, true);
+    LC::OD cached(odFileName, true);
+    REQUIRE(cached.num_agents() == 4);
+    REQUIRE(cached.agents().at(2).init_intersection == 1);
+    REQUIRE(cached.agents().at(2).end_intersection == 4);
+    REQUIRE(cached.agents().at(2).time_departure == 350);
+  }
+}
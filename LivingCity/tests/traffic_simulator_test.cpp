@@ -1,4 +1,5 @@
 #include "catch.hpp"
+#include "cpu_simulator.h"
 #include "traffic_simulator.h"
 
 using namespace LC;
@@ -15,6 +16,7 @@ TEST_CASE("CHECK SIMULATOR", "[SIMULATOR]") {
   SECTION("Check loaded agents") {
     auto &agents = od->agents();
     auto &mid2eid = lanemap->mid2eid();
+    auto &routes = simulator.routes();
     std::cout << "Print Shortest Path" << std::endl;
     std::cout << "========================================" << std::endl;
 
@@ -24,25 +26,450 @@ TEST_CASE("CHECK SIMULATOR", "[SIMULATOR]") {
       std::cout << "Current ptr " << agent.route_ptr << std::endl;
       std::cout << "number of passing edges: " << agent.route_size << std::endl;
       for (int j = 0; j < agent.route_size; ++j) {
-        std::cout << mid2eid.at(agent.route[j]) << ";";
+        std::cout << mid2eid.at(routes[agent.route_offset + j]) << ";";
       }
       std::cout << std::endl;
       std::cout << "========================================" << std::endl;
     }
 
     REQUIRE(agents[0].route_size == 3);
-    REQUIRE(mid2eid.at(agents[0].route[0]) == 4);
-    REQUIRE(mid2eid.at(agents[0].route[1]) == 7);
-    REQUIRE(mid2eid.at(agents[0].route[2]) == 8);
+    REQUIRE(mid2eid.at(routes[agents[0].route_offset]) == 4);
+    REQUIRE(mid2eid.at(routes[agents[0].route_offset + 1]) == 7);
+    REQUIRE(mid2eid.at(routes[agents[0].route_offset + 2]) == 8);
 
     REQUIRE(agents[1].route_size == 2);
-    REQUIRE(mid2eid.at(agents[1].route[0]) == 2);
-    REQUIRE(mid2eid.at(agents[1].route[1]) == 8);
+    REQUIRE(mid2eid.at(routes[agents[1].route_offset]) == 2);
+    REQUIRE(mid2eid.at(routes[agents[1].route_offset + 1]) == 8);
+
+    // agents with the same od pair share one route
+    REQUIRE(agents[1].route_offset == agents[0].route_offset + 3);
+    REQUIRE(agents[2].route_offset == agents[1].route_offset);
+    REQUIRE(agents[2].route_size == 2);
+    REQUIRE(agents[3].route_offset == agents[0].route_offset);
+    REQUIRE(agents[3].route_size == 3);
+    REQUIRE(routes.size() == 3 + 2);
+  }
+
+  SECTION("Check cached contraction hierarchy") {
+    // the simulator above wrote (or loaded) the CH file of the network,
+    // routes must match a CH built from scratch
+    auto uncached_network = std::make_shared<LC::Network>(networkPath, false);
+    REQUIRE(uncached_network->cache_path().empty());
+    TrafficSimulator cached(network, od, lanemap, "./test_results/");
+    auto cached_routes = cached.routes();
+    TrafficSimulator uncached(uncached_network, od, lanemap,
+                              "./test_results/");
+    REQUIRE(cached_routes == uncached.routes());
+    REQUIRE(cached_routes == simulator.routes());
+  }
+
+  SECTION("Check weight profiles") {
+    // edge 7 (3 -> 2) is congested from 300 s on
+    auto profiled_network = std::make_shared<LC::Network>(networkPath);
+    profiled_network->load_weight_profiles(
+        "../tests/test_data/weight_profiles.csv");
+    REQUIRE(profiled_network->num_profiles() == 2);
+    REQUIRE(profiled_network->profile(0) == 0);
+    REQUIRE(profiled_network->profile(299) == 0);
+    REQUIRE(profiled_network->profile(350) == 1);
+    REQUIRE(profiled_network->edge_weights()[1][7] == Approx(500));
+
+    TrafficSimulator profiled(profiled_network, od, lanemap,
+                              "./test_results/");
+    auto &agents = od->agents();
+    auto &mid2eid = lanemap->mid2eid();
+    auto &routes = profiled.routes();
+    auto route_eids = [&](const Agent &agent) {
+      std::vector<abm::graph::edge_id_t> eids;
+      for (int j = 0; j < agent.route_size; ++j) {
+        eids.emplace_back(mid2eid.at(routes[agent.route_offset + j]));
+      }
+      return eids;
+    };
+    // same origin and destination, departing before and after 300 s
+    REQUIRE((route_eids(agents[0]) ==
+             std::vector<abm::graph::edge_id_t>{4, 7, 8}));
+    REQUIRE((route_eids(agents[3]) ==
+             std::vector<abm::graph::edge_id_t>{0, 8}));
+    REQUIRE(routes.size() == 3 + 2 + 2);
   }
 
     SECTION("Run Simulation") {
         simulator.simulateInGPU(0,600,100);
   }
+
+  SECTION("Run Simulation on CPU") {
+    simulator.simulateInCPU(0, 600, 100);
+    auto &agents = od->agents();
+    for (const auto &agent : agents) {
+      REQUIRE(agent.active != 0); // all agents departed before 600 s
+      REQUIRE(agent.route_ptr >= 0);
+    }
+  }
+
+  SECTION("Check final state of a single thread CPU simulation") {
+    // one thread steps the agents in a fixed order, the run is deterministic
+    simulator.simulateInCPU(0, 600, 100, 1);
+
+    // all agents arrive; steps and slowdowns per agent
+    const std::vector<unsigned> num_steps{396, 361, 361, 396};
+    const std::vector<unsigned> slow_down_steps{3, 3, 4, 3};
+    auto &agents = od->agents();
+    for (std::size_t i = 0; i < agents.size(); ++i) {
+      const auto &agent = agents[i];
+      REQUIRE(agent.active == 2);
+      REQUIRE(agent.route_ptr == int(agent.route_size) - 1);
+      REQUIRE(agent.cum_length == Approx(3000));
+      REQUIRE(agent.num_steps == num_steps[i]);
+      REQUIRE(agent.slow_down_steps == slow_down_steps[i]);
+      REQUIRE(agent.num_steps_in_queue == 0);
+      REQUIRE(agent.v == Approx(13.3744).epsilon(1e-4));
+    }
+
+    // vehicles in, vehicles out and travel steps of the used edges
+    const std::map<abm::graph::edge_id_t, std::vector<unsigned>> used_edges{
+        {2, {2, 2, 388}}, {4, {2, 2, 236}}, {7, {2, 2, 222}}, {8, {4, 4, 668}}};
+    const auto &edgesData = lanemap->edgesData();
+    for (const auto &eid_mid : lanemap->eid2mid()) {
+      const auto &edge = edgesData.at(eid_mid.second);
+      const auto used = used_edges.find(eid_mid.first);
+      const auto expected = used == used_edges.end()
+                                ? std::vector<unsigned>{0, 0, 0}
+                                : used->second;
+      REQUIRE(edge.upstream_veh_count == expected[0]);
+      REQUIRE(edge.downstream_veh_count == expected[1]);
+      REQUIRE(edge.period_cum_travel_steps == expected[2]);
+    }
+  }
+
+  SECTION("Check leader on the next edge of the route") {
+    // the follower drives towards the end of edge 4, the leader is 10 m into
+    // edge 7, the next edge of their route (4, 7, 8)
+    auto routes = simulator.routes();
+    auto &edgesData = lanemap->edgesData();
+    auto &intersections = lanemap->intersections();
+    std::vector<Agent> agents(2, od->agents().at(0));
+    auto place = [&](Agent &agent, int route_ptr, float pos, float v) {
+      const auto mid = routes[agent.route_offset + route_ptr];
+      agent.active = 1;
+      agent.route_ptr = route_ptr;
+      agent.edge_mid = mid;
+      agent.edge_id = edgesData[mid].eid;
+      agent.posInLaneM = pos;
+      agent.v = v;
+      agent.max_speed = edgesData[mid].maxSpeedMperSec;
+      agent.edge_length = edgesData[mid].length;
+    };
+    place(agents[0], 0, 970, 10);
+    place(agents[1], 1, 10, 0);
+    REQUIRE(edgesData[agents[0].edge_mid].eid == 4);
+    REQUIRE(edgesData[agents[1].edge_mid].eid == 7);
+
+    lanemap->init_queues(agents);
+    init_cpu(true, agents, routes, edgesData, lanemap->lanemap_array(),
+             lanemap->occupancy_array(), lanemap->cell_offsets(),
+             intersections, lanemap->movements(), lanemap->queue_pool());
+    const float dt = 0.5;
+    // the lanemap of the first step is empty, the rest of edge 4 is free
+    cpu_simulate(0, agents.size(), intersections.size(), dt, 1);
+    cpu_get_data(agents, edgesData, intersections);
+    REQUIRE(agents[0].s == Approx(20));
+    const auto follower = agents[0];
+    const auto leader = agents[1];
+    REQUIRE(follower.route_ptr == 0);
+    REQUIRE(1000 - follower.posInLaneM < LOOK_AHEAD_M);
+
+    // the second step reads where the first one wrote the leader
+    cpu_simulate(dt, agents.size(), intersections.size(), dt, 1);
+    cpu_get_data(agents, edgesData, intersections);
+    finish_cpu();
+    const float to_end = 1000 - std::floor(follower.posInLaneM);
+    REQUIRE(agents[0].s == Approx(to_end + std::floor(leader.posInLaneM)));
+    REQUIRE(agents[0].delta_v ==
+            Approx(follower.v - uchar(leader.v * 3) / 3.0f));
+  }
+
+  SECTION("Check leader and gap lookups against a scan of the lanemap") {
+    // vehicles on both lanes of edge 2 (route 2, 8), far from its end
+    auto routes = simulator.routes();
+    auto &edgesData = lanemap->edgesData();
+    auto &intersections = lanemap->intersections();
+    auto &lanemap_array = lanemap->lanemap_array();
+    const std::vector<std::vector<float>> vehicles{
+        {0, 100, 5}, {0, 130, 8}, {1, 90, 3},
+        {1, 120, 10}, {1, 300, 0}, {0, 500, 12}};
+    std::vector<Agent> agents(vehicles.size(), od->agents().at(1));
+    for (std::size_t i = 0; i < agents.size(); ++i) {
+      auto &agent = agents[i];
+      const auto mid = routes[agent.route_offset];
+      agent.time_departure = 0;
+      agent.active = 1;
+      agent.route_ptr = 0;
+      agent.edge_mid = mid;
+      agent.edge_id = edgesData[mid].eid;
+      agent.lane = vehicles[i][0];
+      agent.posInLaneM = vehicles[i][1];
+      agent.v = vehicles[i][2];
+      agent.max_speed = edgesData[mid].maxSpeedMperSec;
+      agent.edge_length = edgesData[mid].length;
+    }
+    const auto &edge = edgesData[agents[0].edge_mid];
+    REQUIRE(edge.eid == 2);
+    REQUIRE(edge.num_lanes == 2);
+
+    lanemap->init_queues(agents);
+    init_cpu(true, agents, routes, edgesData, lanemap_array,
+             lanemap->occupancy_array(), lanemap->cell_offsets(),
+             intersections, lanemap->movements(), lanemap->queue_pool());
+    const float dt = 0.5;
+    // the first step writes the vehicles to the lanemap the second one reads
+    cpu_simulate(0, agents.size(), intersections.size(), dt, 1);
+    cpu_get_data(agents, edgesData, intersections);
+    const auto start = agents;
+    cpu_simulate(dt, agents.size(), intersections.size(), dt, 1);
+    cpu_get_data(agents, edgesData, intersections);
+
+    // first and last written meter of a lane of edge 2 in [from, to)
+    const std::size_t cells = std::ceil(edge.length / kMaxMapWidthM_);
+    auto lane_start = [&](uint lane) {
+      return lanemap_array.size() / 2 +
+             kMaxMapWidthM_ *
+                 (lanemap->cell_offsets()[agents[0].edge_mid] + lane * cells);
+    };
+    auto first_written = [&](uint lane, uint from, uint to) {
+      for (uint pos = from; pos < to; ++pos) {
+        if (lanemap_array[lane_start(lane) + pos] != 0xFF) {
+          return pos;
+        }
+      }
+      return to;
+    };
+    auto last_written = [&](uint lane, uint from, uint to) {
+      for (uint pos = to; pos-- > from;) {
+        if (lanemap_array[lane_start(lane) + pos] != 0xFF) {
+          return pos;
+        }
+      }
+      return to;
+    };
+    auto speed = [&](uint lane, uint pos) {
+      return lanemap_array[lane_start(lane) + pos];
+    };
+
+    const uint end = std::ceil(edge.length);
+    for (std::size_t i = 0; i < agents.size(); ++i) {
+      const auto &agent = start[i];
+      REQUIRE(agent.edge_mid == agents[0].edge_mid);
+      REQUIRE(end - agent.posInLaneM > LOOK_AHEAD_M);
+      const uint meter = std::floor(agent.posInLaneM);
+
+      // leader on the lane of the vehicle
+      float s = 20;
+      float delta_v = agent.v - agent.max_speed;
+      const uint ahead = first_written(agent.lane, meter + 1, end);
+      if (ahead < end) {
+        s = ahead - meter;
+        delta_v = agent.v - speed(agent.lane, ahead) / 3.0f;
+      }
+      REQUIRE(agents[i].s == Approx(s));
+      REQUIRE(agents[i].delta_v == Approx(delta_v));
+
+      // gaps on the other lane
+      const uint other = 1 - agent.lane;
+      float gap_a = 1000, gap_b = 1000;
+      uchar v_a = 0, v_b = 0;
+      REQUIRE(cpu_lane_gaps(i, other, gap_a, gap_b, v_a, v_b));
+      const uint front = first_written(other, meter - 1, end);
+      if (front < end) {
+        REQUIRE(gap_a == Approx(float(front) - meter));
+        REQUIRE(v_a == speed(other, front) / 3);
+      } else {
+        REQUIRE(gap_a == 1000);
+      }
+      const uint back = last_written(other, 1, meter + 2);
+      if (back < meter + 2) {
+        REQUIRE(gap_b == Approx(float(meter) - back));
+        REQUIRE(v_b == speed(other, back) / 3);
+      } else {
+        REQUIRE(gap_b == 1000);
+      }
+    }
+    finish_cpu();
+  }
+
+  SECTION("Run Simulation on CPU with en-route rerouting") {
+    TrafficSimulator rerouting(network, od, lanemap,
+                               "./test_results/en_route/");
+    rerouting.set_en_route_rerouting(1, 10);
+    rerouting.simulateInCPU(0, 600, 100);
+    // rerouted or not, every route connects the origin to the destination
+    auto &routes = rerouting.routes();
+    const auto &edgesData = lanemap->edgesData();
+    for (const auto &agent : od->agents()) {
+      REQUIRE(agent.active != 0);
+      REQUIRE(agent.route_size > 0);
+      const uint *route = routes.data() + agent.route_offset;
+      REQUIRE(edgesData.at(route[0]).vertex[0] == agent.init_intersection);
+      for (unsigned j = 0; j + 1 < agent.route_size; ++j) {
+        REQUIRE(edgesData.at(route[j]).vertex[1] ==
+                edgesData.at(route[j + 1]).vertex[0]);
+      }
+      REQUIRE(edgesData.at(route[agent.route_size - 1]).vertex[1] ==
+              agent.end_intersection);
+    }
+  }
+
+  SECTION("Reroute around a congested edge on the CPU") {
+    // a column of stopped vehicles 3 m apart on edge 4 of route (4, 7, 8),
+    // and edge 7 looks jammed: the detour (4, 10) from vertex 3 is faster
+    // than the rest of their route. The rounds are waited for, so the run
+    // is the same every time
+    auto &edgesData = lanemap->edgesData();
+    const auto &eid2mid = lanemap->eid2mid();
+    const auto &mid2eid = lanemap->mid2eid();
+    auto &jammed = edgesData.at(eid2mid.at(7));
+    jammed.downstream_veh_count = 1;
+    jammed.period_cum_travel_steps = 200000;
+    TrafficSimulator rerouting(network, od, lanemap,
+                               "./test_results/en_route/");
+    auto &agents = od->agents();
+    agents.assign(12, agents.at(0));
+    for (std::size_t i = 0; i < agents.size(); ++i) {
+      auto &agent = agents[i];
+      agent.active = 1;
+      agent.route_ptr = 0;
+      agent.edge_mid = eid2mid.at(4);
+      agent.edge_id = 4;
+      agent.posInLaneM = 900 - 3 * i;
+      agent.v = 0;
+      agent.max_speed = edgesData[agent.edge_mid].maxSpeedMperSec;
+      agent.edge_length = edgesData[agent.edge_mid].length;
+    }
+    const auto old_offset = agents[0].route_offset;
+    const std::vector<uint> old_route(
+        rerouting.routes().begin() + old_offset,
+        rerouting.routes().begin() + old_offset + 3);
+    rerouting.set_en_route_rerouting(1, 4, true);
+    rerouting.simulateInCPU(0, 600, 100, 1);
+    REQUIRE(rerouting.en_route_reroutes() > 0);
+
+    // the rerouted agents keep edge 4 and take edge 10, the others keep the
+    // old route; routes holds each route once, replaced routes are dropped
+    const auto &routes = rerouting.routes();
+    std::size_t rerouted = 0;
+    bool kept_old_route = false;
+    for (const auto &agent : agents) {
+      REQUIRE(agent.active == 2);
+      REQUIRE(agent.route_ptr == int(agent.route_size) - 1);
+      const uint *route = routes.data() + agent.route_offset;
+      if (agent.route_size == 2) {
+        REQUIRE(route[0] == old_route[0]);
+        REQUIRE(mid2eid.at(route[1]) == 10);
+        ++rerouted;
+      } else {
+        REQUIRE(std::vector<uint>(route, route + agent.route_size) ==
+                old_route);
+        kept_old_route = true;
+      }
+    }
+    REQUIRE(rerouted == rerouting.en_route_reroutes());
+    REQUIRE(routes.size() == (kept_old_route ? 3 : 0) + 2 * rerouted);
+  }
+
+  SECTION("Reject route updates of agents that moved on") {
+    // agent 0 (route 4, 7, 8) is on edge 4; the updates replace the rest of
+    // its route with edge 10 or keep edge 7 and replace edge 8
+    auto routes = simulator.routes();
+    auto &edgesData = lanemap->edgesData();
+    auto &intersections = lanemap->intersections();
+    const auto &eid2mid = lanemap->eid2mid();
+    std::vector<Agent> agents(1, od->agents().at(0));
+    auto &agent = agents[0];
+    const auto old_offset = agent.route_offset;
+    agent.active = 1;
+    agent.route_ptr = 0;
+    agent.edge_mid = eid2mid.at(4);
+    agent.edge_id = 4;
+    agent.posInLaneM = 500;
+    agent.max_speed = edgesData[agent.edge_mid].maxSpeedMperSec;
+    agent.edge_length = edgesData[agent.edge_mid].length;
+    const uint new_offset = routes.size();
+    routes.insert(routes.end(), {eid2mid.at(4), eid2mid.at(10)});
+
+    auto update = [&](int route_ptr, unsigned splice) {
+      RouteUpdate update;
+      update.agent = 0;
+      update.old_offset = old_offset;
+      update.route_ptr = route_ptr;
+      update.splice = splice;
+      update.route_offset = new_offset;
+      update.route_size = 2;
+      return update;
+    };
+    auto check = [&](bool in_queue, const std::vector<RouteUpdate> &updates) {
+      agent.in_queue = in_queue;
+      lanemap->init_queues(agents);
+      init_cpu(true, agents, routes, edgesData, lanemap->lanemap_array(),
+               lanemap->occupancy_array(), lanemap->cell_offsets(),
+               intersections, lanemap->movements(), lanemap->queue_pool());
+      std::vector<uchar> valid;
+      cpu_check_route_updates(updates, valid);
+      const unsigned applied = cpu_update_routes(routes, updates);
+      finish_cpu();
+      return std::make_pair(valid, applied);
+    };
+
+    // rerouted from the next edge: the agent moved on, nothing changes
+    auto result = check(false, {update(1, 2)});
+    REQUIRE(result.first == std::vector<uchar>{0});
+    REQUIRE(result.second == 0);
+    REQUIRE(agent.route_offset == old_offset);
+    REQUIRE(agent.route_size == 3);
+
+    // queued for edge 7, which the update replaces
+    result = check(true, {update(0, 1)});
+    REQUIRE(result.first == std::vector<uchar>{0});
+    REQUIRE(result.second == 0);
+    REQUIRE(agent.route_offset == old_offset);
+
+    // a queued agent keeps its next edge
+    result = check(true, {update(0, 2)});
+    REQUIRE(result.first == std::vector<uchar>{1});
+    REQUIRE(result.second == 1);
+    REQUIRE(agent.route_offset == new_offset);
+    REQUIRE(agent.route_size == 2);
+
+    // still driving on edge 4, the update applies
+    agent.route_offset = old_offset;
+    agent.route_size = 3;
+    result = check(false, {update(1, 2), update(0, 1)});
+    const std::vector<uchar> second_valid{0, 1};
+    REQUIRE(result.first == second_valid);
+    REQUIRE(result.second == 1);
+    REQUIRE(agent.route_offset == new_offset);
+  }
+
+  SECTION("Run iterative assignment") {
+    TrafficSimulator assignment(network, od, lanemap,
+                                "./test_results/assignment/");
+    assignment.simulateAssignment(0, 600, 100, 3, 0.5, true);
+    const auto &gaps = assignment.relative_gaps();
+    REQUIRE(gaps.size() == 3);
+    for (const auto gap : gaps) {
+      REQUIRE(gap >= 0);
+      REQUIRE(gap < 1);
+    }
+    // every agent still has a route from its origin to its destination
+    auto &routes = assignment.routes();
+    for (const auto &agent : od->agents()) {
+      REQUIRE(agent.route_size > 0);
+      const auto &first = lanemap->edgesData().at(routes[agent.route_offset]);
+      const auto &last = lanemap->edgesData().at(
+          routes[agent.route_offset + agent.route_size - 1]);
+      REQUIRE(first.vertex[0] == agent.init_intersection);
+      REQUIRE(last.vertex[1] == agent.end_intersection);
+    }
+  }
   //
   //        simulator.load_agents();
   //
@@ -31,9 +31,10 @@ struct Agent {
   unsigned int init_intersection;
   unsigned int end_intersection;
   float time_departure;
-  //! Route of the agent (array of lanemap ids)
-  uint route[500];
-  unsigned short route_size{0};
+  //! Route of the agent: route_size lanemap ids stored from route_offset in
+  //! the flat route array shared by all agents (TrafficSimulator::routes)
+  unsigned int route_offset{0};
+  unsigned int route_size{0};
   int route_ptr{-1};
 
   // Agent information
@@ -76,6 +77,37 @@ struct Agent {
   unsigned int initial_waited_steps{0};
 };
 
+//! RouteUpdate Struct
+//! \brief New route of an agent found while it is on its way. The new route
+//! keeps the entries of the old one before splice, so it is only switched to
+//! if the agent has not moved on (or entered the intersection queue when the
+//! splice is right after its current edge) since it was rerouted
+struct RouteUpdate {
+  unsigned int agent;
+  //! route the new one was spliced from and position of the agent on it
+  unsigned int old_offset;
+  int route_ptr;
+  //! first entry of the route that was replaced
+  unsigned int splice;
+  //! new route in the flat route array
+  unsigned int route_offset;
+  unsigned int route_size;
+};
+
+//! RerouteCandidate Struct
+//! \brief Agent queued at an intersection or stopped on its edge with part
+//! of its route left to replace, listed by the simulators for a rerouting
+//! round
+struct RerouteCandidate {
+  unsigned int agent;
+  //! steps since the agent entered its edge
+  unsigned int steps_on_edge;
+  unsigned int route_offset;
+  unsigned int route_size;
+  int route_ptr;
+  bool in_queue;
+};
+
 } // namespace LC
 
 #endif // LC_B18_TRAFFIC_PERSON_H
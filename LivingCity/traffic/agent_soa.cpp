@@ -0,0 +1,114 @@
+#include "agent_soa.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace LC {
+
+void AgentsHotBuffer::scatter(const std::vector<Agent> &agents) {
+  const auto n = agents.size();
+  active_.resize(n);
+  in_queue_.resize(n);
+  time_departure_.resize(n);
+  edge_mid_.resize(n);
+  lane_.resize(n);
+  posInLaneM_.resize(n);
+  v_.resize(n);
+  s_.resize(n);
+  delta_v_.resize(n);
+  max_speed_.resize(n);
+  edge_length_.resize(n);
+  a_.resize(n);
+  b_.resize(n);
+  T_.resize(n);
+  s_0_.resize(n);
+  dv_dt_.resize(n);
+  cum_length_.resize(n);
+  cum_v_.resize(n);
+  num_steps_.resize(n);
+  num_steps_in_queue_.resize(n);
+  slow_down_steps_.resize(n);
+
+  for (std::size_t i = 0; i < n; ++i) {
+    const auto &agent = agents[i];
+    active_[i] = agent.active;
+    in_queue_[i] = agent.in_queue;
+    time_departure_[i] = agent.time_departure;
+    edge_mid_[i] = agent.edge_mid;
+    lane_[i] = agent.lane;
+    posInLaneM_[i] = agent.posInLaneM;
+    v_[i] = agent.v;
+    s_[i] = agent.s;
+    delta_v_[i] = agent.delta_v;
+    max_speed_[i] = agent.max_speed;
+    edge_length_[i] = agent.edge_length;
+    a_[i] = agent.a;
+    b_[i] = agent.b;
+    T_[i] = agent.T;
+    s_0_[i] = agent.s_0;
+    dv_dt_[i] = agent.dv_dt;
+    cum_length_[i] = agent.cum_length;
+    cum_v_[i] = agent.cum_v;
+    num_steps_[i] = agent.num_steps;
+    num_steps_in_queue_[i] = agent.num_steps_in_queue;
+    slow_down_steps_[i] = agent.slow_down_steps;
+  }
+
+  departures_.resize(n);
+  std::iota(departures_.begin(), departures_.end(), 0);
+  std::stable_sort(departures_.begin(), departures_.end(),
+                   [this](unsigned int a, unsigned int b) {
+                     return time_departure_[a] < time_departure_[b];
+                   });
+}
+
+void AgentsHotBuffer::gather(std::vector<Agent> &agents) const {
+  for (std::size_t i = 0; i < agents.size() && i < size(); ++i) {
+    auto &agent = agents[i];
+    agent.active = active_[i];
+    agent.in_queue = in_queue_[i];
+    agent.time_departure = time_departure_[i];
+    agent.edge_mid = edge_mid_[i];
+    agent.lane = lane_[i];
+    agent.posInLaneM = posInLaneM_[i];
+    agent.v = v_[i];
+    agent.s = s_[i];
+    agent.delta_v = delta_v_[i];
+    agent.max_speed = max_speed_[i];
+    agent.edge_length = edge_length_[i];
+    agent.dv_dt = dv_dt_[i];
+    agent.cum_length = cum_length_[i];
+    agent.cum_v = cum_v_[i];
+    agent.num_steps = num_steps_[i];
+    agent.num_steps_in_queue = num_steps_in_queue_[i];
+    agent.slow_down_steps = slow_down_steps_[i];
+  }
+}
+
+AgentsHot AgentsHotBuffer::view() {
+  AgentsHot hot;
+  hot.active = active_.data();
+  hot.in_queue = in_queue_.data();
+  hot.time_departure = time_departure_.data();
+  hot.edge_mid = edge_mid_.data();
+  hot.lane = lane_.data();
+  hot.posInLaneM = posInLaneM_.data();
+  hot.v = v_.data();
+  hot.s = s_.data();
+  hot.delta_v = delta_v_.data();
+  hot.max_speed = max_speed_.data();
+  hot.edge_length = edge_length_.data();
+  hot.a = a_.data();
+  hot.b = b_.data();
+  hot.T = T_.data();
+  hot.s_0 = s_0_.data();
+  hot.dv_dt = dv_dt_.data();
+  hot.cum_length = cum_length_.data();
+  hot.cum_v = cum_v_.data();
+  hot.num_steps = num_steps_.data();
+  hot.num_steps_in_queue = num_steps_in_queue_.data();
+  hot.slow_down_steps = slow_down_steps_.data();
+  return hot;
+}
+
+} // namespace LC
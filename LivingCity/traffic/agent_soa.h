@@ -0,0 +1,120 @@
+#ifndef LC_AGENT_SOA_H
+#define LC_AGENT_SOA_H
+
+#include <vector>
+
+#include "edge_data.h"
+#include "agent.h"
+
+namespace LC {
+//! AgentsHot Struct
+//! \brief Struct of arrays holding the agent fields touched on every
+//! simulation step (one array per field, indexed by agent id): the car
+//! following state, the IDM parameters and the statistics counted every
+//! step. The stepping kernels of both backends read/write these arrays; the
+//! cold fields (route metadata, queue position, statistics of edge changes)
+//! stay in the LC::Agent array
+struct AgentsHot {
+  unsigned short *active;
+  uchar *in_queue;
+  float *time_departure;
+  unsigned int *edge_mid;
+  unsigned short *lane;
+  float *posInLaneM;
+  float *v;
+  float *s;
+  float *delta_v;
+  float *max_speed;
+  float *edge_length;
+  // IDM parameters
+  float *a;
+  float *b;
+  float *T;
+  float *s_0;
+  // statistics
+  float *dv_dt;
+  float *cum_length;
+  float *cum_v;
+  unsigned int *num_steps;
+  unsigned int *num_steps_in_queue;
+  unsigned int *slow_down_steps;
+};
+
+//! AgentHot Struct
+//! \brief Hot fields of one agent, loaded into registers for a step
+struct AgentHot {
+  unsigned short active;
+  bool in_queue;
+  float time_departure;
+  unsigned int edge_mid;
+  unsigned short lane;
+  float posInLaneM;
+  float v;
+  float s;
+  float delta_v;
+  float max_speed;
+  float edge_length;
+  float a;
+  float b;
+  float T;
+  float s_0;
+  float dv_dt;
+  float cum_length;
+  float cum_v;
+  unsigned int num_steps;
+  unsigned int num_steps_in_queue;
+  unsigned int slow_down_steps;
+};
+
+//! AgentsHotBuffer Class
+//! \brief Host storage for AgentsHot. The hot fields are scattered from the
+//! agent vector when a simulation starts and gathered back into it whenever
+//! the host needs the agents (output, end of simulation). Scattering also
+//! builds the departure calendar the backends activate agents from
+class AgentsHotBuffer {
+public:
+  //! Copy the hot fields of the agents into the arrays
+  //! \param[in] agents agent vector
+  void scatter(const std::vector<Agent> &agents);
+
+  //! Copy the hot arrays back into the agents
+  //! \param[in,out] agents agent vector
+  void gather(std::vector<Agent> &agents) const;
+
+  //! Pointers to the host arrays
+  AgentsHot view();
+
+  //! Number of agents
+  std::size_t size() const { return active_.size(); }
+
+  //! Departure calendar: agent ids sorted by departure time
+  const std::vector<unsigned int> &departures() const { return departures_; }
+
+private:
+  std::vector<unsigned short> active_;
+  std::vector<uchar> in_queue_;
+  std::vector<float> time_departure_;
+  std::vector<unsigned int> edge_mid_;
+  std::vector<unsigned short> lane_;
+  std::vector<float> posInLaneM_;
+  std::vector<float> v_;
+  std::vector<float> s_;
+  std::vector<float> delta_v_;
+  std::vector<float> max_speed_;
+  std::vector<float> edge_length_;
+  std::vector<float> a_;
+  std::vector<float> b_;
+  std::vector<float> T_;
+  std::vector<float> s_0_;
+  std::vector<float> dv_dt_;
+  std::vector<float> cum_length_;
+  std::vector<float> cum_v_;
+  std::vector<unsigned int> num_steps_;
+  std::vector<unsigned int> num_steps_in_queue_;
+  std::vector<unsigned int> slow_down_steps_;
+  std::vector<unsigned int> departures_;
+};
+
+} // namespace LC
+
+#endif // LC_AGENT_SOA_H
@@ -0,0 +1,150 @@
+#include "binary_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace LC {
+
+namespace {
+const char kMagic[8] = {'L', 'C', 'C', 'A', 'C', 'H', 'E', '\0'};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_sections;
+  uint64_t stamp;
+  uint64_t count[2];
+  uint64_t record_size[2];
+  //! Byte offset of each section from the start of the file
+  uint64_t offset[2];
+};
+
+uint64_t align8(uint64_t bytes) { return (bytes + 7) & ~uint64_t(7); }
+} // namespace
+
+BinaryCache::~BinaryCache() {
+  if (map_ != nullptr) {
+    munmap(map_, map_size_);
+  }
+}
+
+uint64_t BinaryCache::stamp_(const std::vector<std::string> &sources) {
+  // FNV-1a over the size and modification time of every source
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+      hash ^= (value >> (8 * i)) & 0xFF;
+      hash *= 1099511628211ull;
+    }
+  };
+  for (const auto &source : sources) {
+    struct stat info;
+    if (stat(source.c_str(), &info) != 0) {
+      return 0;
+    }
+    mix(info.st_size);
+    mix(info.st_mtime);
+  }
+  return hash;
+}
+
+bool BinaryCache::open(const std::string &filename,
+                       const std::vector<std::string> &sources) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+  void *map = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+
+  const auto *header = static_cast<const Header *>(map);
+  bool valid = std::memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+               header->version == kVersion && header->num_sections == 2 &&
+               header->stamp == stamp_(sources) && header->stamp != 0;
+  for (int i = 0; valid && i < 2; ++i) {
+    valid = header->offset[i] + header->count[i] * header->record_size[i] <=
+            (uint64_t)info.st_size;
+  }
+  if (not valid) {
+    munmap(map, info.st_size);
+    return false;
+  }
+
+  if (map_ != nullptr) {
+    munmap(map_, map_size_);
+  }
+  map_ = map;
+  map_size_ = info.st_size;
+  return true;
+}
+
+std::size_t BinaryCache::size(int i) const {
+  return static_cast<const Header *>(map_)->count[i];
+}
+
+const void *BinaryCache::section_data_(int i, std::size_t record_size) const {
+  const auto *header = static_cast<const Header *>(map_);
+  if (header->record_size[i] != record_size) {
+    std::cerr << "Error: binary cache record size mismatch in section " << i
+              << std::endl;
+    abort();
+  }
+  return static_cast<const char *>(map_) + header->offset[i];
+}
+
+bool BinaryCache::write_(const std::string &filename,
+                         const std::vector<std::string> &sources,
+                         const void *const data[2], const uint64_t count[2],
+                         const uint64_t record_size[2]) {
+  Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.num_sections = 2;
+  header.stamp = stamp_(sources);
+  uint64_t offset = align8(sizeof(Header));
+  for (int i = 0; i < 2; ++i) {
+    header.count[i] = count[i];
+    header.record_size[i] = record_size[i];
+    header.offset[i] = offset;
+    offset = align8(offset + count[i] * record_size[i]);
+  }
+
+  // write to a temporary file first so a reader never maps a partial cache
+  const std::string tmpname = filename + ".tmp";
+  std::ofstream file(tmpname, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    return false;
+  }
+  const char padding[8] = {0};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  uint64_t written = sizeof(header);
+  for (int i = 0; i < 2; ++i) {
+    file.write(padding, header.offset[i] - written);
+    file.write(static_cast<const char *>(data[i]),
+               count[i] * record_size[i]);
+    written = header.offset[i] + count[i] * record_size[i];
+  }
+  file.close();
+  if (!file || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+    std::remove(tmpname.c_str());
+    return false;
+  }
+  return true;
+}
+
+} // namespace LC
@@ -0,0 +1,85 @@
+#ifndef LC_BINARY_CACHE_H
+#define LC_BINARY_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace LC {
+
+//! BinaryCache Class
+//! \brief Versioned binary snapshot of parsed input tables (network, OD). A
+//! cache file holds a header followed by up to two sections of fixed size
+//! records. The header stores a stamp of the source files, so a cache whose
+//! sources changed is ignored. Caches are memory mapped on load
+class BinaryCache {
+public:
+  //! Version of the file layout (bump when a record type changes)
+  static const uint32_t kVersion = 2;
+
+  BinaryCache() = default;
+  ~BinaryCache();
+  BinaryCache(const BinaryCache &) = delete;
+  BinaryCache &operator=(const BinaryCache &) = delete;
+
+  //! Map a cache file
+  //! \param[in] filename cache file path
+  //! \param[in] sources input files the cache was built from
+  //! \retval status false if the file is missing, stale or of another version
+  bool open(const std::string &filename,
+            const std::vector<std::string> &sources);
+
+  //! Records of a section
+  //! \param[in] i section index
+  template <typename T> const T *section(int i) const {
+    return reinterpret_cast<const T *>(section_data_(i, sizeof(T)));
+  }
+
+  //! Number of records in a section
+  //! \param[in] i section index
+  std::size_t size(int i) const;
+
+  //! Write a cache file with two sections
+  //! \param[in] filename cache file path
+  //! \param[in] sources input files the cache is built from
+  //! \param[in] first records of section 0
+  //! \param[in] second records of section 1
+  //! \retval status false if the file could not be written
+  template <typename T0, typename T1>
+  static bool write(const std::string &filename,
+                    const std::vector<std::string> &sources,
+                    const std::vector<T0> &first,
+                    const std::vector<T1> &second) {
+    const void *data[2] = {first.data(), second.data()};
+    const uint64_t count[2] = {first.size(), second.size()};
+    const uint64_t record_size[2] = {sizeof(T0), sizeof(T1)};
+    return write_(filename, sources, data, count, record_size);
+  }
+
+  //! Write a cache file with one section
+  template <typename T>
+  static bool write(const std::string &filename,
+                    const std::vector<std::string> &sources,
+                    const std::vector<T> &records) {
+    return write(filename, sources, records, std::vector<char>());
+  }
+
+private:
+  void *map_{nullptr};
+  std::size_t map_size_{0};
+
+  const void *section_data_(int i, std::size_t record_size) const;
+
+  static bool write_(const std::string &filename,
+                     const std::vector<std::string> &sources,
+                     const void *const data[2], const uint64_t count[2],
+                     const uint64_t record_size[2]);
+
+  //! Stamp (size and modification time) of the source files
+  static uint64_t stamp_(const std::vector<std::string> &sources);
+};
+
+} // namespace LC
+
+#endif // LC_BINARY_CACHE_H
@@ -24,6 +24,13 @@ const int SOCIAL_DIST{3};
 const float INIT_SPEED{3};
 //! Initial queue cap (for agent initialization)
 const short INIT_QUEUE_CAP{10};
+//! Minimum capacity of a movement queue
+const unsigned MOVEMENT_QUEUE_CAP{10};
+//! Steps between two compactions of the active agent list
+const int ACTIVE_COMPACT_STEPS{120};
+//! Distance (m) ahead of an agent searched for a leader on the next edge of
+//! its route when the rest of its edge is free
+const int LOOK_AHEAD_M{64};
 
 
 struct IDMParametersCar {
@@ -0,0 +1,1051 @@
+// CPU CODE
+// Multithreaded (OpenMP) mirror of cuda_simulator.cu. Every __device__ helper
+// has a host twin with the same name and logic so that both backends step the
+// agents and intersections identically; the kernels become parallel for loops.
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#include <parallel/algorithm>
+#endif
+
+#include "agent_soa.h"
+#include "cpu_simulator.h"
+
+#ifndef ushort
+#define ushort uint16_t
+#endif
+#ifndef uint
+#define uint uint32_t
+#endif
+#ifndef uchar
+#define uchar uint8_t
+#endif
+
+using namespace LC;
+
+namespace {
+////////////////////////////////
+// VARIABLES (host buffers, bound in place to the simulator vectors)
+LC::Agent *trafficPersonVec_h = nullptr;
+LC::AgentsHotBuffer hotBuffer_h;
+AgentsHot hot_h;
+uint *routes_h = nullptr;
+LC::EdgeData *edgesData_h = nullptr;
+LC::IntersectionData *intersections_h = nullptr;
+LC::MovementData *movements_h = nullptr;
+int *queuePool_h = nullptr;
+
+// Agents departed and not yet removed as finished; new departures are
+// appended from the calendar, finished agents dropped every
+// ACTIVE_COMPACT_STEPS steps
+std::vector<uint> activeList_h;
+uint nextDeparture = 0;
+uint numSteps = 0;
+uchar *laneMap_h = nullptr;
+// One bit per lanemap byte (same layout and halves): set where a vehicle wrote
+// its speed. The scans for vehicles skip free road a word (32 m) at a time.
+// Every word keeps the step that wrote it in its upper 32 bits and words of
+// older steps read as empty, so the halves are never cleared
+unsigned long long *laneOccupancy_h = nullptr;
+// Step writing the lanemap, the read half was written at mapEpoch - 1
+uint mapEpoch = 0;
+// First lanemap cell of every edge (Lanemap::cell_offsets)
+uint *cellOffsets_h = nullptr;
+
+// Vehicles on the edges at the start of the step (the state the read half of
+// the lanemap holds) sorted by vehicle_key, with their speed in 3*m/s as in
+// the lanemap, and the place of every agent in the order (NO_VEHICLE if it
+// was not on an edge)
+const uint NO_VEHICLE = 0xFFFFFFFF;
+std::vector<std::pair<unsigned long long, uint>> vehicleSort_h;
+std::vector<unsigned long long> vehicleKeys_h;
+std::vector<uchar> vehicleSpeeds_h;
+std::vector<uint> vehicleRank_h;
+uint numVehicles = 0;
+
+// En-route rerouting data listed by cpu_stage_reroute
+uint numEdges = 0;
+std::vector<LC::RerouteCandidate> rerouteStage_h;
+std::vector<LC::EdgeTravel> edgeTravel_h;
+
+bool readFirstMapC = true;
+uint mapToReadShift;
+uint mapToWriteShift;
+uint halfLaneMap;
+
+//! Atomically reserve one slot at the rear of a queue
+inline unsigned reserve_slot(unsigned &rear) {
+  unsigned slot;
+#pragma omp atomic capture
+  slot = rear++;
+  return slot;
+}
+
+inline void atomic_add(unsigned int &counter, unsigned int value) {
+#pragma omp atomic
+  counter += value;
+}
+
+inline void atomic_sub(unsigned int &counter, unsigned int value) {
+#pragma omp atomic
+  counter -= value;
+}
+
+//! Load the hot fields of agent p
+inline AgentHot load_hot(const AgentsHot &hot, int p) {
+  AgentHot agent;
+  agent.active = hot.active[p];
+  agent.in_queue = hot.in_queue[p];
+  agent.time_departure = hot.time_departure[p];
+  agent.edge_mid = hot.edge_mid[p];
+  agent.lane = hot.lane[p];
+  agent.posInLaneM = hot.posInLaneM[p];
+  agent.v = hot.v[p];
+  agent.s = hot.s[p];
+  agent.delta_v = hot.delta_v[p];
+  agent.max_speed = hot.max_speed[p];
+  agent.edge_length = hot.edge_length[p];
+  agent.a = hot.a[p];
+  agent.b = hot.b[p];
+  agent.T = hot.T[p];
+  agent.s_0 = hot.s_0[p];
+  agent.dv_dt = hot.dv_dt[p];
+  agent.cum_length = hot.cum_length[p];
+  agent.cum_v = hot.cum_v[p];
+  agent.num_steps = hot.num_steps[p];
+  agent.num_steps_in_queue = hot.num_steps_in_queue[p];
+  agent.slow_down_steps = hot.slow_down_steps[p];
+  return agent;
+}
+
+//! Store the hot fields of agent p (time_departure and the IDM parameters are
+//! read only)
+inline void store_hot(AgentsHot &hot, int p, const AgentHot &agent) {
+  hot.active[p] = agent.active;
+  hot.in_queue[p] = agent.in_queue;
+  hot.edge_mid[p] = agent.edge_mid;
+  hot.lane[p] = agent.lane;
+  hot.posInLaneM[p] = agent.posInLaneM;
+  hot.v[p] = agent.v;
+  hot.s[p] = agent.s;
+  hot.delta_v[p] = agent.delta_v;
+  hot.max_speed[p] = agent.max_speed;
+  hot.edge_length[p] = agent.edge_length;
+  hot.dv_dt[p] = agent.dv_dt;
+  hot.cum_length[p] = agent.cum_length;
+  hot.cum_v[p] = agent.cum_v;
+  hot.num_steps[p] = agent.num_steps;
+  hot.num_steps_in_queue[p] = agent.num_steps_in_queue;
+  hot.slow_down_steps[p] = agent.slow_down_steps;
+}
+
+uint lanemap_pos(const uint currentEdge, const uint edge_length,
+                 const uint laneNum, const uint pos_in_lane) {
+  uint kMaxMapWidthM = 1024;
+  int tot_num_cell = edge_length / kMaxMapWidthM;
+  if (edge_length % kMaxMapWidthM) {
+    tot_num_cell += 1;
+  }
+  return kMaxMapWidthM * (cellOffsets_h[currentEdge] + laneNum * tot_num_cell) +
+         pos_in_lane;
+}
+
+//! Mark a lanemap byte as written in this step
+inline void set_occupied(uint pos) {
+  auto *word = &laneOccupancy_h[pos / 32];
+  const unsigned long long bit = 1ull << (pos % 32);
+  // the first writer of the step replaces the bits of an older step
+  unsigned long long old = __atomic_load_n(word, __ATOMIC_RELAXED);
+  while ((old >> 32) != mapEpoch) {
+    const unsigned long long stamped =
+        ((unsigned long long)mapEpoch << 32) | bit;
+    if (__atomic_compare_exchange_n(word, &old, stamped, false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      return;
+    }
+  }
+  __atomic_fetch_or(word, bit, __ATOMIC_RELAXED);
+}
+
+//! Occupancy bits of a word of the read half (none if written before the
+//! last step)
+inline uint occupied_bits(uint word) {
+  const unsigned long long bits = laneOccupancy_h[word];
+  return (bits >> 32) == mapEpoch - 1 ? (uint)bits : 0;
+}
+
+//! First occupied lanemap byte in [from, to), to if there is none
+uint next_occupied(uint from, uint to) {
+  while (from < to) {
+    uint word = occupied_bits(from / 32) >> (from % 32);
+    if (word != 0) {
+      return std::min<uint>(from + __builtin_ctz(word), to);
+    }
+    from += 32 - from % 32;
+  }
+  return to;
+}
+
+//! Last occupied lanemap byte in [from, to), to if there is none
+uint last_occupied(uint from, uint to) {
+  uint end = to;
+  while (end > from) {
+    uint last = end - 1;
+    uint word = occupied_bits(last / 32) << (31 - last % 32);
+    if (word != 0) {
+      uint pos = last - __builtin_clz(word);
+      return pos >= from ? pos : to;
+    }
+    end = last - last % 32;
+  }
+  return to;
+}
+
+//! Sort key of a vehicle at meter pos of a lane. The keys of a lane are
+//! [vehicle_key(edge, lane, 0), vehicle_key(edge, lane, 0) + 0x10000)
+//! (the lanemap rejects edges of 65535 m or more)
+inline unsigned long long vehicle_key(uint edge_mid, uint lane, uint pos) {
+  return ((unsigned long long)edge_mid << 32) | ((lane & 0xFFFF) << 16) |
+         (pos & 0xFFFF);
+}
+
+//! First vehicle of the sorted order with a key of at least key
+uint lower_vehicle(unsigned long long key) {
+  uint first = 0;
+  uint count = numVehicles;
+  while (count > 0) {
+    uint step = count / 2;
+    if (vehicleKeys_h[first + step] < key) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return first;
+}
+
+//! First meter of the stop line an intersection places at the end of a full
+//! edge (place_stop). The stop line is only in the lanemap
+inline uint stop_line(const AgentHot &agent) {
+  uint end = agent.edge_length;
+  return end > SOCIAL_DIST - 1 ? end - (SOCIAL_DIST - 1) : 0;
+}
+
+void calculateGaps(uchar *laneMap, AgentHot &agent, uint laneToCheck,
+                   float &gap_a, float &gap_b, uchar &v_a, uchar &v_b) {
+  const auto lane = vehicle_key(agent.edge_mid, laneToCheck, 0);
+  // the meters of a lane are contiguous in the lanemap
+  uint map_lane = mapToReadShift +
+                  lanemap_pos(agent.edge_mid, agent.edge_length, laneToCheck, 0);
+
+  // CHECK FORWARD
+  ushort first = agent.posInLaneM - 1; // NOTE -1 to make sure there is none in
+                                       // at the same level
+  uint next = lower_vehicle(lane + first);
+  uint pos = ceilf(agent.edge_length);
+  if (next < numVehicles && vehicleKeys_h[next] < lane + 0x10000) {
+    pos = vehicleKeys_h[next] & 0xFFFF;
+    v_a = vehicleSpeeds_h[next] / 3;
+  }
+  uint stop = next_occupied(map_lane + std::max<uint>(first, stop_line(agent)),
+                            map_lane + pos);
+  if (stop < map_lane + pos) {
+    pos = stop - map_lane;
+    v_a = laneMap[stop] / 3;
+  }
+  if (pos < agent.edge_length) {
+    gap_a = pos - agent.posInLaneM; // m
+  }
+  // CHECK BACKWARD
+  ushort last = agent.posInLaneM + 1;
+  uint prev = lower_vehicle(lane + last + 1);
+  pos = 0;
+  if (prev > 0 && vehicleKeys_h[prev - 1] > lane) {
+    pos = vehicleKeys_h[prev - 1] & 0xFFFF;
+    v_b = vehicleSpeeds_h[prev - 1] / 3;
+  }
+  stop = last_occupied(
+      map_lane + std::max<uint>(pos + 1, stop_line(agent)), map_lane + last + 1);
+  if (stop < map_lane + last + 1) {
+    pos = stop - map_lane;
+    v_b = laneMap[stop] / 3;
+  }
+  if (pos > 0) {
+    gap_b = agent.posInLaneM - pos; // m
+  }
+}
+
+bool check_space(int space, int eid, int edge_length, uint mapToReadShift) {
+  // just right LANE !!!!!!!
+  uint lane = mapToReadShift + lanemap_pos(eid, edge_length, 0, 0);
+  return next_occupied(lane, lane + space) == lane + space;
+}
+
+//! Append an agent to a queue, false if the queue is full
+bool enqueue(LC::QueueData &queue, int *queuePool, int agent_id) {
+  unsigned slot = reserve_slot(queue.size);
+  if (slot >= queue.capacity) { // full: the agent retries in check_stagnation
+    atomic_sub(queue.size, 1);
+    return false;
+  }
+  queuePool[queue.offset + (queue.head + slot) % queue.capacity] = agent_id;
+  return true;
+}
+
+//! i-th agent of a queue (0 is the front)
+int queue_at(const LC::QueueData &queue, const int *queuePool, unsigned i) {
+  return queuePool[queue.offset + (queue.head + i) % queue.capacity];
+}
+
+int deque(LC::QueueData &queue, int *queuePool) {
+  int aid = queuePool[queue.offset + queue.head];
+  queue.head = (queue.head + 1) % queue.capacity;
+  queue.size--;
+  return aid;
+}
+
+void initialize_agent(int agent_id, AgentHot &agent, LC::Agent &info,
+                      LC::IntersectionData *intersections, int *queuePool) {
+
+  // 1.1  edge case: no available route
+  if (info.route_size == 0) {
+    agent.active = 2;
+    return;
+  }
+  // add to corresponding queue
+  auto &intersection = intersections[info.init_intersection];
+  enqueue(intersection.init_queue, queuePool, agent_id);
+
+  // initialize agent
+  agent.active = 1;
+  agent.in_queue = true;
+  info.intersection_id = info.init_intersection;
+}
+
+bool in_queue(int agent_id, const LC::QueueData &queue, const int *queuePool) {
+  unsigned size = std::min(queue.size, queue.capacity);
+  for (unsigned i = 0; i < size; ++i) {
+    if (queue_at(queue, queuePool, i) == agent_id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void check_stagnation(int agent_id, LC::Agent &info,
+                      LC::IntersectionData *intersections,
+                      LC::MovementData *movements, int *queuePool) {
+  auto &intersection = intersections[info.intersection_id];
+  auto &queue =
+      info.queue_idx == -1
+          ? intersection.init_queue
+          : movements[intersection.movement_offset + info.queue_idx].queue;
+  if (in_queue(agent_id, queue, queuePool)) {
+    return;
+  }
+  // try to place the agent to the queue again
+  enqueue(queue, queuePool, agent_id);
+}
+
+void check_front_car(int agent_id, AgentHot &agent, LC::Agent &info,
+                     LC::EdgeData *edgesData, uchar *laneMap, uint *routes) {
+
+  ushort byteInLine = (ushort)floor(agent.posInLaneM);
+
+  // a) SAME LINE (BEFORE SIGNALING): the next vehicle of the lane in the
+  // sorted order, looked up if the agent entered the edge in this step
+  float s = 20;
+  float delta_v = agent.v - agent.max_speed;
+  const auto lane = vehicle_key(agent.edge_mid, agent.lane, 0);
+  uint next = vehicleRank_h[agent_id];
+  if (next == NO_VEHICLE) {
+    next = lower_vehicle(lane + byteInLine + 1);
+  } else {
+    do {
+      ++next; // skip vehicles at the same meter
+    } while (next < numVehicles && vehicleKeys_h[next] <= lane + byteInLine);
+  }
+  uint pos = ceilf(agent.edge_length);
+  uchar laneChar = 0xFF;
+  if (next < numVehicles && vehicleKeys_h[next] < lane + 0x10000) {
+    pos = vehicleKeys_h[next] & 0xFFFF;
+    laneChar = vehicleSpeeds_h[next];
+  }
+  // b) the stop line of a full queue
+  uint map_lane = mapToReadShift +
+                  lanemap_pos(agent.edge_mid, agent.edge_length, agent.lane, 0);
+  uint stop = next_occupied(
+      map_lane + std::max<uint>(byteInLine + 1, stop_line(agent)),
+      map_lane + pos);
+  if (stop < map_lane + pos) {
+    pos = stop - map_lane;
+    laneChar = laneMap[stop];
+  }
+  if (pos < agent.edge_length) {
+    s = ((float)(pos - byteInLine)); // m
+    delta_v =
+        agent.v -
+        (laneChar / 3.0f); // laneChar is in 3*ms (to save space in array)
+  } else if (info.route_ptr + 1 < int(info.route_size)) {
+    // c) NEXT EDGE: the rest of the edge is free, look at the lane the agent
+    // enters the next edge of its route on, up to LOOK_AHEAD_M ahead
+    int toEnd = ceilf(agent.edge_length) - byteInLine;
+    if (toEnd < LOOK_AHEAD_M) {
+      auto next_mid = routes[info.route_offset + info.route_ptr + 1];
+      auto &next_edge = edgesData[next_mid];
+      uint next_lane =
+          mapToReadShift + lanemap_pos(next_mid, next_edge.length, 0, 0);
+      uint end = next_lane + std::min<uint>(ceilf(next_edge.length),
+                                            LOOK_AHEAD_M - toEnd);
+      uint ahead = next_occupied(next_lane, end);
+      if (ahead < end) {
+        s = ((float)(toEnd + ahead - next_lane)); // m
+        delta_v = agent.v - (laneMap[ahead] / 3.0f);
+      }
+    }
+  }
+  agent.s = s;
+  agent.delta_v = delta_v;
+}
+
+void update_agent_info(AgentHot &agent, float deltaTime) {
+
+  // update speed
+  float thirdTerm = 0;
+  if (agent.delta_v > -0.01) { // car in front and slower than us
+    // 2.1.2 calculate dv_dt
+    float s_star =
+        agent.s_0 +
+        fmax(0.0f, (agent.v * agent.T + (agent.v * agent.delta_v) /
+                                            (2 * sqrtf(agent.a * agent.b))));
+
+    thirdTerm = powf(((s_star) / (agent.s)), 2);
+    agent.slow_down_steps++;
+  }
+  float dv_dt =
+      agent.a * (1.0f - std::pow((agent.v / agent.max_speed), 4) - thirdTerm);
+  agent.dv_dt = dv_dt;
+  // 2.1.3 update values
+  agent.v += dv_dt * deltaTime;
+  // if safe enough, speed up instead of creeping
+  if ((agent.s > 2 * SOCIAL_DIST) and (agent.v < INIT_SPEED)) {
+    agent.v = INIT_SPEED;
+  }
+  float numMToMove =
+      fmax(0.0f, agent.v * deltaTime + 0.5f * (dv_dt)*deltaTime * deltaTime);
+  // freeze if below social distance
+  if (agent.v < 0 or
+      (agent.s - numMToMove < SOCIAL_DIST and agent.v - agent.delta_v < 0.1)) {
+    agent.v = 0;
+    numMToMove = 0;
+  }
+  agent.cum_length += numMToMove;
+  agent.cum_v += agent.v;
+  agent.posInLaneM += numMToMove;
+}
+
+void change_lane(AgentHot &agent, LC::Agent &info, LC::EdgeData *edgesData,
+                 uchar *laneMap) {
+
+  auto &current_edge = edgesData[agent.edge_mid];
+  if (agent.posInLaneM > current_edge.length) { // skip if will go to next edge
+    return;
+  }
+  if (current_edge.num_lanes < 2 || agent.v > 0.9 * agent.max_speed) {
+    return; // skip if reach the destination/have no lane to change/cruising
+            // (avoid periodic lane changing)
+  }
+
+  if (agent.delta_v > -0.01 &&    // decelerating or stuck
+      agent.num_steps % 2 == 0) { // check every 2 steps (1 second)
+
+    bool leftLane = agent.lane > 0; // at least one lane on the left
+    bool rightLane =
+        agent.lane < current_edge.num_lanes - 1; // at least one lane
+
+    if (leftLane && rightLane) {
+      if (int(agent.v) % 2 == 0) { // pseudo random for change lane
+        rightLane = false;
+      }
+    }
+
+    ushort laneToCheck = agent.lane - 1;
+    if (rightLane) {
+      laneToCheck = agent.lane + 1;
+    }
+
+    uchar v_a, v_b;
+    float gap_a = 1000.0f, gap_b = 1000.0f;
+    calculateGaps(laneMap, agent, laneToCheck, gap_a, gap_b, v_a, v_b);
+
+    // Safe distance calculation
+    float b1A = 0.05, b2A = 0.15;
+    float b1B = 0.15, b2B = 0.40;
+    // simParameters.s_0-> critical lead gap
+    float g_na_D =
+        fmax(agent.s_0, agent.s_0 + b1A * agent.v + b2A * (agent.v - v_a));
+    float g_bn_D =
+        fmax(agent.s_0, agent.s_0 + b1B * v_b + b2B * (v_b - agent.v));
+    if (gap_b < g_bn_D || gap_a < g_na_D) { // gap smaller than critical gap
+      return;
+    }
+
+    agent.lane = laneToCheck; // CHANGE LINE
+    info.num_lane_change += 1;
+  }
+}
+
+uint find_intersetcion_id(AgentHot &agent, LC::Agent &info,
+                          LC::EdgeData *edgesData, uint *routes) {
+  // find the intersection id
+  auto &current_edge = edgesData[agent.edge_mid];
+  auto &next_edge = edgesData[routes[info.route_offset + info.route_ptr + 1]];
+  for (unsigned i = 0; i < 2; i++) {
+    auto vid = current_edge.vertex[i];
+    for (unsigned j = 0; j < 2; j++) {
+      if (next_edge.vertex[j] == vid) {
+        return vid;
+      }
+    }
+  }
+  return 0;
+}
+
+uint find_queue_id(AgentHot &agent, LC::Agent &info,
+                   LC::IntersectionData &intersection,
+                   LC::MovementData *movements, uint *routes) {
+  auto next_mid = routes[info.route_offset + info.route_ptr + 1];
+  for (unsigned i = 0; i < intersection.num_queue; i++) {
+    auto &movement = movements[intersection.movement_offset + i];
+    if (agent.edge_mid == movement.start_edge and
+        next_mid == movement.end_edge) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+bool update_intersection(int agent_id, AgentHot &agent, LC::Agent &info,
+                         LC::EdgeData *edgesData,
+                         LC::IntersectionData *intersections,
+                         LC::MovementData *movements, int *queuePool,
+                         uint *routes) {
+  auto &current_edge = edgesData[agent.edge_mid];
+  auto extra = agent.posInLaneM - agent.edge_length;
+  if (extra < 0) { // does not reach an intersection
+    return false;
+  }
+  agent.cum_length -= extra;                     // remove the extra distance
+  if (info.route_ptr + 1 >= int(info.route_size)) { // reach destination
+    agent.active = 2;
+    atomic_add(current_edge.downstream_veh_count, 1);
+    int num_steps_in_edge = agent.num_steps - info.num_steps_entering_edge;
+    atomic_add(current_edge.period_cum_travel_steps,
+               num_steps_in_edge); // for average travel time calculation
+    return false;
+  }
+  auto intersetcion_id = find_intersetcion_id(agent, info, edgesData, routes);
+  auto &intersection = intersections[intersetcion_id];
+  int queue_id = find_queue_id(agent, info, intersection, movements, routes);
+  auto &queue = movements[intersection.movement_offset + queue_id].queue;
+  info.queue_idx = queue_id;
+  info.intersection_id = intersetcion_id;
+  agent.in_queue = true;
+  agent.v = 0; // in queue vehicle is stopped.
+  int num_steps_in_edge = agent.num_steps - info.num_steps_entering_edge;
+  atomic_add(current_edge.period_cum_travel_steps,
+             num_steps_in_edge); // for average travel time calculation
+
+  enqueue(queue, queuePool, agent_id);
+  atomic_add(current_edge.downstream_veh_count, 1);
+  return true;
+}
+
+void write2lane_map(AgentHot &agent, uchar *laneMap) {
+  // write to the lanemap if still on the edge
+
+  auto posToSample = lanemap_pos(agent.edge_mid, agent.edge_length, agent.lane,
+                                 agent.posInLaneM);
+  uchar vInMpS = (uchar)(agent.v * 3); // speed in m/s to fit in uchar
+  laneMap[mapToWriteShift + posToSample] = vInMpS;
+  set_occupied(mapToWriteShift + posToSample);
+}
+
+//! Simulate one agent's movement on network edges
+void trafficSimulation(int p, float currentTime, AgentsHot hot,
+                       LC::Agent *agents, LC::EdgeData *edgesData,
+                       uchar *laneMap, LC::IntersectionData *intersections,
+                       LC::MovementData *movements, int *queuePool,
+                       uint *routes, float deltaTime) {
+
+  // 1. initialization
+  if (hot.active[p] == 2) { // agent is already finished
+    return;
+  }
+  // 1.1. check if person should still wait or should start
+  if (hot.active[p] == 0 && hot.time_departure[p] > currentTime) { // wait
+    return;
+  }
+  auto agent = load_hot(hot, p);
+  auto &info = agents[p];
+  if (agent.active == 0) { // its your turn
+    initialize_agent(p, agent, info, intersections, queuePool);
+    store_hot(hot, p, agent);
+    return;
+  }
+
+  // 2. Moving
+  agent.num_steps++;
+  if (agent.in_queue) { // only the step counters change while queued
+    hot.num_steps[p] = agent.num_steps;
+    hot.num_steps_in_queue[p] = agent.num_steps_in_queue + 1;
+    check_stagnation(p, info, intersections, movements, queuePool);
+    return;
+  }
+
+  // 2.1.1 Find front car
+  check_front_car(p, agent, info, edgesData, laneMap, routes);
+  // 2.1.2 Update agent information using the front car info
+  update_agent_info(agent, deltaTime);
+  //  2.1.3 Perform lane changing if necessary
+  change_lane(agent, info, edgesData, laneMap);
+  // 2.1.4 check intersection
+  bool added2queue =
+      update_intersection(p, agent, info, edgesData, intersections, movements,
+                          queuePool, routes);
+  // 2.1.5 write the updated agent info to lanemap
+  if (not added2queue) {
+    write2lane_map(agent, laneMap);
+  }
+  store_hot(hot, p, agent);
+}
+
+void move2nextEdge(AgentHot &agent, LC::Agent &info, int numMToMove,
+                   LC::EdgeData *edgesData, uchar *laneMap, uint *routes) {
+
+  agent.in_queue = false;
+  info.route_ptr += 1;
+  agent.edge_mid = routes[info.route_offset + info.route_ptr];
+  agent.posInLaneM = numMToMove;
+  agent.lane = 0;
+  agent.v = INIT_SPEED; // double initial speed to avoid unnecessary queueing
+
+  auto &current_edge = edgesData[agent.edge_mid];
+  info.edge_id = current_edge.eid;
+  agent.max_speed = current_edge.maxSpeedMperSec;
+  agent.edge_length = current_edge.length;
+  info.num_steps_entering_edge = agent.num_steps;
+  //
+  atomic_add(current_edge.upstream_veh_count, 1);
+
+  auto posToSample = lanemap_pos(agent.edge_mid, current_edge.length,
+                                 agent.lane, agent.posInLaneM);
+  uchar vInMpS = (uchar)(agent.v * 3); // speed in m/s to fit in uchar
+  laneMap[mapToWriteShift + posToSample] = vInMpS;
+  set_occupied(mapToWriteShift + posToSample);
+  //
+  agent.cum_length += numMToMove;
+  agent.num_steps += 1;
+}
+
+bool discharge_queue(LC::IntersectionData &intersection,
+                     LC::MovementData *movements, int *queuePool,
+                     AgentsHot hot, LC::Agent *trafficPersonVec,
+                     LC::EdgeData *edgesData, uchar *laneMap, uint *routes) {
+  auto &movement = movements[intersection.movement_offset +
+                             intersection.queue_ptr];
+  auto &q1 = movement.queue;
+
+  if (q1.size < 1) {
+    return false;
+  }
+
+  auto aid = queue_at(q1, queuePool, 0);
+  if (not hot.in_queue[aid]) { // bug walk around: agent has been
+                               // reassigned to a queue
+    deque(q1, queuePool);
+    return true;
+  }
+
+  unsigned eid1 = movement.end_edge;
+  int edge_length = edgesData[eid1].length;
+  unsigned numMToMove = SOCIAL_DIST;
+
+  bool enough_space =
+      check_space(numMToMove + SOCIAL_DIST, eid1, edge_length,
+                  mapToReadShift); // check social dist ahead
+
+  intersection.max_queue =
+      std::max<unsigned>(intersection.max_queue, q1.size);
+  bool discharged = false;
+  if (enough_space) {
+    deque(q1, queuePool);
+    auto agent = load_hot(hot, aid);
+    move2nextEdge(agent, trafficPersonVec[aid], numMToMove, edgesData,
+                  laneMap, routes); // move to the next edge
+    store_hot(hot, aid, agent);
+    discharged = true;
+  }
+  return discharged;
+}
+
+void place_stop(AgentHot &agent, LC::EdgeData *edgesData, uchar *laneMap,
+                uint mapToWriteShift) {
+  auto &edge = edgesData[agent.edge_mid];
+  for (int j = 0; j < SOCIAL_DIST; ++j) {
+    auto pos = agent.edge_length - j;
+    for (int i = 0; i < edge.num_lanes; ++i) {
+      auto posToSample = lanemap_pos(agent.edge_mid, agent.edge_length, i, pos);
+      laneMap[mapToWriteShift + posToSample] = 0;
+      set_occupied(mapToWriteShift + posToSample);
+    }
+  }
+}
+
+bool discharge_init_agents(unsigned intersection_id, LC::EdgeData *edgesData,
+                           LC::IntersectionData *intersections,
+                           int *queuePool, AgentsHot hot,
+                           LC::Agent *trafficPersonVec, uchar *laneMap,
+                           uint *routes) {
+  auto &intersection = intersections[intersection_id];
+  auto &init_queue = intersection.init_queue;
+  if (init_queue.size < 1) {
+    return false;
+  }
+  bool discharged = false;
+  auto aid = queue_at(init_queue, queuePool, 0);
+  auto &info = trafficPersonVec[aid];
+  if (not hot.in_queue[aid]) { // bug walk around: agent has been
+                               // reassigned to a queue
+    deque(init_queue, queuePool);
+    return true;
+  }
+
+  auto &first_edge = edgesData[routes[info.route_offset]];
+  unsigned numMToMove = SOCIAL_DIST;
+  bool enough_space =
+      check_space(numMToMove + SOCIAL_DIST, routes[info.route_offset],
+                  first_edge.length,
+                  mapToReadShift); // check social dist ahead
+  if (enough_space) {
+    deque(init_queue, queuePool);
+    auto agent = load_hot(hot, aid);
+    move2nextEdge(agent, info, numMToMove, edgesData, laneMap, routes);
+    store_hot(hot, aid, agent);
+    discharged = true;
+  }
+  // update waiting steps for all other agents
+  for (unsigned i = 0; i < init_queue.size; ++i) {
+    auto aid = queue_at(init_queue, queuePool, i);
+    trafficPersonVec[aid].initial_waited_steps += 1;
+  }
+  return discharged;
+}
+
+void check_queues(unsigned intersection_id, LC::EdgeData *edgesData,
+                  LC::IntersectionData *intersections,
+                  LC::MovementData *movements, int *queuePool, AgentsHot hot,
+                  LC::Agent *trafficPersonVec, uchar *laneMap, uint *routes) {
+  auto &intersection = intersections[intersection_id];
+  bool discharged = false;
+  for (int i = 0; i < intersection.num_queue + 1; ++i) {
+    if (intersection.queue_ptr > intersection.num_queue - 1) {
+      intersection.queue_ptr = 0; // reset
+      discharged =
+          discharge_init_agents(intersection_id, edgesData, intersections,
+                                queuePool, hot, trafficPersonVec, laneMap,
+                                routes);
+    }
+    if (not discharged) {
+      discharged =
+          discharge_queue(intersection, movements, queuePool, hot,
+                          trafficPersonVec, edgesData, laneMap, routes);
+    }
+    intersection.queue_ptr += 1;
+    if (discharged) {
+      break;
+    }
+  }
+}
+
+//! A new route applies if the agent is still on the edge it was rerouted
+//! from, and not yet queued for the next edge when that one was replaced
+bool route_update_valid(const LC::RouteUpdate &update, const LC::Agent &info,
+                        unsigned short active, bool in_queue) {
+  return active == 1 and info.route_offset == update.old_offset and
+         info.route_ptr == update.route_ptr and
+         (int(update.splice) > update.route_ptr + 1 or not in_queue);
+}
+
+//! List agent p for rerouting if it waits with part of its route left to
+//! replace (a queued agent keeps its next edge), and raise the waiting time
+//! of its edge
+void stage_reroute(uint p, const AgentsHot &hot, const LC::Agent *agents,
+                   LC::EdgeTravel *travel,
+                   std::vector<LC::RerouteCandidate> &stage) {
+  const auto &info = agents[p];
+  if (hot.active[p] != 1 or info.route_ptr < 0) {
+    return;
+  }
+  const uint steps = hot.num_steps[p] - info.num_steps_entering_edge;
+  auto &wait = travel[hot.edge_mid[p]].wait_steps;
+  wait = std::max(wait, steps);
+  const bool queued = hot.in_queue[p];
+  const int splice = info.route_ptr + (queued ? 2 : 1);
+  if ((queued or hot.v[p] == 0) and splice < int(info.route_size)) {
+    stage.push_back({p, steps, info.route_offset, info.route_size,
+                     info.route_ptr, queued});
+  }
+}
+
+//! Sort the vehicles on the edges by (edge, lane, position) for the leader
+//! and gap lookups of the step
+void sort_vehicles() {
+  vehicleSort_h.clear();
+  for (const auto p : activeList_h) {
+    vehicleRank_h[p] = NO_VEHICLE;
+    if (hot_h.active[p] == 1 && not hot_h.in_queue[p]) {
+      vehicleSort_h.emplace_back(
+          vehicle_key(hot_h.edge_mid[p], hot_h.lane[p], hot_h.posInLaneM[p]),
+          p);
+    }
+  }
+#ifdef _OPENMP
+  __gnu_parallel::sort(vehicleSort_h.begin(), vehicleSort_h.end());
+#else
+  std::sort(vehicleSort_h.begin(), vehicleSort_h.end());
+#endif
+  numVehicles = vehicleSort_h.size();
+  vehicleKeys_h.resize(numVehicles);
+  vehicleSpeeds_h.resize(numVehicles);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < (int)numVehicles; ++i) {
+    const uint p = vehicleSort_h[i].second;
+    vehicleKeys_h[i] = vehicleSort_h[i].first;
+    vehicleSpeeds_h[i] = (uchar)(hot_h.v[p] * 3);
+    vehicleRank_h[p] = i;
+  }
+}
+
+//! Simulate one intersection
+void intersectionOneSimulation(uint i, LC::EdgeData *edgesData,
+                               LC::IntersectionData *intersections,
+                               LC::MovementData *movements, int *queuePool,
+                               AgentsHot hot, LC::Agent *agents,
+                               uchar *laneMap, uint *routes) {
+  check_queues(i, edgesData, intersections, movements, queuePool, hot, agents,
+               laneMap, routes);
+
+  // add a stop sign for full queues
+  auto &intersection = intersections[i];
+  for (unsigned j = 0; j < intersection.num_queue; j++) {
+    auto &q1 = movements[intersection.movement_offset + j].queue;
+    if (q1.size > 0) {
+      auto agent = load_hot(hot, queue_at(q1, queuePool, 0));
+      place_stop(agent, edgesData, laneMap, mapToWriteShift);
+    }
+  }
+}
+} // namespace
+
+//! Bind the host buffers (no copy is needed on the CPU)
+void init_cpu(bool fistInitialization, // bind buffers
+              std::vector<LC::Agent> &agents, std::vector<uint> &routes,
+              std::vector<LC::EdgeData> &edgesData,
+              std::vector<uchar> &laneMap,
+              std::vector<unsigned long long> &laneOccupancy,
+              std::vector<uint> &cellOffsets,
+              std::vector<LC::IntersectionData> &intersections,
+              std::vector<LC::MovementData> &movements,
+              std::vector<int> &queuePool) {
+  trafficPersonVec_h = agents.data();
+  hotBuffer_h.scatter(agents);
+  hot_h = hotBuffer_h.view();
+  routes_h = routes.data();
+  edgesData_h = edgesData.data();
+  laneMap_h = laneMap.data();
+  laneOccupancy_h = laneOccupancy.data();
+  cellOffsets_h = cellOffsets.data();
+  intersections_h = intersections.data();
+  movements_h = movements.data();
+  queuePool_h = queuePool.data();
+  halfLaneMap = laneMap.size() / 2;
+  numEdges = edgesData.size();
+  if (fistInitialization) {
+    readFirstMapC = true;
+  }
+  activeList_h.clear();
+  activeList_h.reserve(agents.size());
+  vehicleSort_h.reserve(agents.size());
+  vehicleRank_h.assign(agents.size(), NO_VEHICLE);
+  numVehicles = 0;
+  nextDeparture = 0;
+  numSteps = 0;
+#ifdef _OPENMP
+  printf("CPU simulation with up to %d threads\n", omp_get_max_threads());
+#endif
+}
+
+void finish_cpu(void) {
+  trafficPersonVec_h = nullptr;
+  hotBuffer_h = LC::AgentsHotBuffer();
+  routes_h = nullptr;
+  edgesData_h = nullptr;
+  laneMap_h = nullptr;
+  laneOccupancy_h = nullptr;
+  cellOffsets_h = nullptr;
+  intersections_h = nullptr;
+  movements_h = nullptr;
+  queuePool_h = nullptr;
+  activeList_h = std::vector<uint>();
+  vehicleSort_h = std::vector<std::pair<unsigned long long, uint>>();
+  vehicleKeys_h = std::vector<unsigned long long>();
+  vehicleSpeeds_h = std::vector<uchar>();
+  vehicleRank_h = std::vector<uint>();
+  numVehicles = 0;
+  rerouteStage_h = std::vector<LC::RerouteCandidate>();
+  edgeTravel_h = std::vector<LC::EdgeTravel>();
+  numEdges = 0;
+}
+
+void cpu_get_data(std::vector<LC::Agent> &trafficPersonVec,
+                  std::vector<LC::EdgeData> & /*edgesData*/,
+                  std::vector<LC::IntersectionData> & /*intersections*/) {
+  // edges and intersections are updated in place; only the hot agent
+  // fields have to be written back into the agent records
+  hotBuffer_h.gather(trafficPersonVec);
+}
+
+void cpu_stage_reroute(void) {
+  edgeTravel_h.resize(numEdges);
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < (int)numEdges; ++i) {
+    edgeTravel_h[i].downstream_veh_count = edgesData_h[i].downstream_veh_count;
+    edgeTravel_h[i].period_cum_travel_steps =
+        edgesData_h[i].period_cum_travel_steps;
+    edgeTravel_h[i].wait_steps = 0;
+  }
+  rerouteStage_h.clear();
+  for (const auto p : activeList_h) {
+    stage_reroute(p, hot_h, trafficPersonVec_h, edgeTravel_h.data(),
+                  rerouteStage_h);
+  }
+}
+
+void cpu_get_reroute_data(std::vector<LC::RerouteCandidate> &candidates,
+                          std::vector<LC::EdgeTravel> &edges) {
+  candidates.swap(rerouteStage_h);
+  edges.swap(edgeTravel_h);
+}
+
+void cpu_check_route_updates(const std::vector<LC::RouteUpdate> &updates,
+                             std::vector<uchar> &valid) {
+  valid.resize(updates.size());
+  for (std::size_t i = 0; i < updates.size(); ++i) {
+    const auto &update = updates[i];
+    valid[i] = route_update_valid(update, trafficPersonVec_h[update.agent],
+                                  hot_h.active[update.agent],
+                                  hot_h.in_queue[update.agent]);
+  }
+}
+
+unsigned cpu_update_routes(std::vector<uint> &routes,
+                           const std::vector<LC::RouteUpdate> &updates) {
+  routes_h = routes.data();
+  unsigned applied = 0;
+  for (const auto &update : updates) {
+    auto &info = trafficPersonVec_h[update.agent];
+    if (route_update_valid(update, info, hot_h.active[update.agent],
+                           hot_h.in_queue[update.agent])) {
+      info.route_offset = update.route_offset;
+      info.route_size = update.route_size;
+      ++applied;
+    }
+  }
+  return applied;
+}
+
+void cpu_set_routes(std::vector<uint> &routes) { routes_h = routes.data(); }
+
+bool cpu_lane_gaps(uint p, uint laneToCheck, float &gap_a, float &gap_b,
+                   uchar &v_a, uchar &v_b) {
+  if (p >= vehicleRank_h.size() || vehicleRank_h[p] == NO_VEHICLE) {
+    return false;
+  }
+  // the sorted order holds the place of p at the start of the step
+  const auto key = vehicleKeys_h[vehicleRank_h[p]];
+  auto agent = load_hot(hot_h, p);
+  agent.edge_mid = key >> 32;
+  agent.posInLaneM = key & 0xFFFF;
+  agent.edge_length = edgesData_h[agent.edge_mid].length;
+  calculateGaps(laneMap_h, agent, laneToCheck, gap_a, gap_b, v_a, v_b);
+  return true;
+}
+
+void cpu_simulate(float currentTime, uint /*numPeople*/,
+                  uint numIntersections, float deltaTime, int numThreads) {
+#ifdef _OPENMP
+  if (numThreads > 0) {
+    omp_set_num_threads(numThreads);
+  }
+#endif
+
+  ////////////////////////////////////////////////////////////
+  // 1. CHANGE MAP: set map to use and clean the other
+  if (readFirstMapC) {
+    mapToReadShift = 0;
+    mapToWriteShift = halfLaneMap;
+  } else {
+    mapToReadShift = halfLaneMap;
+    mapToWriteShift = 0;
+  }
+  readFirstMapC = !readFirstMapC; // next iteration invert use
+  // a new step stamp empties the write half
+  if (++mapEpoch == 0) { // stamps wrapped around: clean both halves
+    memset(laneOccupancy_h, 0,
+           2 * (halfLaneMap / 32) * sizeof(unsigned long long));
+  }
+
+  ////////////////////////////////////////////////////////////
+  // 2. ACTIVATE: append the agents departing by now to the active list
+  const auto &departures = hotBuffer_h.departures();
+  while (nextDeparture < departures.size() &&
+         hot_h.time_departure[departures[nextDeparture]] <= currentTime) {
+    activeList_h.emplace_back(departures[nextDeparture++]);
+  }
+  if (numSteps++ % ACTIVE_COMPACT_STEPS == 0) { // drop finished agents
+    activeList_h.erase(std::remove_if(activeList_h.begin(), activeList_h.end(),
+                                      [](uint p) {
+                                        return hot_h.active[p] == 2;
+                                      }),
+                       activeList_h.end());
+  }
+
+  ////////////////////////////////////////////////////////////
+  // 3. SORT: vehicles on the edges by (edge, lane, position)
+  sort_vehicles();
+
+  intersectionBench.startMeasuring();
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < (int)numIntersections; ++i) {
+    intersectionOneSimulation(i, edgesData_h, intersections_h, movements_h,
+                              queuePool_h, hot_h, trafficPersonVec_h,
+                              laneMap_h, routes_h);
+  }
+  intersectionBench.stopMeasuring();
+
+  peopleBench.startMeasuring();
+  // Simulate the active people.
+  const int numActive = activeList_h.size();
+#pragma omp parallel for schedule(static)
+  for (int i = 0; i < numActive; ++i) {
+    trafficSimulation(activeList_h[i], currentTime, hot_h, trafficPersonVec_h,
+                      edgesData_h, laneMap_h, intersections_h, movements_h,
+                      queuePool_h, routes_h, deltaTime);
+  }
+  peopleBench.stopMeasuring();
+}
@@ -0,0 +1,62 @@
+#ifndef LC_CPU_SIMULATOR_H
+#define LC_CPU_SIMULATOR_H
+#include <vector>
+#include <iostream>
+
+#include "agent.h"
+#include "edge_data.h"
+#include "config.h"
+#include "src/benchmarker.h"
+
+// Host (OpenMP) counterpart of cuda_simulator.h. Edges, intersections and the
+// lanemap are updated in place; the per-step agent fields live in an
+// LC::AgentsHotBuffer and cpu_get_data gathers them back into the agents.
+
+extern void init_cpu (
+        bool fistInitialization, // bind buffers
+        std::vector<LC::Agent> &agents, std::vector<uint> &routes,
+        std::vector<LC::EdgeData> &edgesData, std::vector<uchar> &laneMap,
+        std::vector<unsigned long long> &laneOccupancy,
+        std::vector<uint> &cellOffsets,
+        std::vector<LC::IntersectionData> &intersections,
+        std::vector<LC::MovementData> &movements, std::vector<int> &queuePool);
+
+extern void cpu_get_data (std::vector<LC::Agent> &trafficPersonVec,
+                          std::vector<LC::EdgeData> &edgesData,
+                          std::vector<LC::IntersectionData> &intersections);
+
+// En-route rerouting data: cpu_stage_reroute lists the agents that can be
+// rerouted and the travel counters of every edge, cpu_get_reroute_data hands
+// the lists over (same protocol as the CUDA backend)
+extern void cpu_stage_reroute (void);
+extern void cpu_get_reroute_data (
+        std::vector<LC::RerouteCandidate> &candidates,
+        std::vector<LC::EdgeTravel> &edges);
+
+// Check which new routes still apply between two steps: valid[i] is 1 if the
+// agent of updates[i] did not move on since it was rerouted
+extern void cpu_check_route_updates (
+        const std::vector<LC::RouteUpdate> &updates, std::vector<uchar> &valid);
+
+// Switch agents to new routes between two steps. routes may have grown (it is
+// bound again); updates of agents that moved on are skipped. Returns the
+// number of agents switched
+extern unsigned cpu_update_routes (std::vector<uint> &routes,
+                                   const std::vector<LC::RouteUpdate> &updates);
+
+// Bind routes again after it was rebuilt, the route offsets of the agents
+// were rewritten in place
+extern void cpu_set_routes (std::vector<uint> &routes);
+
+// Gaps (m) to the vehicles ahead of and behind agent p on lane laneToCheck of
+// its edge and their speeds, looked up as by the lane changes of the last
+// step from the meter p started the step at. Returns false if p was not on an
+// edge then (used by the tests)
+extern bool cpu_lane_gaps (uint p, uint laneToCheck, float &gap_a,
+                           float &gap_b, uchar &v_a, uchar &v_b);
+
+extern void finish_cpu (void);                      // release buffers
+extern void cpu_simulate(float currentTime, uint numPeople, uint numIntersections,
+                         float deltaTime, int numThreads);
+
+#endif // LC_CPU_SIMULATOR_H
@@ -6,10 +6,13 @@
 #include "device_launch_parameters.h"
 #include <stdio.h>
 
+#include "agent_soa.h"
 #include "cuda_simulator.h"
 
 #include <iostream>
 #include <random>
+#include <thrust/execution_policy.h>
+#include <thrust/sort.h>
 
 #ifndef ushort
 #define ushort uint16_t
@@ -30,16 +33,83 @@ using namespace LC;
 ////////////////////////////////
 // VARIABLES
 LC::Agent *trafficPersonVec_d;
+AgentsHot hot_d;
+LC::AgentsHotBuffer hotBuffer_h;
 uint *indexPathVec_d;
+// entries of the route array on the device and its allocated size
+size_t numRoutes;
+size_t routesCapacity;
 LC::EdgeData *edgesData_d;
 LC::IntersectionData *intersections_d;
+LC::MovementData *movements_d;
+int *queuePool_d;
+
+// Departure calendar (agent ids sorted by departure time) and the list of
+// agents departed and not yet removed as finished. The people kernel only
+// runs over the active list
+uint *departures_d;
+std::vector<float> departureTimes_h;
+uint nextDeparture;
+uint *activeList_d;
+uint *activeListTmp_d;
+uint *activeCount_d;
+uint numActive;
+uint numSteps;
 uchar *laneMap_d;
 
+// Vehicles on the edges at the start of the step (the state the read half of
+// the lanemap holds) sorted by vehicle_key, with their agent and speed in
+// 3*m/s as in the lanemap, and the place of every agent in the order
+// (NO_VEHICLE if it was not on an edge)
+#define NO_VEHICLE 0xFFFFFFFF
+__managed__ unsigned long long *vehicleKeys_d;
+uint *vehicleOrder_d;
+__managed__ uchar *vehicleSpeeds_d;
+__managed__ uint *vehicleRank_d;
+uint *vehicleCount_d;
+__managed__ uint numVehicles;
+
+// Delta transfer: agents stepped and edges whose counters moved since the last
+// transfer are compacted into the stage buffers and copied to pinned memory
+uint numAgents;
+uint numEdges;
+uchar *agentDirty_d;
+LC::Agent *agentStage_d;
+uint *agentStageIdx_d;
+LC::EdgeData *edgesSynced_d;
+LC::EdgeData *edgeStage_d;
+uint *edgeStageIdx_d;
+uint *stageCount_d; // [0] agents, [1] edges
+LC::Agent *agentStage_h;
+uint *agentStageIdx_h;
+LC::EdgeData *edgeStage_h;
+uint *edgeStageIdx_h;
+uint *stageCount_h;
+cudaStream_t copyStream;
+cudaEvent_t stagedEvent;
+// En-route rerouting data: the agents that can be rerouted and the travel
+// counters of every edge, copied to pinned memory on copyStream as well
+LC::RerouteCandidate *rerouteStage_d;
+LC::EdgeTravel *edgeTravel_d;
+uint *rerouteCount_d;
+LC::RerouteCandidate *rerouteStage_h;
+LC::EdgeTravel *edgeTravel_h;
+uint *rerouteCount_h;
+
 __managed__ bool readFirstMapC = true;
 __managed__ uint mapToReadShift;
 __managed__ uint mapToWriteShift;
 __managed__ int mutex = 0;
 __managed__ uint halfLaneMap;
+// One bit per lanemap byte (same layout and halves): set where a vehicle wrote
+// its speed. The scans for vehicles skip free road a word (32 m) at a time.
+// Every word keeps the step that wrote it in its upper 32 bits and words of
+// older steps read as empty, so the halves are never cleared
+__managed__ unsigned long long *laneOccupancy_d;
+// Step writing the lanemap, the read half was written at mapEpoch - 1
+__managed__ uint mapEpoch = 0;
+// First lanemap cell of every edge (Lanemap::cell_offsets)
+__managed__ uint *cellOffsets_d;
 
 #define gpuErrchk(ans)                                                         \
   { gpuAssert((ans), __FILE__, __LINE__); }
@@ -70,12 +140,49 @@ inline void printMemoryUsage() {
          total_db / 1024.0 / 1024.0);
 }
 
+//! Copy every hot agent array between host and device
+void copy_hot(AgentsHot &dst, const AgentsHot &src, size_t n,
+              cudaMemcpyKind kind) {
+  gpuErrchk(cudaMemcpy(dst.active, src.active, n * sizeof(ushort), kind));
+  gpuErrchk(cudaMemcpy(dst.in_queue, src.in_queue, n * sizeof(uchar), kind));
+  gpuErrchk(cudaMemcpy(dst.time_departure, src.time_departure,
+                       n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.edge_mid, src.edge_mid, n * sizeof(uint), kind));
+  gpuErrchk(cudaMemcpy(dst.lane, src.lane, n * sizeof(ushort), kind));
+  gpuErrchk(
+      cudaMemcpy(dst.posInLaneM, src.posInLaneM, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.v, src.v, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.s, src.s, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.delta_v, src.delta_v, n * sizeof(float), kind));
+  gpuErrchk(
+      cudaMemcpy(dst.max_speed, src.max_speed, n * sizeof(float), kind));
+  gpuErrchk(
+      cudaMemcpy(dst.edge_length, src.edge_length, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.a, src.a, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.b, src.b, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.T, src.T, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.s_0, src.s_0, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.dv_dt, src.dv_dt, n * sizeof(float), kind));
+  gpuErrchk(
+      cudaMemcpy(dst.cum_length, src.cum_length, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.cum_v, src.cum_v, n * sizeof(float), kind));
+  gpuErrchk(cudaMemcpy(dst.num_steps, src.num_steps, n * sizeof(uint), kind));
+  gpuErrchk(cudaMemcpy(dst.num_steps_in_queue, src.num_steps_in_queue,
+                       n * sizeof(uint), kind));
+  gpuErrchk(cudaMemcpy(dst.slow_down_steps, src.slow_down_steps,
+                       n * sizeof(uint), kind));
+}
+
 //! Allocate appropirate amount of memory on the cuda device
 void init_cuda(bool fistInitialization, // create buffers
-               std::vector<LC::Agent> &agents,
+               std::vector<LC::Agent> &agents, std::vector<uint> &routes,
                std::vector<LC::EdgeData> &edgesData,
                std::vector<uchar> &laneMap,
-               std::vector<LC::IntersectionData> &intersections) {
+               std::vector<unsigned long long> &laneOccupancy,
+               std::vector<uint> &cellOffsets,
+               std::vector<LC::IntersectionData> &intersections,
+               std::vector<LC::MovementData> &movements,
+               std::vector<int> &queuePool) {
 
   { // agents
     size_t size = agents.size() * sizeof(LC::Agent);
@@ -86,6 +193,82 @@ void init_cuda(bool fistInitialization, // create buffers
                          cudaMemcpyHostToDevice));
   }
 
+  { // hot agent fields (one device array per field)
+    hotBuffer_h.scatter(agents);
+    AgentsHot hot_h = hotBuffer_h.view();
+    size_t n = agents.size();
+    if (fistInitialization) {
+      gpuErrchk(cudaMalloc((void **)&hot_d.active, n * sizeof(ushort)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.in_queue, n * sizeof(uchar)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.time_departure, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.edge_mid, n * sizeof(uint)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.lane, n * sizeof(ushort)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.posInLaneM, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.v, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.s, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.delta_v, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.max_speed, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.edge_length, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.a, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.b, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.T, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.s_0, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.dv_dt, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.cum_length, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.cum_v, n * sizeof(float)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.num_steps, n * sizeof(uint)));
+      gpuErrchk(
+          cudaMalloc((void **)&hot_d.num_steps_in_queue, n * sizeof(uint)));
+      gpuErrchk(cudaMalloc((void **)&hot_d.slow_down_steps, n * sizeof(uint)));
+    }
+    copy_hot(hot_d, hot_h, n, cudaMemcpyHostToDevice);
+  }
+
+  { // departure calendar and active list
+    const auto &departures = hotBuffer_h.departures();
+    size_t sizeA = departures.size() * sizeof(uint);
+    if (fistInitialization) {
+      gpuErrchk(cudaMalloc((void **)&departures_d, sizeA));
+      gpuErrchk(cudaMalloc((void **)&activeList_d, sizeA));
+      gpuErrchk(cudaMalloc((void **)&activeListTmp_d, sizeA));
+      gpuErrchk(cudaMalloc((void **)&activeCount_d, sizeof(uint)));
+    }
+    gpuErrchk(cudaMemcpy(departures_d, departures.data(), sizeA,
+                         cudaMemcpyHostToDevice));
+    departureTimes_h.resize(departures.size());
+    for (size_t i = 0; i < departures.size(); ++i) {
+      departureTimes_h[i] = agents[departures[i]].time_departure;
+    }
+    nextDeparture = 0;
+    numActive = 0;
+    numSteps = 0;
+  }
+
+  { // sorted vehicle order
+    size_t n = agents.size();
+    if (fistInitialization) {
+      gpuErrchk(cudaMalloc((void **)&vehicleKeys_d,
+                           n * sizeof(unsigned long long)));
+      gpuErrchk(cudaMalloc((void **)&vehicleOrder_d, n * sizeof(uint)));
+      gpuErrchk(cudaMalloc((void **)&vehicleSpeeds_d, n * sizeof(uchar)));
+      gpuErrchk(cudaMalloc((void **)&vehicleRank_d, n * sizeof(uint)));
+      gpuErrchk(cudaMalloc((void **)&vehicleCount_d, sizeof(uint)));
+    }
+    gpuErrchk(cudaMemset(vehicleRank_d, 0xFF, n * sizeof(uint)));
+    numVehicles = 0;
+  }
+
+  { // routes (flat array indexed by Agent::route_offset)
+    size_t sizeR = routes.size() * sizeof(uint);
+    if (fistInitialization)
+      gpuErrchk(cudaMalloc((void **)&indexPathVec_d,
+                           sizeR)); // Allocate array on device
+    gpuErrchk(cudaMemcpy(indexPathVec_d, routes.data(), sizeR,
+                         cudaMemcpyHostToDevice));
+    numRoutes = routes.size();
+    routesCapacity = routes.size();
+  }
+
   { // edgeData
     size_t sizeD = edgesData.size() * sizeof(LC::EdgeData);
     if (fistInitialization)
@@ -102,6 +285,16 @@ void init_cuda(bool fistInitialization, // create buffers
     gpuErrchk(
         cudaMemcpy(laneMap_d, laneMap.data(), sizeL, cudaMemcpyHostToDevice));
     halfLaneMap = laneMap.size() / 2;
+    size_t sizeO = laneOccupancy.size() * sizeof(unsigned long long);
+    if (fistInitialization)
+      gpuErrchk(cudaMalloc((void **)&laneOccupancy_d, sizeO));
+    gpuErrchk(cudaMemcpy(laneOccupancy_d, laneOccupancy.data(), sizeO,
+                         cudaMemcpyHostToDevice));
+    size_t sizeC = cellOffsets.size() * sizeof(uint);
+    if (fistInitialization)
+      gpuErrchk(cudaMalloc((void **)&cellOffsets_d, sizeC));
+    gpuErrchk(cudaMemcpy(cellOffsets_d, cellOffsets.data(), sizeC,
+                         cudaMemcpyHostToDevice));
   }
   { // intersections
     size_t sizeI = intersections.size() * sizeof(LC::IntersectionData);
@@ -111,6 +304,62 @@ void init_cuda(bool fistInitialization, // create buffers
     gpuErrchk(cudaMemcpy(intersections_d, intersections.data(), sizeI,
                          cudaMemcpyHostToDevice));
   }
+  { // movements and the queue pool
+    size_t sizeM = movements.size() * sizeof(LC::MovementData);
+    size_t sizeQ = queuePool.size() * sizeof(int);
+    if (fistInitialization) {
+      gpuErrchk(cudaMalloc((void **)&movements_d, sizeM));
+      gpuErrchk(cudaMalloc((void **)&queuePool_d, sizeQ));
+    }
+    gpuErrchk(cudaMemcpy(movements_d, movements.data(), sizeM,
+                         cudaMemcpyHostToDevice));
+    gpuErrchk(cudaMemcpy(queuePool_d, queuePool.data(), sizeQ,
+                         cudaMemcpyHostToDevice));
+  }
+  { // delta transfer buffers
+    numAgents = agents.size();
+    numEdges = edgesData.size();
+    if (fistInitialization) {
+      gpuErrchk(cudaMalloc((void **)&agentDirty_d, numAgents * sizeof(uchar)));
+      gpuErrchk(cudaMalloc((void **)&agentStage_d,
+                           numAgents * sizeof(LC::Agent)));
+      gpuErrchk(
+          cudaMalloc((void **)&agentStageIdx_d, numAgents * sizeof(uint)));
+      gpuErrchk(cudaMalloc((void **)&edgesSynced_d,
+                           numEdges * sizeof(LC::EdgeData)));
+      gpuErrchk(cudaMalloc((void **)&edgeStage_d,
+                           numEdges * sizeof(LC::EdgeData)));
+      gpuErrchk(cudaMalloc((void **)&edgeStageIdx_d, numEdges * sizeof(uint)));
+      gpuErrchk(cudaMalloc((void **)&stageCount_d, 2 * sizeof(uint)));
+      // pinned host memory so the copies can run asynchronously
+      gpuErrchk(cudaMallocHost((void **)&agentStage_h,
+                               numAgents * sizeof(LC::Agent)));
+      gpuErrchk(
+          cudaMallocHost((void **)&agentStageIdx_h, numAgents * sizeof(uint)));
+      gpuErrchk(cudaMallocHost((void **)&edgeStage_h,
+                               numEdges * sizeof(LC::EdgeData)));
+      gpuErrchk(
+          cudaMallocHost((void **)&edgeStageIdx_h, numEdges * sizeof(uint)));
+      gpuErrchk(cudaMallocHost((void **)&stageCount_h, 2 * sizeof(uint)));
+      gpuErrchk(cudaMalloc((void **)&rerouteStage_d,
+                           numAgents * sizeof(LC::RerouteCandidate)));
+      gpuErrchk(cudaMalloc((void **)&edgeTravel_d,
+                           numEdges * sizeof(LC::EdgeTravel)));
+      gpuErrchk(cudaMalloc((void **)&rerouteCount_d, sizeof(uint)));
+      gpuErrchk(cudaMallocHost((void **)&rerouteStage_h,
+                               numAgents * sizeof(LC::RerouteCandidate)));
+      gpuErrchk(cudaMallocHost((void **)&edgeTravel_h,
+                               numEdges * sizeof(LC::EdgeTravel)));
+      gpuErrchk(cudaMallocHost((void **)&rerouteCount_h, sizeof(uint)));
+      gpuErrchk(cudaStreamCreateWithFlags(&copyStream, cudaStreamNonBlocking));
+      gpuErrchk(
+          cudaEventCreateWithFlags(&stagedEvent, cudaEventDisableTiming));
+    }
+    gpuErrchk(cudaMemset(agentDirty_d, 0, numAgents * sizeof(uchar)));
+    gpuErrchk(cudaMemcpy(edgesSynced_d, edgesData.data(),
+                         numEdges * sizeof(LC::EdgeData),
+                         cudaMemcpyHostToDevice));
+  }
   printMemoryUsage();
 } //
 
@@ -119,10 +368,64 @@ void finish_cuda(void) {
   //////////////////////////////
   // FINISH
   cudaFree(trafficPersonVec_d);
+  cudaFree(hot_d.active);
+  cudaFree(hot_d.in_queue);
+  cudaFree(hot_d.time_departure);
+  cudaFree(hot_d.edge_mid);
+  cudaFree(hot_d.lane);
+  cudaFree(hot_d.posInLaneM);
+  cudaFree(hot_d.v);
+  cudaFree(hot_d.s);
+  cudaFree(hot_d.delta_v);
+  cudaFree(hot_d.max_speed);
+  cudaFree(hot_d.edge_length);
+  cudaFree(hot_d.a);
+  cudaFree(hot_d.b);
+  cudaFree(hot_d.T);
+  cudaFree(hot_d.s_0);
+  cudaFree(hot_d.dv_dt);
+  cudaFree(hot_d.cum_length);
+  cudaFree(hot_d.cum_v);
+  cudaFree(hot_d.num_steps);
+  cudaFree(hot_d.num_steps_in_queue);
+  cudaFree(hot_d.slow_down_steps);
   cudaFree(indexPathVec_d);
   cudaFree(edgesData_d);
   cudaFree(laneMap_d);
+  cudaFree(laneOccupancy_d);
+  cudaFree(cellOffsets_d);
   cudaFree(intersections_d);
+  cudaFree(movements_d);
+  cudaFree(queuePool_d);
+  cudaFree(departures_d);
+  cudaFree(activeList_d);
+  cudaFree(activeListTmp_d);
+  cudaFree(activeCount_d);
+  cudaFree(vehicleKeys_d);
+  cudaFree(vehicleOrder_d);
+  cudaFree(vehicleSpeeds_d);
+  cudaFree(vehicleRank_d);
+  cudaFree(vehicleCount_d);
+  cudaFree(agentDirty_d);
+  cudaFree(agentStage_d);
+  cudaFree(agentStageIdx_d);
+  cudaFree(edgesSynced_d);
+  cudaFree(edgeStage_d);
+  cudaFree(edgeStageIdx_d);
+  cudaFree(stageCount_d);
+  cudaFreeHost(agentStage_h);
+  cudaFreeHost(agentStageIdx_h);
+  cudaFreeHost(edgeStage_h);
+  cudaFreeHost(edgeStageIdx_h);
+  cudaFreeHost(stageCount_h);
+  cudaFree(rerouteStage_d);
+  cudaFree(edgeTravel_d);
+  cudaFree(rerouteCount_d);
+  cudaFreeHost(rerouteStage_h);
+  cudaFreeHost(edgeTravel_h);
+  cudaFreeHost(rerouteCount_h);
+  cudaStreamDestroy(copyStream);
+  cudaEventDestroy(stagedEvent);
 } //
 
 void cuda_get_data(std::vector<LC::Agent> &trafficPersonVec,
@@ -136,167 +439,344 @@ void cuda_get_data(std::vector<LC::Agent> &trafficPersonVec,
 
   cudaMemcpy(trafficPersonVec.data(), trafficPersonVec_d, size,
              cudaMemcpyDeviceToHost); // cudaMemcpyHostToDevice
+  AgentsHot hot_h = hotBuffer_h.view();
+  copy_hot(hot_h, hot_d, trafficPersonVec.size(), cudaMemcpyDeviceToHost);
+  hotBuffer_h.gather(trafficPersonVec);
   cudaMemcpy(edgesData.data(), edgesData_d, size_edges,
              cudaMemcpyDeviceToHost); // cudaMemcpyHostToDevice
   cudaMemcpy(intersections.data(), intersections_d, size_intersections,
              cudaMemcpyDeviceToHost); // cudaMemcpyHostToDevice
 }
 
+//! Load the hot fields of agent p
+__device__ AgentHot load_hot(const AgentsHot &hot, int p) {
+  AgentHot agent;
+  agent.active = hot.active[p];
+  agent.in_queue = hot.in_queue[p];
+  agent.time_departure = hot.time_departure[p];
+  agent.edge_mid = hot.edge_mid[p];
+  agent.lane = hot.lane[p];
+  agent.posInLaneM = hot.posInLaneM[p];
+  agent.v = hot.v[p];
+  agent.s = hot.s[p];
+  agent.delta_v = hot.delta_v[p];
+  agent.max_speed = hot.max_speed[p];
+  agent.edge_length = hot.edge_length[p];
+  agent.a = hot.a[p];
+  agent.b = hot.b[p];
+  agent.T = hot.T[p];
+  agent.s_0 = hot.s_0[p];
+  agent.dv_dt = hot.dv_dt[p];
+  agent.cum_length = hot.cum_length[p];
+  agent.cum_v = hot.cum_v[p];
+  agent.num_steps = hot.num_steps[p];
+  agent.num_steps_in_queue = hot.num_steps_in_queue[p];
+  agent.slow_down_steps = hot.slow_down_steps[p];
+  return agent;
+}
+
+//! Store the hot fields of agent p (time_departure and the IDM parameters are
+//! read only)
+__device__ void store_hot(AgentsHot &hot, int p, const AgentHot &agent) {
+  hot.active[p] = agent.active;
+  hot.in_queue[p] = agent.in_queue;
+  hot.edge_mid[p] = agent.edge_mid;
+  hot.lane[p] = agent.lane;
+  hot.posInLaneM[p] = agent.posInLaneM;
+  hot.v[p] = agent.v;
+  hot.s[p] = agent.s;
+  hot.delta_v[p] = agent.delta_v;
+  hot.max_speed[p] = agent.max_speed;
+  hot.edge_length[p] = agent.edge_length;
+  hot.dv_dt[p] = agent.dv_dt;
+  hot.cum_length[p] = agent.cum_length;
+  hot.cum_v[p] = agent.cum_v;
+  hot.num_steps[p] = agent.num_steps;
+  hot.num_steps_in_queue[p] = agent.num_steps_in_queue;
+  hot.slow_down_steps[p] = agent.slow_down_steps;
+}
+
 __device__ uint lanemap_pos(const uint currentEdge, const uint edge_length,
                             const uint laneNum, const uint pos_in_lane) {
   uint kMaxMapWidthM = 1024;
-  uint num_cell = pos_in_lane / kMaxMapWidthM;
   int tot_num_cell = edge_length / kMaxMapWidthM;
   if (edge_length % kMaxMapWidthM) {
     tot_num_cell += 1;
   }
-  return kMaxMapWidthM * currentEdge + kMaxMapWidthM * laneNum * tot_num_cell +
-         kMaxMapWidthM * num_cell + pos_in_lane % kMaxMapWidthM;
+  return kMaxMapWidthM * (cellOffsets_d[currentEdge] + laneNum * tot_num_cell) +
+         pos_in_lane;
+}
+
+//! Mark a lanemap byte as written in this step
+__device__ void set_occupied(uint pos) {
+  unsigned long long *word = &laneOccupancy_d[pos / 32];
+  const unsigned long long bit = 1ull << (pos % 32);
+  // the first writer of the step replaces the bits of an older step
+  unsigned long long old = *word;
+  while ((old >> 32) != mapEpoch) {
+    const unsigned long long stamped =
+        ((unsigned long long)mapEpoch << 32) | bit;
+    const unsigned long long seen = atomicCAS(word, old, stamped);
+    if (seen == old) {
+      return;
+    }
+    old = seen;
+  }
+  atomicOr(word, bit);
 }
 
-__device__ void calculateGaps(uchar *laneMap, LC::Agent &agent,
+//! Occupancy bits of a word of the read half (none if written before the
+//! last step)
+__device__ uint occupied_bits(uint word) {
+  const unsigned long long bits = laneOccupancy_d[word];
+  return (bits >> 32) == mapEpoch - 1 ? (uint)bits : 0;
+}
+
+//! First occupied lanemap byte in [from, to), to if there is none
+__device__ uint next_occupied(uint from, uint to) {
+  while (from < to) {
+    uint word = occupied_bits(from / 32) >> (from % 32);
+    if (word != 0) {
+      return min(from + __ffs(word) - 1, to);
+    }
+    from += 32 - from % 32;
+  }
+  return to;
+}
+
+//! Last occupied lanemap byte in [from, to), to if there is none
+__device__ uint last_occupied(uint from, uint to) {
+  uint end = to;
+  while (end > from) {
+    uint last = end - 1;
+    uint word = occupied_bits(last / 32) << (31 - last % 32);
+    if (word != 0) {
+      uint pos = last - __clz(word);
+      return pos >= from ? pos : to;
+    }
+    end = last - last % 32;
+  }
+  return to;
+}
+
+//! Sort key of a vehicle at meter pos of a lane. The keys of a lane are
+//! [vehicle_key(edge, lane, 0), vehicle_key(edge, lane, 0) + 0x10000)
+//! (the lanemap rejects edges of 65535 m or more)
+__device__ unsigned long long vehicle_key(uint edge_mid, uint lane,
+                                          uint pos) {
+  return ((unsigned long long)edge_mid << 32) | ((lane & 0xFFFF) << 16) |
+         (pos & 0xFFFF);
+}
+
+//! First vehicle of the sorted order with a key of at least key
+__device__ uint lower_vehicle(unsigned long long key) {
+  uint first = 0;
+  uint count = numVehicles;
+  while (count > 0) {
+    uint step = count / 2;
+    if (vehicleKeys_d[first + step] < key) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return first;
+}
+
+//! First meter of the stop line an intersection places at the end of a full
+//! edge (place_stop). The stop line is only in the lanemap
+__device__ uint stop_line(const AgentHot &agent) {
+  uint end = agent.edge_length;
+  return end > SOCIAL_DIST - 1 ? end - (SOCIAL_DIST - 1) : 0;
+}
+
+__device__ void calculateGaps(uchar *laneMap, AgentHot &agent,
                               uint laneToCheck, float &gap_a, float &gap_b,
                               uchar &v_a, uchar &v_b) {
+  const auto lane = vehicle_key(agent.edge_mid, laneToCheck, 0);
+  // the meters of a lane are contiguous in the lanemap
+  uint map_lane = mapToReadShift +
+                  lanemap_pos(agent.edge_mid, agent.edge_length, laneToCheck, 0);
 
   // CHECK FORWARD
-  for (ushort b = agent.posInLaneM - 1; b < agent.edge_length;
-       b++) { // NOTE -1 to make sure there is none in at the same level
-    auto posToSample =
-        lanemap_pos(agent.edge_mid, agent.edge_length, laneToCheck, b);
-    if (laneMap[mapToReadShift + posToSample] != 0xFF) {
-      gap_a = b - agent.posInLaneM; // m
-      v_a = laneMap[mapToReadShift + posToSample] / 3;
-      break;
-    }
+  ushort first = agent.posInLaneM - 1; // NOTE -1 to make sure there is none in
+                                       // at the same level
+  uint next = lower_vehicle(lane + first);
+  uint pos = ceilf(agent.edge_length);
+  if (next < numVehicles && vehicleKeys_d[next] < lane + 0x10000) {
+    pos = vehicleKeys_d[next] & 0xFFFF;
+    v_a = vehicleSpeeds_d[next] / 3;
+  }
+  uint stop = next_occupied(map_lane + max((uint)first, stop_line(agent)),
+                            map_lane + pos);
+  if (stop < map_lane + pos) {
+    pos = stop - map_lane;
+    v_a = laneMap[stop] / 3;
+  }
+  if (pos < agent.edge_length) {
+    gap_a = pos - agent.posInLaneM; // m
   }
   // CHECK BACKWARD
-  for (ushort b = agent.posInLaneM + 1; b > 0;
-       b--) { // NOTE -1 to make sure there is none in at the same level
-    auto posToSample =
-        lanemap_pos(agent.edge_mid, agent.edge_length, laneToCheck, b);
-    if (laneMap[mapToReadShift + posToSample] != 0xFF) {
-      gap_b = agent.posInLaneM - b; // m
-      v_b = laneMap[mapToReadShift + posToSample] / 3;
-      break;
-    }
+  ushort last = agent.posInLaneM + 1;
+  uint prev = lower_vehicle(lane + last + 1);
+  pos = 0;
+  if (prev > 0 && vehicleKeys_d[prev - 1] > lane) {
+    pos = vehicleKeys_d[prev - 1] & 0xFFFF;
+    v_b = vehicleSpeeds_d[prev - 1] / 3;
+  }
+  stop = last_occupied(map_lane + max(pos + 1, stop_line(agent)),
+                       map_lane + last + 1);
+  if (stop < map_lane + last + 1) {
+    pos = stop - map_lane;
+    v_b = laneMap[stop] / 3;
+  }
+  if (pos > 0) {
+    gap_b = agent.posInLaneM - pos; // m
   }
 }
 
 // TODO : CHECK MULTIPLE LANES
-__device__ bool check_space(int space, int eid, int edge_length, uchar *laneMap,
+__device__ bool check_space(int space, int eid, int edge_length,
                             uint mapToReadShift) {
-  for (auto b = 0; b < space; b++) {
-    // just right LANE !!!!!!!
-    auto pos = lanemap_pos(eid, edge_length, 0, b);
-    auto laneChar =
-        laneMap[mapToReadShift + pos]; // get byte of edge (proper line)
-    if (laneChar != 0xFF) {
-      return false;
-    }
+  // just right LANE !!!!!!!
+  uint lane = mapToReadShift + lanemap_pos(eid, edge_length, 0, 0);
+  return next_occupied(lane, lane + space) == lane + space;
+}
+
+//! Append an agent to a queue, false if the queue is full
+__device__ bool enqueue(LC::QueueData &queue, int *queuePool, int agent_id) {
+  unsigned slot = atomicAdd(&(queue.size), 1);
+  if (slot >= queue.capacity) { // full: the agent retries in check_stagnation
+    atomicSub(&(queue.size), 1);
+    return false;
   }
+  queuePool[queue.offset + (queue.head + slot) % queue.capacity] = agent_id;
   return true;
 }
 
-__device__ int deque(int *queue, unsigned &rear) {
-  int aid = queue[0];
-  for (int i = 0; i < rear - 1; i++) {
-    queue[i] = queue[i + 1];
-  }
-  rear--; // decrement rear
+//! i-th agent of a queue (0 is the front)
+__device__ int queue_at(const LC::QueueData &queue, const int *queuePool,
+                        unsigned i) {
+  return queuePool[queue.offset + (queue.head + i) % queue.capacity];
+}
+
+__device__ int deque(LC::QueueData &queue, int *queuePool) {
+  int aid = queuePool[queue.offset + queue.head];
+  queue.head = (queue.head + 1) % queue.capacity;
+  queue.size--;
   return aid;
 }
 
-__device__ void initialize_agent(int agent_id, LC::Agent &agent,
-                                 LC::EdgeData *edgesData, uchar *laneMap,
-                                 LC::IntersectionData *intersections) {
+__device__ void initialize_agent(int agent_id, AgentHot &agent,
+                                 LC::Agent &info,
+                                 LC::IntersectionData *intersections,
+                                 int *queuePool) {
 
   // 1.1  edge case: no available route
-  if (agent.route_size == 0) {
+  if (info.route_size == 0) {
     agent.active = 2;
     return;
   }
   // add to corresponding queue
-  auto &intersection = intersections[agent.init_intersection];
-  intersection.init_queue[intersection.init_queue_rear] = agent_id;
-  intersection.init_queue_rear += 1;
-  //  atomicAdd(&(intersection.init_queue_rear), 1);
+  auto &intersection = intersections[info.init_intersection];
+  enqueue(intersection.init_queue, queuePool, agent_id);
 
   // initialize agent
   agent.active = 1;
   agent.in_queue = true;
-  agent.intersection_id = agent.init_intersection;
-
-  //        bool isSet = false;
-  //        do {
-  //          if (isSet = atomicCAS(&mutex0, 0, 1) == 0) {
-  //            intersection.init_queue[intersection.init_queue_rear] =
-  //            agent_id; atomicAdd(&(intersection.init_queue_rear), 1);
-  //          }
-  //          if (isSet) {
-  //            atomicExch(&mutex0, 0);
-  //            __syncthreads();
-  //          }
-  //        } while (!isSet);
-}
-
-__device__ bool in_queue(int agent_id, int *queue, unsigned queue_size) {
-  for (int i = 0; i < queue_size; ++i) {
-    if (queue[i] == agent_id) {
+  info.intersection_id = info.init_intersection;
+}
+
+__device__ bool in_queue(int agent_id, const LC::QueueData &queue,
+                         const int *queuePool) {
+  unsigned size = min(queue.size, queue.capacity);
+  for (unsigned i = 0; i < size; ++i) {
+    if (queue_at(queue, queuePool, i) == agent_id) {
       return true;
     }
   }
   return false;
 }
 
-__device__ void check_stagnation(int agent_id, LC::Agent &agent,
-                                 LC::IntersectionData *intersections) {
-  auto &intersection = intersections[agent.intersection_id];
-  if (agent.queue_idx == -1) {
-    if (in_queue(agent_id, intersection.init_queue,
-                 intersection.init_queue_rear)) {
-      return;
-    }
-    // try to place the agent to the queue again
-    intersection.init_queue[intersection.init_queue_rear] = agent_id;
-    intersection.init_queue_rear += 1;
-  }
-  auto &queue = intersection.queue[agent.queue_idx];
-  auto &queue_ptr = intersection.pos[agent.queue_idx];
-  if (in_queue(agent_id, queue, queue_ptr)) {
+__device__ void check_stagnation(int agent_id, LC::Agent &info,
+                                 LC::IntersectionData *intersections,
+                                 LC::MovementData *movements, int *queuePool) {
+  auto &intersection = intersections[info.intersection_id];
+  auto &queue =
+      info.queue_idx == -1
+          ? intersection.init_queue
+          : movements[intersection.movement_offset + info.queue_idx].queue;
+  if (in_queue(agent_id, queue, queuePool)) {
     return;
   }
-  queue[queue_ptr] = agent_id;
-  queue_ptr += 1;
+  // try to place the agent to the queue again
+  enqueue(queue, queuePool, agent_id);
 }
 
-// TODO : CHECK NEXT EDGE?
-__device__ void check_front_car(LC::Agent &agent, uchar *laneMap,
-                                float deltaTime) {
+__device__ void check_front_car(int agent_id, AgentHot &agent,
+                                LC::Agent &info, LC::EdgeData *edgesData,
+                                uchar *laneMap, uint *routes) {
 
-  int numCellsCheck = fmax(15.0f, agent.v * deltaTime); // 15 or speed*time
   ushort byteInLine = (ushort)floor(agent.posInLaneM);
 
-  // a) SAME LINE (BEFORE SIGNALING)
+  // a) SAME LINE (BEFORE SIGNALING): the next vehicle of the lane in the
+  // sorted order, looked up if the agent entered the edge in this step
   float s = 20;
   float delta_v = agent.v - agent.max_speed;
-  for (ushort b = byteInLine + 1;
-       (b < agent.edge_length) && (numCellsCheck > 0); b++, numCellsCheck--) {
-    uint posToSample =
-        lanemap_pos(agent.edge_mid, agent.edge_length, agent.lane, b);
-    auto laneChar = laneMap[mapToReadShift + posToSample];
-    if (laneChar != 0xFF) {
-      s = ((float)(b - byteInLine)); // m
-      delta_v =
-          agent.v -
-          (laneChar / 3.0f); // laneChar is in 3*ms (to save space in array)
-      break;
+  const auto lane = vehicle_key(agent.edge_mid, agent.lane, 0);
+  uint next = vehicleRank_d[agent_id];
+  if (next == NO_VEHICLE) {
+    next = lower_vehicle(lane + byteInLine + 1);
+  } else {
+    do {
+      ++next; // skip vehicles at the same meter
+    } while (next < numVehicles && vehicleKeys_d[next] <= lane + byteInLine);
+  }
+  uint pos = ceilf(agent.edge_length);
+  uchar laneChar = 0xFF;
+  if (next < numVehicles && vehicleKeys_d[next] < lane + 0x10000) {
+    pos = vehicleKeys_d[next] & 0xFFFF;
+    laneChar = vehicleSpeeds_d[next];
+  }
+  // b) the stop line of a full queue
+  uint map_lane = mapToReadShift +
+                  lanemap_pos(agent.edge_mid, agent.edge_length, agent.lane, 0);
+  uint stop = next_occupied(
+      map_lane + max((uint)(byteInLine + 1), stop_line(agent)),
+      map_lane + pos);
+  if (stop < map_lane + pos) {
+    pos = stop - map_lane;
+    laneChar = laneMap[stop];
+  }
+  if (pos < agent.edge_length) {
+    s = ((float)(pos - byteInLine)); // m
+    delta_v =
+        agent.v -
+        (laneChar / 3.0f); // laneChar is in 3*ms (to save space in array)
+  } else if (info.route_ptr + 1 < int(info.route_size)) {
+    // c) NEXT EDGE: the rest of the edge is free, look at the lane the agent
+    // enters the next edge of its route on, up to LOOK_AHEAD_M ahead
+    int toEnd = ceilf(agent.edge_length) - byteInLine;
+    if (toEnd < LOOK_AHEAD_M) {
+      auto next_mid = routes[info.route_offset + info.route_ptr + 1];
+      auto &next_edge = edgesData[next_mid];
+      uint next_lane =
+          mapToReadShift + lanemap_pos(next_mid, next_edge.length, 0, 0);
+      uint end = next_lane + min((uint)ceilf(next_edge.length),
+                                 (uint)(LOOK_AHEAD_M - toEnd));
+      uint ahead = next_occupied(next_lane, end);
+      if (ahead < end) {
+        s = ((float)(toEnd + ahead - next_lane)); // m
+        delta_v = agent.v - (laneMap[ahead] / 3.0f);
+      }
     }
   }
   agent.s = s;
   agent.delta_v = delta_v;
 }
 
-__device__ void update_agent_info(LC::Agent &agent, float deltaTime) {
+__device__ void update_agent_info(AgentHot &agent, float deltaTime) {
 
   // update speed
   float thirdTerm = 0;
@@ -332,8 +812,8 @@ __device__ void update_agent_info(LC::Agent &agent, float deltaTime) {
   agent.posInLaneM += numMToMove;
 }
 
-__device__ void change_lane(LC::Agent &agent, LC::EdgeData *edgesData,
-                            uchar *laneMap) {
+__device__ void change_lane(AgentHot &agent, LC::Agent &info,
+                            LC::EdgeData *edgesData, uchar *laneMap) {
 
   auto &current_edge = edgesData[agent.edge_mid];
   if (agent.posInLaneM > current_edge.length) { // skip if will go to next edge
@@ -382,15 +862,15 @@ __device__ void change_lane(LC::Agent &agent, LC::EdgeData *edgesData,
     }
 
     agent.lane = laneToCheck; // CHANGE LINE
-    agent.num_lane_change += 1;
+    info.num_lane_change += 1;
   }
 }
 
-__device__ uint find_intersetcion_id(LC::Agent &agent,
-                                     LC::EdgeData *edgesData) {
+__device__ uint find_intersetcion_id(AgentHot &agent, LC::Agent &info,
+                                     LC::EdgeData *edgesData, uint *routes) {
   // find the intersection id
   auto &current_edge = edgesData[agent.edge_mid];
-  auto &next_edge = edgesData[agent.route[agent.route_ptr + 1]];
+  auto &next_edge = edgesData[routes[info.route_offset + info.route_ptr + 1]];
   for (unsigned i = 0; i < 2; i++) {
     auto vid = current_edge.vertex[i];
     for (unsigned j = 0; j < 2; j++) {
@@ -402,50 +882,52 @@ __device__ uint find_intersetcion_id(LC::Agent &agent,
   return 0;
 }
 
-__device__ uint find_queue_id(LC::Agent &agent,
-                              LC::IntersectionData &intersection) {
+__device__ uint find_queue_id(AgentHot &agent, LC::Agent &info,
+                              LC::IntersectionData &intersection,
+                              LC::MovementData *movements, uint *routes) {
+  auto next_mid = routes[info.route_offset + info.route_ptr + 1];
   for (unsigned i = 0; i < intersection.num_queue; i++) {
-    if (agent.edge_mid == intersection.start_edge[i] and
-        agent.route[agent.route_ptr + 1] == intersection.end_edge[i]) {
+    auto &movement = movements[intersection.movement_offset + i];
+    if (agent.edge_mid == movement.start_edge and
+        next_mid == movement.end_edge) {
       return i;
     }
   }
   return 0;
 }
 
-__device__ bool update_intersection(int agent_id, LC::Agent &agent,
-                                    LC::EdgeData *edgesData,
-                                    LC::IntersectionData *intersections) {
+__device__ bool update_intersection(int agent_id, AgentHot &agent,
+                                    LC::Agent &info, LC::EdgeData *edgesData,
+                                    LC::IntersectionData *intersections,
+                                    LC::MovementData *movements,
+                                    int *queuePool, uint *routes) {
   auto &current_edge = edgesData[agent.edge_mid];
   auto extra = agent.posInLaneM - agent.edge_length;
   if (extra < 0) { // does not reach an intersection
     return false;
   }
   agent.cum_length -= extra;                     // remove the extra distance
-  if (agent.route_ptr + 1 >= agent.route_size) { // reach destination
+  if (info.route_ptr + 1 >= int(info.route_size)) { // reach destination
     agent.active = 2;
     atomicAdd(&(current_edge.downstream_veh_count), 1);
-    int num_steps_in_edge = agent.num_steps - agent.num_steps_entering_edge;
+    int num_steps_in_edge = agent.num_steps - info.num_steps_entering_edge;
     atomicAdd(&(current_edge.period_cum_travel_steps),
               num_steps_in_edge); // for average travel time calculation
     return false;
   }
-  auto intersetcion_id = find_intersetcion_id(agent, edgesData);
+  auto intersetcion_id = find_intersetcion_id(agent, info, edgesData, routes);
   auto &intersection = intersections[intersetcion_id];
-  int queue_id = find_queue_id(agent, intersection);
-  auto &queue = intersection.queue[queue_id];
-  auto &queue_ptr = intersection.pos[queue_id];
-  agent.queue_idx = queue_id;
-  agent.intersection_id = intersetcion_id;
+  int queue_id = find_queue_id(agent, info, intersection, movements, routes);
+  auto &queue = movements[intersection.movement_offset + queue_id].queue;
+  info.queue_idx = queue_id;
+  info.intersection_id = intersetcion_id;
   agent.in_queue = true;
   agent.v = 0; // in queue vehicle is stopped.
-  int num_steps_in_edge = agent.num_steps - agent.num_steps_entering_edge;
+  int num_steps_in_edge = agent.num_steps - info.num_steps_entering_edge;
   atomicAdd(&(current_edge.period_cum_travel_steps),
             num_steps_in_edge); // for average travel time calculation
 
-  queue[queue_ptr] = agent_id;
-  queue_ptr += 1;
-  //  atomicAdd(&(queue_ptr), 1);
+  enqueue(queue, queuePool, agent_id);
   atomicAdd(&(current_edge.downstream_veh_count), 1);
 
   // Synchronization Control
@@ -464,89 +946,99 @@ __device__ bool update_intersection(int agent_id, LC::Agent &agent,
   return true;
 }
 
-__device__ void write2lane_map(LC::Agent &agent, LC::EdgeData *edgesData,
-                               uchar *laneMap) {
+__device__ void write2lane_map(AgentHot &agent, uchar *laneMap) {
   // write to the lanemap if still on the edge
 
   auto posToSample = lanemap_pos(agent.edge_mid, agent.edge_length, agent.lane,
                                  agent.posInLaneM);
   uchar vInMpS = (uchar)(agent.v * 3); // speed in m/s to fit in uchar
   laneMap[mapToWriteShift + posToSample] = vInMpS;
+  set_occupied(mapToWriteShift + posToSample);
 }
 
 //! Simulate agents movements on network edges
 __global__ void
-kernel_trafficSimulation(int numPeople, float currentTime, LC::Agent *agents,
+kernel_trafficSimulation(int numActive, uint *activeList, float currentTime,
+                         AgentsHot hot, LC::Agent *agents, uchar *dirty,
                          LC::EdgeData *edgesData, uchar *laneMap,
-                         LC::IntersectionData *intersections, float deltaTime) {
+                         LC::IntersectionData *intersections,
+                         LC::MovementData *movements, int *queuePool,
+                         uint *routes, float deltaTime) {
 
-  int p = blockIdx.x * blockDim.x + threadIdx.x;
-  if (p >= numPeople) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numActive) {
     return; // CUDA check (inside margins)
   }
   if (threadIdx.x == 0) {
     mutex = 0;
   }
+  int p = activeList[i];
   //  __syncthreads();
 
-  auto &agent = agents[p];
   // 1. initialization
-  if (agent.active == 2) { // agent is already finished
+  if (hot.active[p] == 2) { // agent is already finished
     return;
   }
   // 1.1. check if person should still wait or should start
-  if (agent.active == 0) {
-    if (agent.time_departure > currentTime) { // wait
-      return;
-    } else { // its your turn
-      initialize_agent(p, agent, edgesData, laneMap, intersections);
-      return;
-    }
+  if (hot.active[p] == 0 && hot.time_departure[p] > currentTime) { // wait
+    return;
+  }
+  auto agent = load_hot(hot, p);
+  auto &info = agents[p];
+  dirty[p] = 1; // copy back with the next delta transfer
+  if (agent.active == 0) { // its your turn
+    initialize_agent(p, agent, info, intersections, queuePool);
+    store_hot(hot, p, agent);
+    return;
   }
 
   // 2. Moving
   agent.num_steps++;
-  if (agent.in_queue) {
-    agent.num_steps_in_queue += 1;
-    check_stagnation(p, agent, intersections);
+  if (agent.in_queue) { // only the step counters change while queued
+    hot.num_steps[p] = agent.num_steps;
+    hot.num_steps_in_queue[p] = agent.num_steps_in_queue + 1;
+    check_stagnation(p, info, intersections, movements, queuePool);
     return;
   }
 
   // 2.1.1 Find front car
-  check_front_car(agent, laneMap, deltaTime);
+  check_front_car(p, agent, info, edgesData, laneMap, routes);
   // 2.1.2 Update agent information using the front car info
   update_agent_info(agent, deltaTime);
   //  2.1.3 Perform lane changing if necessary
-  change_lane(agent, edgesData, laneMap);
+  change_lane(agent, info, edgesData, laneMap);
   // 2.1.4 check intersection
-  bool added2queue = update_intersection(p, agent, edgesData, intersections);
+  bool added2queue =
+      update_intersection(p, agent, info, edgesData, intersections, movements,
+                          queuePool, routes);
   // 2.1.5 write the updated agent info to lanemap
   if (not added2queue) {
-    write2lane_map(agent, edgesData, laneMap);
+    write2lane_map(agent, laneMap);
   }
-
+  store_hot(hot, p, agent);
 } //
 
 // TODO : PLACE ON MULTIPLE LANES
-__device__ void move2nextEdge(LC::Agent &agent, int numMToMove,
-                              LC::EdgeData *edgesData, uchar *laneMap) {
+__device__ void move2nextEdge(AgentHot &agent, LC::Agent &info, int numMToMove,
+                              LC::EdgeData *edgesData, uchar *laneMap,
+                              uint *routes) {
 
   //  if (not agent.in_queue) {
   //    return;
   //  }
   agent.in_queue = false;
-  agent.route_ptr += 1;
-  //  atomicAdd(&(agent.route_ptr), 1);
-  agent.edge_mid = agent.route[agent.route_ptr];
+  info.route_ptr += 1;
+  //  atomicAdd(&(info.route_ptr), 1);
+  agent.edge_mid = routes[info.route_offset + info.route_ptr];
   agent.posInLaneM = numMToMove;
   agent.lane = 0;
   agent.v = INIT_SPEED; // double initial speed to avoid unnecessary queueing
 
   auto &current_edge = edgesData[agent.edge_mid];
-  agent.edge_id = current_edge.eid;
+  info.edge_id = current_edge.eid;
   agent.max_speed = current_edge.maxSpeedMperSec;
   agent.edge_length = current_edge.length;
-  agent.num_steps_entering_edge = agent.num_steps;
+  info.num_steps_entering_edge = agent.num_steps;
   //
   atomicAdd(&(current_edge.upstream_veh_count), 1);
 
@@ -554,49 +1046,54 @@ __device__ void move2nextEdge(LC::Agent &agent, int numMToMove,
                                  agent.lane, agent.posInLaneM);
   uchar vInMpS = (uchar)(agent.v * 3); // speed in m/s to fit in uchar
   laneMap[mapToWriteShift + posToSample] = vInMpS;
+  set_occupied(mapToWriteShift + posToSample);
   //
   agent.cum_length += numMToMove;
   agent.num_steps += 1;
 }
 
 __device__ bool discharge_queue(LC::IntersectionData &intersection,
-                                LC::Agent *trafficPersonVec,
-                                LC::EdgeData *edgesData, uchar *laneMap) {
-  auto &q1 = intersection.queue[intersection.queue_ptr];
-  auto &n1 = intersection.pos[intersection.queue_ptr];
-
-  if (n1 < 1) {
+                                LC::MovementData *movements, int *queuePool,
+                                AgentsHot hot, LC::Agent *trafficPersonVec,
+                                LC::EdgeData *edgesData, uchar *laneMap,
+                                uint *routes) {
+  auto &movement = movements[intersection.movement_offset +
+                             intersection.queue_ptr];
+  auto &q1 = movement.queue;
+
+  if (q1.size < 1) {
     return false;
   }
 
-  auto aid = q1[0];
-  auto &agent = trafficPersonVec[aid];
-  if (not agent.in_queue) { // bug walk around: agent has been reassigned to a
-                            // queue
-    deque(q1, n1);
+  auto aid = queue_at(q1, queuePool, 0);
+  if (not hot.in_queue[aid]) { // bug walk around: agent has been
+                               // reassigned to a queue
+    deque(q1, queuePool);
     return true;
   }
 
-  unsigned eid1 = intersection.end_edge[intersection.queue_ptr];
+  unsigned eid1 = movement.end_edge;
   int edge_length = edgesData[eid1].length;
   unsigned numMToMove = SOCIAL_DIST;
 
   bool enough_space =
-      check_space(numMToMove + SOCIAL_DIST, eid1, edge_length, laneMap,
+      check_space(numMToMove + SOCIAL_DIST, eid1, edge_length,
                   mapToReadShift); // check social dist ahead
 
-  intersection.max_queue = max(intersection.max_queue, n1);
+  intersection.max_queue = max(intersection.max_queue, q1.size);
   bool discharged = false;
   if (enough_space) {
-    auto aid = deque(q1, n1);
-    move2nextEdge(agent, numMToMove, edgesData,
-                  laneMap); // move to the next edge
+    deque(q1, queuePool);
+    auto agent = load_hot(hot, aid);
+    move2nextEdge(agent, trafficPersonVec[aid], numMToMove, edgesData,
+                  laneMap, routes); // move to the next edge
+    store_hot(hot, aid, agent);
     discharged = true;
   }
   return discharged;
 }
 
-__device__ void place_stop(LC::Agent &agent, LC::EdgeData *edgesData,
+__device__ void place_stop(AgentHot &agent, LC::EdgeData *edgesData,
                            uchar *laneMap, uint mapToWriteShift) {
   auto &edge = edgesData[agent.edge_mid];
   for (int j = 0; j < SOCIAL_DIST; ++j) {
@@ -604,6 +1101,7 @@ __device__ void place_stop(LC::Agent &agent, LC::EdgeData *edgesData,
     for (int i = 0; i < edge.num_lanes; ++i) {
       auto posToSample = lanemap_pos(agent.edge_mid, agent.edge_length, i, pos);
       laneMap[mapToWriteShift + posToSample] = 0;
+      set_occupied(mapToWriteShift + posToSample);
     }
   }
 }
@@ -611,56 +1109,63 @@ __device__ void place_stop(LC::Agent &agent, LC::EdgeData *edgesData,
 __device__ bool discharge_init_agents(unsigned intersection_id,
                                       LC::EdgeData *edgesData,
                                       LC::IntersectionData *intersections,
+                                      int *queuePool, AgentsHot hot,
                                       LC::Agent *trafficPersonVec,
-                                      uchar *laneMap) {
+                                      uchar *laneMap, uint *routes) {
   auto &intersection = intersections[intersection_id];
   auto &init_queue = intersection.init_queue;
-  auto &rear_ptr = intersection.init_queue_rear;
-  if (rear_ptr < 1) {
+  if (init_queue.size < 1) {
     return false;
   }
   bool discharged = false;
-  auto aid = init_queue[0];
-  auto &agent = trafficPersonVec[aid];
-  if (not agent.in_queue) { // bug walk around: agent has been reassigned to a
-                            // queue
-    deque(init_queue, rear_ptr);
+  auto aid = queue_at(init_queue, queuePool, 0);
+  auto &info = trafficPersonVec[aid];
+  if (not hot.in_queue[aid]) { // bug walk around: agent has been
+                               // reassigned to a queue
+    deque(init_queue, queuePool);
     return true;
   }
 
-  auto &first_edge = edgesData[agent.route[0]];
+  auto &first_edge = edgesData[routes[info.route_offset]];
   unsigned numMToMove = SOCIAL_DIST;
-  bool enough_space = check_space(numMToMove + SOCIAL_DIST, agent.route[0],
-                                  first_edge.length, laneMap,
-                                  mapToReadShift); // check social dist ahead
+  bool enough_space =
+      check_space(numMToMove + SOCIAL_DIST, routes[info.route_offset],
+                  first_edge.length,
+                  mapToReadShift); // check social dist ahead
   if (enough_space) {
-    aid = deque(init_queue, rear_ptr);
-    move2nextEdge(agent, numMToMove, edgesData, laneMap);
+    deque(init_queue, queuePool);
+    auto agent = load_hot(hot, aid);
+    move2nextEdge(agent, info, numMToMove, edgesData, laneMap, routes);
+    store_hot(hot, aid, agent);
     discharged = true;
   }
   // update waiting steps for all other agents
-  for (int i = 0; i < rear_ptr; ++i) {
-    auto aid = init_queue[i];
-    auto &agent = trafficPersonVec[aid];
-    agent.initial_waited_steps += 1;
+  for (unsigned i = 0; i < init_queue.size; ++i) {
+    auto aid = queue_at(init_queue, queuePool, i);
+    trafficPersonVec[aid].initial_waited_steps += 1;
   }
   return discharged;
 }
 
 __device__ void check_queues(unsigned intersection_id, LC::EdgeData *edgesData,
                              LC::IntersectionData *intersections,
-                             LC::Agent *trafficPersonVec, uchar *laneMap) {
+                             LC::MovementData *movements, int *queuePool,
+                             AgentsHot hot, LC::Agent *trafficPersonVec,
+                             uchar *laneMap, uint *routes) {
   auto &intersection = intersections[intersection_id];
   bool discharged = false;
   for (int i = 0; i < intersection.num_queue + 1; ++i) {
     if (intersection.queue_ptr > intersection.num_queue - 1) {
       intersection.queue_ptr = 0; // reset
-      discharged = discharge_init_agents(
-          intersection_id, edgesData, intersections, trafficPersonVec, laneMap);
+      discharged =
+          discharge_init_agents(intersection_id, edgesData, intersections,
+                                queuePool, hot, trafficPersonVec, laneMap,
+                                routes);
     }
     if (not discharged) {
       discharged =
-          discharge_queue(intersection, trafficPersonVec, edgesData, laneMap);
+          discharge_queue(intersection, movements, queuePool, hot,
+                          trafficPersonVec, edgesData, laneMap, routes);
     }
     intersection.queue_ptr += 1;
     if (discharged) {
@@ -673,45 +1178,144 @@ __device__ void check_queues(unsigned intersection_id, LC::EdgeData *edgesData,
 __global__ void
 kernel_intersectionOneSimulation(uint numIntersections, LC::EdgeData *edgesData,
                                  LC::IntersectionData *intersections,
-                                 LC::Agent *agents, uchar *laneMap) {
+                                 LC::MovementData *movements, int *queuePool,
+                                 AgentsHot hot, LC::Agent *agents,
+                                 uchar *laneMap, uint *routes) {
 
   int i = blockIdx.x * blockDim.x + threadIdx.x;
   if (i >= numIntersections) {
     return; // CUDA check (inside margins)
   }
-  check_queues(i, edgesData, intersections, agents, laneMap);
+  check_queues(i, edgesData, intersections, movements, queuePool, hot, agents,
+               laneMap, routes);
 
   // add a stop sign for full queues
   auto &intersection = intersections[i];
   for (unsigned j = 0; j < intersection.num_queue; j++) {
-    auto num_cars = intersection.pos[j];
-    if (num_cars > 0) {
-      auto &q1 = intersection.queue[j];
-      auto &agent = agents[q1[0]];
+    auto &q1 = movements[intersection.movement_offset + j].queue;
+    if (q1.size > 0) {
+      auto agent = load_hot(hot, queue_at(q1, queuePool, 0));
       place_stop(agent, edgesData, laneMap, mapToWriteShift);
     }
   }
 }
 
+//! Collect the active agents on an edge with their sort keys
+__global__ void kernel_collectVehicles(uint numActive, uint *activeList,
+                                       AgentsHot hot, unsigned long long *keys,
+                                       uint *order, uint *rank, uint *count) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numActive) {
+    return;
+  }
+  uint p = activeList[i];
+  rank[p] = NO_VEHICLE;
+  if (hot.active[p] == 1 && not hot.in_queue[p]) {
+    uint slot = atomicAdd(count, 1);
+    keys[slot] = vehicle_key(hot.edge_mid[p], hot.lane[p], hot.posInLaneM[p]);
+    order[slot] = p;
+  }
+}
+
+//! Record the place and speed of every sorted vehicle
+__global__ void kernel_rankVehicles(uint numVehicles, const uint *order,
+                                    AgentsHot hot, uchar *speeds,
+                                    uint *rank) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numVehicles) {
+    return;
+  }
+  uint p = order[i];
+  speeds[i] = (uchar)(hot.v[p] * 3);
+  rank[p] = i;
+}
+
+//! Keep the active agents that have not finished yet
+__global__ void kernel_compactActive(uint numActive, uint *activeList,
+                                     unsigned short *active, uint *compacted,
+                                     uint *count) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numActive) {
+    return;
+  }
+  uint p = activeList[i];
+  if (active[p] != 2) {
+    compacted[atomicAdd(count, 1)] = p;
+  }
+}
+
 void cuda_simulate(float currentTime, uint numPeople, uint numIntersections,
                    float deltaTime, int numBlocks, int threadsPerBlock) {
+  // the previous step has to finish before the managed map shifts change (the
+  // delta copies run on copyStream and are not waited for here)
+  gpuErrchk(cudaStreamSynchronize(0));
 
   ////////////////////////////////////////////////////////////
   // 1. CHANGE MAP: set map to use and clean the other
   if (readFirstMapC) {
     mapToReadShift = 0;
     mapToWriteShift = halfLaneMap;
-    gpuErrchk(
-        cudaMemset(&laneMap_d[halfLaneMap], -1,
-                   halfLaneMap * sizeof(unsigned char))); // clean second half
   } else {
     mapToReadShift = halfLaneMap;
     mapToWriteShift = 0;
-    gpuErrchk(
-        cudaMemset(&laneMap_d[0], -1,
-                   halfLaneMap * sizeof(unsigned char))); // clean first half
   }
   readFirstMapC = !readFirstMapC; // next iteration invert use
+  // a new step stamp empties the write half
+  if (++mapEpoch == 0) { // stamps wrapped around: clean both halves
+    gpuErrchk(cudaMemset(laneOccupancy_d, 0,
+                         2 * (halfLaneMap / 32) * sizeof(unsigned long long)));
+  }
+
+  ////////////////////////////////////////////////////////////
+  // 2. ACTIVATE: drop finished agents from the active list every
+  // ACTIVE_COMPACT_STEPS steps and append the agents departing by now
+  if (numSteps++ % ACTIVE_COMPACT_STEPS == 0 && numActive > 0) {
+    gpuErrchk(cudaMemset(activeCount_d, 0, sizeof(uint)));
+    int compactBlocks = (numActive + threadsPerBlock - 1) / threadsPerBlock;
+    kernel_compactActive<<<compactBlocks, threadsPerBlock>>>(
+        numActive, activeList_d, hot_d.active, activeListTmp_d,
+        activeCount_d);
+    gpuErrchk(cudaPeekAtLastError());
+    gpuErrchk(cudaMemcpy(&numActive, activeCount_d, sizeof(uint),
+                         cudaMemcpyDeviceToHost));
+    std::swap(activeList_d, activeListTmp_d);
+  }
+  uint firstDeparture = nextDeparture;
+  while (nextDeparture < departureTimes_h.size() &&
+         departureTimes_h[nextDeparture] <= currentTime) {
+    nextDeparture++;
+  }
+  if (nextDeparture > firstDeparture) {
+    uint numDepartures = nextDeparture - firstDeparture;
+    gpuErrchk(cudaMemcpy(activeList_d + numActive,
+                         departures_d + firstDeparture,
+                         numDepartures * sizeof(uint),
+                         cudaMemcpyDeviceToDevice));
+    numActive += numDepartures;
+  }
+
+  ////////////////////////////////////////////////////////////
+  // 3. SORT: vehicles on the edges by (edge, lane, position)
+  if (numActive > 0) {
+    gpuErrchk(cudaMemset(vehicleCount_d, 0, sizeof(uint)));
+    int activeBlocks = (numActive + threadsPerBlock - 1) / threadsPerBlock;
+    kernel_collectVehicles<<<activeBlocks, threadsPerBlock>>>(
+        numActive, activeList_d, hot_d, vehicleKeys_d, vehicleOrder_d,
+        vehicleRank_d, vehicleCount_d);
+    gpuErrchk(cudaPeekAtLastError());
+    uint count;
+    gpuErrchk(cudaMemcpy(&count, vehicleCount_d, sizeof(uint),
+                         cudaMemcpyDeviceToHost));
+    numVehicles = count;
+    thrust::sort_by_key(thrust::device, vehicleKeys_d, vehicleKeys_d + count,
+                        vehicleOrder_d);
+    if (count > 0) {
+      int vehicleBlocks = (count + threadsPerBlock - 1) / threadsPerBlock;
+      kernel_rankVehicles<<<vehicleBlocks, threadsPerBlock>>>(
+          count, vehicleOrder_d, hot_d, vehicleSpeeds_d, vehicleRank_d);
+      gpuErrchk(cudaPeekAtLastError());
+    }
+  }
 
   std::random_device
       rd; // Will be used to obtain a seed for the random number engine
@@ -720,17 +1324,21 @@ void cuda_simulate(float currentTime, uint numPeople, uint numIntersections,
   // random assign which to go
   intersectionBench.startMeasuring();
   kernel_intersectionOneSimulation<<<numBlocks, threadsPerBlock>>>(
-      numIntersections, edgesData_d, intersections_d, trafficPersonVec_d,
-      laneMap_d);
+      numIntersections, edgesData_d, intersections_d, movements_d,
+      queuePool_d, hot_d, trafficPersonVec_d, laneMap_d, indexPathVec_d);
   gpuErrchk(cudaPeekAtLastError());
   intersectionBench.stopMeasuring();
 
   peopleBench.startMeasuring();
-  // Simulate people.
-  kernel_trafficSimulation<<<numBlocks, threadsPerBlock>>>(
-      numPeople, currentTime, trafficPersonVec_d, edgesData_d, laneMap_d,
-      intersections_d, deltaTime);
-  gpuErrchk(cudaPeekAtLastError());
+  // Simulate the active people.
+  if (numActive > 0) {
+    int activeBlocks = (numActive + threadsPerBlock - 1) / threadsPerBlock;
+    kernel_trafficSimulation<<<activeBlocks, threadsPerBlock>>>(
+        numActive, activeList_d, currentTime, hot_d, trafficPersonVec_d,
+        agentDirty_d, edgesData_d, laneMap_d, intersections_d, movements_d,
+        queuePool_d, indexPathVec_d, deltaTime);
+    gpuErrchk(cudaPeekAtLastError());
+  }
   peopleBench.stopMeasuring();
   //    if (random_bool(gen)){
   //        peopleBench.startMeasuring();
@@ -773,3 +1381,328 @@ void cuda_simulate(float currentTime, uint numPeople, uint numIntersections,
   //    }
 
 } //
+
+//! Compact the agents stepped since the last transfer into the stage buffer
+__global__ void kernel_stageAgents(uint numPeople, AgentsHot hot,
+                                   LC::Agent *agents, uchar *dirty,
+                                   LC::Agent *stage, uint *stageIdx,
+                                   uint *count) {
+  int p = blockIdx.x * blockDim.x + threadIdx.x;
+  if (p >= numPeople || not dirty[p]) {
+    return;
+  }
+  dirty[p] = 0;
+  LC::Agent agent = agents[p];
+  agent.active = hot.active[p];
+  agent.in_queue = hot.in_queue[p];
+  agent.edge_mid = hot.edge_mid[p];
+  agent.lane = hot.lane[p];
+  agent.posInLaneM = hot.posInLaneM[p];
+  agent.v = hot.v[p];
+  agent.s = hot.s[p];
+  agent.delta_v = hot.delta_v[p];
+  agent.max_speed = hot.max_speed[p];
+  agent.edge_length = hot.edge_length[p];
+  agent.dv_dt = hot.dv_dt[p];
+  agent.cum_length = hot.cum_length[p];
+  agent.cum_v = hot.cum_v[p];
+  agent.num_steps = hot.num_steps[p];
+  agent.num_steps_in_queue = hot.num_steps_in_queue[p];
+  agent.slow_down_steps = hot.slow_down_steps[p];
+  uint slot = atomicAdd(&count[0], 1);
+  stage[slot] = agent;
+  stageIdx[slot] = p;
+}
+
+//! Compact the edges whose counters moved since the last transfer
+__global__ void kernel_stageEdges(uint numEdges, LC::EdgeData *edgesData,
+                                  LC::EdgeData *synced, LC::EdgeData *stage,
+                                  uint *stageIdx, uint *count) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numEdges) {
+    return;
+  }
+  auto &edge = edgesData[i];
+  auto &last = synced[i];
+  if (edge.upstream_veh_count == last.upstream_veh_count and
+      edge.downstream_veh_count == last.downstream_veh_count and
+      edge.period_cum_travel_steps == last.period_cum_travel_steps) {
+    return;
+  }
+  last = edge;
+  uint slot = atomicAdd(&count[1], 1);
+  stage[slot] = edge;
+  stageIdx[slot] = i;
+}
+
+void cuda_stage_data(int threadsPerBlock) {
+  gpuErrchk(cudaMemsetAsync(stageCount_d, 0, 2 * sizeof(uint)));
+  int agentBlocks = (numAgents + threadsPerBlock - 1) / threadsPerBlock;
+  kernel_stageAgents<<<agentBlocks, threadsPerBlock>>>(
+      numAgents, hot_d, trafficPersonVec_d, agentDirty_d, agentStage_d,
+      agentStageIdx_d, stageCount_d);
+  gpuErrchk(cudaPeekAtLastError());
+  int edgeBlocks = (numEdges + threadsPerBlock - 1) / threadsPerBlock;
+  kernel_stageEdges<<<edgeBlocks, threadsPerBlock>>>(
+      numEdges, edgesData_d, edgesSynced_d, edgeStage_d, edgeStageIdx_d,
+      stageCount_d);
+  gpuErrchk(cudaPeekAtLastError());
+  // the next step may start as soon as the stage buffers are filled
+  gpuErrchk(cudaEventRecord(stagedEvent, 0));
+  gpuErrchk(cudaStreamWaitEvent(copyStream, stagedEvent, 0));
+  gpuErrchk(cudaMemcpyAsync(stageCount_h, stageCount_d, 2 * sizeof(uint),
+                            cudaMemcpyDeviceToHost, copyStream));
+}
+
+void cuda_get_staged_data(std::vector<LC::Agent> &trafficPersonVec,
+                          std::vector<LC::EdgeData> &edgesData) {
+  gpuErrchk(cudaStreamSynchronize(copyStream));
+  uint agentCount = stageCount_h[0];
+  uint edgeCount = stageCount_h[1];
+  gpuErrchk(cudaMemcpyAsync(agentStage_h, agentStage_d,
+                            agentCount * sizeof(LC::Agent),
+                            cudaMemcpyDeviceToHost, copyStream));
+  gpuErrchk(cudaMemcpyAsync(agentStageIdx_h, agentStageIdx_d,
+                            agentCount * sizeof(uint), cudaMemcpyDeviceToHost,
+                            copyStream));
+  gpuErrchk(cudaMemcpyAsync(edgeStage_h, edgeStage_d,
+                            edgeCount * sizeof(LC::EdgeData),
+                            cudaMemcpyDeviceToHost, copyStream));
+  gpuErrchk(cudaMemcpyAsync(edgeStageIdx_h, edgeStageIdx_d,
+                            edgeCount * sizeof(uint), cudaMemcpyDeviceToHost,
+                            copyStream));
+  gpuErrchk(cudaStreamSynchronize(copyStream));
+
+  for (uint i = 0; i < agentCount; ++i) {
+    trafficPersonVec[agentStageIdx_h[i]] = agentStage_h[i];
+  }
+  for (uint i = 0; i < edgeCount; ++i) {
+    edgesData[edgeStageIdx_h[i]] = edgeStage_h[i];
+  }
+}
+
+//! Travel counters of every edge, before the agents raise their waiting time
+__global__ void kernel_stageEdgeTravel(uint numEdges, LC::EdgeData *edgesData,
+                                       LC::EdgeTravel *travel) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numEdges) {
+    return;
+  }
+  travel[i].downstream_veh_count = edgesData[i].downstream_veh_count;
+  travel[i].period_cum_travel_steps = edgesData[i].period_cum_travel_steps;
+  travel[i].wait_steps = 0;
+}
+
+//! List the active agents that wait with part of their route left to replace
+//! (a queued agent keeps its next edge), and raise the waiting time of the
+//! edges they are on
+__global__ void kernel_stageReroute(uint numActive, const uint *activeList,
+                                    AgentsHot hot, const LC::Agent *agents,
+                                    LC::EdgeTravel *travel,
+                                    LC::RerouteCandidate *stage,
+                                    uint *count) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numActive) {
+    return;
+  }
+  const uint p = activeList[i];
+  const auto &info = agents[p];
+  if (hot.active[p] != 1 or info.route_ptr < 0) {
+    return;
+  }
+  const uint steps = hot.num_steps[p] - info.num_steps_entering_edge;
+  atomicMax(&travel[hot.edge_mid[p]].wait_steps, steps);
+  const bool queued = hot.in_queue[p];
+  const int splice = info.route_ptr + (queued ? 2 : 1);
+  if ((queued or hot.v[p] == 0) and splice < int(info.route_size)) {
+    uint slot = atomicAdd(count, 1);
+    stage[slot] = {p, steps, info.route_offset, info.route_size,
+                   info.route_ptr, queued};
+  }
+}
+
+void cuda_stage_reroute(int threadsPerBlock) {
+  gpuErrchk(cudaMemsetAsync(rerouteCount_d, 0, sizeof(uint)));
+  int edgeBlocks = (numEdges + threadsPerBlock - 1) / threadsPerBlock;
+  kernel_stageEdgeTravel<<<edgeBlocks, threadsPerBlock>>>(
+      numEdges, edgesData_d, edgeTravel_d);
+  gpuErrchk(cudaPeekAtLastError());
+  if (numActive > 0) {
+    int activeBlocks = (numActive + threadsPerBlock - 1) / threadsPerBlock;
+    kernel_stageReroute<<<activeBlocks, threadsPerBlock>>>(
+        numActive, activeList_d, hot_d, trafficPersonVec_d, edgeTravel_d,
+        rerouteStage_d, rerouteCount_d);
+    gpuErrchk(cudaPeekAtLastError());
+  }
+  // the next step may start as soon as the lists are filled; the edge
+  // counters have a known size and are copied right away
+  gpuErrchk(cudaEventRecord(stagedEvent, 0));
+  gpuErrchk(cudaStreamWaitEvent(copyStream, stagedEvent, 0));
+  gpuErrchk(cudaMemcpyAsync(rerouteCount_h, rerouteCount_d, sizeof(uint),
+                            cudaMemcpyDeviceToHost, copyStream));
+  gpuErrchk(cudaMemcpyAsync(edgeTravel_h, edgeTravel_d,
+                            numEdges * sizeof(LC::EdgeTravel),
+                            cudaMemcpyDeviceToHost, copyStream));
+}
+
+void cuda_get_reroute_data(std::vector<LC::RerouteCandidate> &candidates,
+                           std::vector<LC::EdgeTravel> &edges) {
+  gpuErrchk(cudaStreamSynchronize(copyStream));
+  uint count = *rerouteCount_h;
+  gpuErrchk(cudaMemcpyAsync(rerouteStage_h, rerouteStage_d,
+                            count * sizeof(LC::RerouteCandidate),
+                            cudaMemcpyDeviceToHost, copyStream));
+  gpuErrchk(cudaStreamSynchronize(copyStream));
+  candidates.assign(rerouteStage_h, rerouteStage_h + count);
+  edges.assign(edgeTravel_h, edgeTravel_h + numEdges);
+}
+
+//! A new route applies if the agent is still on the edge it was rerouted
+//! from, and not yet queued for the next edge when that one was replaced
+__device__ bool route_update_valid(const LC::RouteUpdate &update,
+                                   const LC::Agent &info, ushort active,
+                                   bool in_queue) {
+  return active == 1 and info.route_offset == update.old_offset and
+         info.route_ptr == update.route_ptr and
+         (int(update.splice) > update.route_ptr + 1 or not in_queue);
+}
+
+//! Flag the updates whose new route still applies
+__global__ void kernel_checkRouteUpdates(uint numUpdates,
+                                         const LC::RouteUpdate *updates,
+                                         AgentsHot hot,
+                                         const LC::Agent *agents,
+                                         uchar *valid) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numUpdates) {
+    return;
+  }
+  const LC::RouteUpdate update = updates[i];
+  valid[i] = route_update_valid(update, agents[update.agent],
+                                hot.active[update.agent],
+                                hot.in_queue[update.agent]);
+}
+
+//! Switch the agents whose new route still applies
+__global__ void kernel_updateRoutes(uint numUpdates,
+                                    const LC::RouteUpdate *updates,
+                                    AgentsHot hot, LC::Agent *agents,
+                                    uchar *dirty, uint *count) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= numUpdates) {
+    return;
+  }
+  const LC::RouteUpdate update = updates[i];
+  auto &info = agents[update.agent];
+  if (route_update_valid(update, info, hot.active[update.agent],
+                         hot.in_queue[update.agent])) {
+    info.route_offset = update.route_offset;
+    info.route_size = update.route_size;
+    dirty[update.agent] = 1;
+    atomicAdd(count, 1);
+  }
+}
+
+void cuda_check_route_updates(const std::vector<LC::RouteUpdate> &updates,
+                              std::vector<uchar> &valid,
+                              int threadsPerBlock) {
+  valid.assign(updates.size(), 0);
+  if (updates.empty()) {
+    return;
+  }
+  LC::RouteUpdate *updates_d;
+  uchar *valid_d;
+  size_t sizeU = updates.size() * sizeof(LC::RouteUpdate);
+  gpuErrchk(cudaMalloc((void **)&updates_d, sizeU));
+  gpuErrchk(cudaMalloc((void **)&valid_d, updates.size() * sizeof(uchar)));
+  gpuErrchk(
+      cudaMemcpy(updates_d, updates.data(), sizeU, cudaMemcpyHostToDevice));
+  int blocks = (updates.size() + threadsPerBlock - 1) / threadsPerBlock;
+  kernel_checkRouteUpdates<<<blocks, threadsPerBlock>>>(
+      updates.size(), updates_d, hot_d, trafficPersonVec_d, valid_d);
+  gpuErrchk(cudaPeekAtLastError());
+  gpuErrchk(cudaMemcpy(valid.data(), valid_d, updates.size() * sizeof(uchar),
+                       cudaMemcpyDeviceToHost));
+  cudaFree(updates_d);
+  cudaFree(valid_d);
+}
+
+unsigned cuda_update_routes(std::vector<uint> &routes,
+                            const std::vector<LC::RouteUpdate> &updates,
+                            int threadsPerBlock) {
+  if (routes.size() > routesCapacity) { // grow geometrically
+    size_t capacity = std::max(routes.size(), 2 * routesCapacity);
+    uint *grown;
+    gpuErrchk(cudaMalloc((void **)&grown, capacity * sizeof(uint)));
+    gpuErrchk(cudaMemcpy(grown, indexPathVec_d, numRoutes * sizeof(uint),
+                         cudaMemcpyDeviceToDevice));
+    gpuErrchk(cudaFree(indexPathVec_d));
+    indexPathVec_d = grown;
+    routesCapacity = capacity;
+  }
+  gpuErrchk(cudaMemcpy(indexPathVec_d + numRoutes, routes.data() + numRoutes,
+                       (routes.size() - numRoutes) * sizeof(uint),
+                       cudaMemcpyHostToDevice));
+  numRoutes = routes.size();
+  if (updates.empty()) {
+    return 0;
+  }
+
+  LC::RouteUpdate *updates_d;
+  uint *count_d;
+  size_t sizeU = updates.size() * sizeof(LC::RouteUpdate);
+  gpuErrchk(cudaMalloc((void **)&updates_d, sizeU));
+  gpuErrchk(cudaMalloc((void **)&count_d, sizeof(uint)));
+  gpuErrchk(
+      cudaMemcpy(updates_d, updates.data(), sizeU, cudaMemcpyHostToDevice));
+  gpuErrchk(cudaMemset(count_d, 0, sizeof(uint)));
+  int blocks = (updates.size() + threadsPerBlock - 1) / threadsPerBlock;
+  kernel_updateRoutes<<<blocks, threadsPerBlock>>>(
+      updates.size(), updates_d, hot_d, trafficPersonVec_d, agentDirty_d,
+      count_d);
+  gpuErrchk(cudaPeekAtLastError());
+  uint applied = 0;
+  gpuErrchk(
+      cudaMemcpy(&applied, count_d, sizeof(uint), cudaMemcpyDeviceToHost));
+  cudaFree(updates_d);
+  cudaFree(count_d);
+  return applied;
+}
+
+//! Set the route offset of every agent
+__global__ void kernel_setRouteOffsets(uint numAgents, const uint *offsets,
+                                       LC::Agent *agents) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i < numAgents) {
+    agents[i].route_offset = offsets[i];
+  }
+}
+
+void cuda_set_routes(const std::vector<uint> &routes,
+                     const std::vector<LC::Agent> &agents,
+                     int threadsPerBlock) {
+  // a new array of the rebuilt size, the grown one is released
+  cudaFree(indexPathVec_d);
+  routesCapacity = std::max<size_t>(routes.size(), 1);
+  gpuErrchk(
+      cudaMalloc((void **)&indexPathVec_d, routesCapacity * sizeof(uint)));
+  gpuErrchk(cudaMemcpy(indexPathVec_d, routes.data(),
+                       routes.size() * sizeof(uint), cudaMemcpyHostToDevice));
+  numRoutes = routes.size();
+
+  // the host agents hold the same offsets, they are not marked dirty
+  std::vector<uint> offsets(agents.size());
+  for (size_t i = 0; i < agents.size(); ++i) {
+    offsets[i] = agents[i].route_offset;
+  }
+  uint *offsets_d;
+  gpuErrchk(cudaMalloc((void **)&offsets_d, offsets.size() * sizeof(uint)));
+  gpuErrchk(cudaMemcpy(offsets_d, offsets.data(),
+                       offsets.size() * sizeof(uint), cudaMemcpyHostToDevice));
+  int blocks = (agents.size() + threadsPerBlock - 1) / threadsPerBlock;
+  kernel_setRouteOffsets<<<blocks, threadsPerBlock>>>(agents.size(), offsets_d,
+                                                      trafficPersonVec_d);
+  gpuErrchk(cudaPeekAtLastError());
+  gpuErrchk(cudaDeviceSynchronize());
+  cudaFree(offsets_d);
+}
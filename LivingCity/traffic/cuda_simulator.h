@@ -13,9 +13,12 @@
 
 extern void init_cuda (
         bool fistInitialization, // crate buffers
-        std::vector<LC::Agent> &agents,
+        std::vector<LC::Agent> &agents, std::vector<uint> &routes,
         std::vector<LC::EdgeData> &edgesData, std::vector<uchar> &laneMap,
-        std::vector<LC::IntersectionData> &intersections);
+        std::vector<unsigned long long> &laneOccupancy,
+        std::vector<uint> &cellOffsets,
+        std::vector<LC::IntersectionData> &intersections,
+        std::vector<LC::MovementData> &movements, std::vector<int> &queuePool);
 
 
 
@@ -23,6 +26,43 @@ extern void cuda_get_data (std::vector<LC::Agent> &trafficPersonVec,
                            std::vector<LC::EdgeData> &edgesData,
                            std::vector<LC::IntersectionData> &intersections);
 
+// Delta transfer: cuda_stage_data compacts the agents and edges changed since
+// the last transfer and starts copying them on a separate stream, so the copy
+// overlaps the next cuda_simulate; cuda_get_staged_data waits for it and
+// writes the changed records into the host vectors.
+extern void cuda_stage_data (int threadsPerBlock);
+extern void cuda_get_staged_data (std::vector<LC::Agent> &trafficPersonVec,
+                                  std::vector<LC::EdgeData> &edgesData);
+
+// En-route rerouting data: cuda_stage_reroute lists the agents that can be
+// rerouted and the travel counters of every edge and starts copying them on
+// the same stream, so the copy overlaps the next cuda_simulate;
+// cuda_get_reroute_data waits for it and returns the lists.
+extern void cuda_stage_reroute (int threadsPerBlock);
+extern void cuda_get_reroute_data (
+        std::vector<LC::RerouteCandidate> &candidates,
+        std::vector<LC::EdgeTravel> &edges);
+
+// Check which new routes still apply between two steps: valid[i] is 1 if the
+// agent of updates[i] did not move on since it was rerouted
+extern void cuda_check_route_updates (
+        const std::vector<LC::RouteUpdate> &updates, std::vector<uchar> &valid,
+        int threadsPerBlock);
+
+// Switch agents to new routes between two steps: the entries appended to
+// routes since the last upload are copied (growing the device array when
+// needed) and the updates of agents that did not move on are applied on the
+// device. Returns the number of agents switched
+extern unsigned cuda_update_routes (std::vector<uint> &routes,
+                                    const std::vector<LC::RouteUpdate> &updates,
+                                    int threadsPerBlock);
+
+// Replace the device routes after routes was rebuilt: uploads it (releasing
+// the grown array) and the route offsets of the agents
+extern void cuda_set_routes (const std::vector<uint> &routes,
+                             const std::vector<LC::Agent> &agents,
+                             int threadsPerBlock);
+
 extern void finish_cuda (void);                     // free memory
 extern void cuda_simulate(float currentTime, uint numPeople, uint numIntersections,
                           float deltaTime, int numBlocks, int threadsPerBlock);
@@ -48,17 +48,51 @@ struct EdgeData {
   unsigned int period_cum_travel_steps{0};
 };
 
+//! EdgeTravel Class
+//! \brief Travel counters of an edge listed by the simulators for a
+//! rerouting round
+struct EdgeTravel {
+  //! EdgeData::downstream_veh_count
+  unsigned int downstream_veh_count{0};
+  //! EdgeData::period_cum_travel_steps
+  unsigned int period_cum_travel_steps{0};
+  //! longest time (steps) a vehicle still on the edge has spent on it
+  unsigned int wait_steps{0};
+};
+
+//! QueueData Class
+//! \brief Ring buffer of agent ids. The slots live in the queue pool shared by
+//! all intersections (Lanemap::queue_pool) starting at offset
+struct QueueData {
+  //! First slot of the queue in the pool
+  unsigned offset{0};
+  //! Number of slots
+  unsigned capacity{0};
+  //! Slot (relative to offset) of the agent at the front
+  unsigned head{0};
+  //! Number of agents in the queue
+  unsigned size{0};
+};
+
+//! MovementData Class
+//! \brief One movement (entering edge -> leaving edge) of an intersection and
+//! the queue of agents waiting for it
+struct MovementData {
+  //! Entering mid
+  unsigned start_edge;
+  //! Leaving mid
+  unsigned end_edge;
+  //! Agents waiting for the movement
+  QueueData queue;
+};
+
 //! IntersectionData Class
-//! \brief Data structure that hold essential information for a intersection
+//! \brief Data structure that hold essential information for a intersection.
+//! The movements of the intersection are stored contiguously in
+//! Lanemap::movements starting at movement_offset
 struct IntersectionData {
-  //! Potential queues (for each direction) in the intersection
-  int queue[100][10];
-  //! Entering eid for each queue
-  unsigned start_edge[100];
-  //! Leaving eid for each queue
-  unsigned end_edge[100];
-  //! Ptr position for each queue (number of cars in queue)
-  unsigned pos[100] = {0};
+  //! First movement of the intersection
+  unsigned movement_offset{0};
 
   unsigned short num_edge{0};
   unsigned short num_queue{0};
@@ -67,8 +101,7 @@ struct IntersectionData {
   unsigned short queue_ptr{0};
 
   //! virtual queue for initialization
-  int init_queue[1000] = {-1}; // +5 for safety
-  unsigned init_queue_rear{0};
+  QueueData init_queue;
 };
 
 // struct IntersectionData {
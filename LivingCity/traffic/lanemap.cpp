@@ -1,6 +1,7 @@
 #include "lanemap.h"
 #include "config.h"
 #include "sp/graph.h"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <ios>
@@ -8,74 +9,138 @@
 namespace LC {
 
 void Lanemap::create_edgesData_(const std::shared_ptr<abm::Graph> &graph) {
-  edgesData_.resize(graph->nedges() * 6); // 6 times for enough space
+  // one entry per edge, the lanemap cells of the edges follow each other
+  edgesData_.resize(graph->nedges());
+  cellOffsets_.assign(graph->nedges() + 1, 0);
 
-  int lanemap_idx = 0;
-  for (auto const &x : graph->edges_) {
-    auto edge_vertices = std::get<1>(x)->first;
-    auto edge_id =
-        graph->edge_ids_[std::get<0>(edge_vertices)][std::get<1>(edge_vertices)];
-    auto edge_val = std::get<1>(x)->second;
-    const int numLanes = edge_val[1];
+  for (abm::graph::edge_index_t edge = 0; edge < graph->nedges(); ++edge) {
+    const uint lanemap_idx = edge;
+    auto edge_id = graph->edge_id(edge);
+    const float length = graph->length(edge);
+    const int numLanes = graph->lanes(edge);
 
     if (numLanes == 0) {
       printf("Error! One edge has 0 lane.\n");
       abort();
     }
+    // the simulators sort vehicles by keys holding the lane and the meter of
+    // a vehicle in 16 bits each
+    if (length >= 0xFFFF || numLanes > 0xFFFF) {
+      printf("Error! Edge %lld is longer than 65534 m or has more than 65535 "
+             "lanes.\n",
+             static_cast<long long>(edge_id));
+      abort();
+    }
 
     edgesData_[lanemap_idx].eid = edge_id;
-    edgesData_[lanemap_idx].length = edge_val[0];
-    edgesData_[lanemap_idx].maxSpeedMperSec = edge_val[2];
+    edgesData_[lanemap_idx].length = length;
+    edgesData_[lanemap_idx].maxSpeedMperSec = graph->speed(edge);
 
     edgesData_[lanemap_idx].num_lanes = numLanes;
-    edgesData_[lanemap_idx].vertex[0] = std::get<0>(std::get<0>(x));
-    edgesData_[lanemap_idx].vertex[1] = std::get<1>(std::get<0>(x));
+    edgesData_[lanemap_idx].vertex[0] = graph->source(edge);
+    edgesData_[lanemap_idx].vertex[1] = graph->target(edge);
 
     mid2eid_[lanemap_idx] = edge_id;
     eid2mid_[edge_id] = lanemap_idx;
     const int numWidthNeeded =
-        ceil(edge_val[0] / kMaxMapWidthM_); // number of cells for each lane
-    lanemap_idx += numLanes * numWidthNeeded;
+        ceil(length / kMaxMapWidthM_); // number of cells for each lane
+    cellOffsets_[edge + 1] = cellOffsets_[edge] + numLanes * numWidthNeeded;
   }
 
-  edgesData_.resize(lanemap_idx);
+  edge_mids_.clear();
+  edge_mids_.reserve(eid2mid_.size());
+  for (const auto &eid_mid : eid2mid_) {
+    edge_mids_.emplace_back(eid_mid.second);
+  }
 }
 
 void Lanemap::create_LaneMap_() {
-  laneMap_.resize(kMaxMapWidthM_ * edgesData_.size() *
+  laneMap_.resize(kMaxMapWidthM_ * cellOffsets_.back() *
                   2); // 2: to have two maps.
   memset(laneMap_.data(), -1, laneMap_.size() * sizeof(unsigned char)); //
+  laneOccupancy_.assign(laneMap_.size() / 32, 0);
 }
 
 void Lanemap::create_intersections_(const std::shared_ptr<abm::Graph> &graph) {
-  intersections_.resize(graph->vertex_edges_.size()); // as many as vertices
-  for (const auto &vertex_edges : graph->vertex_in_edges_) {
-    auto vertex = std::get<0>(vertex_edges);
-    auto in_edges = std::get<1>(vertex_edges);
+  intersections_.resize(graph->nvertices()); // as many as vertices
+  movements_.clear();
+  movementQueueSlots_ = 0;
+  for (abm::graph::vertex_t vertex = 0; vertex < graph->nvertices();
+       ++vertex) {
+    const auto in_begin = graph->in_begin(vertex);
+    const auto in_end = graph->in_end(vertex);
+    if (in_begin == in_end) {
+      continue;
+    }
 
     auto &intersection = intersections_[vertex];
-    intersection.num_edge = 2 * in_edges.size();
-    for (const auto &in_edge : in_edges) {
-      for (const auto &out_edge : graph->vertex_out_edges_[vertex]) {
-        auto edge_id1 =
-            graph->edge_ids_[in_edge->first.first][in_edge->first.second];
-        auto lanemap_id1 = eid2mid_[edge_id1];
-
-        auto edge_id2 =
-            graph->edge_ids_[out_edge->first.first][out_edge->first.second];
-        auto lanemap_id2 = eid2mid_[edge_id2];
-
-        if ((in_edge->first.first == out_edge->first.second) &&
-            (in_edge->first.second == out_edge->first.first)) {
+    intersection.num_edge = 2 * (in_end - in_begin);
+    intersection.movement_offset = movements_.size();
+    for (auto i = in_begin; i < in_end; ++i) {
+      const auto in_edge = graph->in_edge(i);
+      auto lanemap_id1 = eid2mid_[graph->edge_id(in_edge)];
+      const auto &start_edge = edgesData_[lanemap_id1];
+      // vehicles the entering edge can hold, shared among its movements
+      unsigned storage =
+          ceil(start_edge.length / SOCIAL_DIST) * start_edge.num_lanes;
+      unsigned num_out = graph->out_degree(vertex);
+      unsigned capacity =
+          std::max(MOVEMENT_QUEUE_CAP, storage / std::max(num_out, 1u));
+
+      for (auto out_edge = graph->out_begin(vertex);
+           out_edge < graph->out_end(vertex); ++out_edge) {
+        auto lanemap_id2 = eid2mid_[graph->edge_id(out_edge)];
+
+        if (graph->source(in_edge) == graph->target(out_edge)) {
           continue; // skip turn around
         }
 
-        intersection.start_edge[intersection.num_queue] = lanemap_id1;
-        intersection.end_edge[intersection.num_queue] = lanemap_id2;
+        MovementData movement;
+        movement.start_edge = lanemap_id1;
+        movement.end_edge = lanemap_id2;
+        movement.queue.offset = movementQueueSlots_;
+        movement.queue.capacity = capacity;
+        movementQueueSlots_ += capacity;
+        movements_.emplace_back(movement);
         intersection.num_queue++;
       }
     }
   }
+  queuePool_.assign(movementQueueSlots_, -1);
+}
+
+void Lanemap::reset() {
+  for (auto &edge : edgesData_) {
+    edge.upstream_veh_count = 0;
+    edge.downstream_veh_count = 0;
+    edge.period_cum_travel_steps = 0;
+  }
+  std::fill(laneOccupancy_.begin(), laneOccupancy_.end(), 0);
+}
+
+void Lanemap::init_queues(const std::vector<Agent> &agents) {
+  std::vector<unsigned> num_origins(intersections_.size(), 0);
+  for (const auto &agent : agents) {
+    num_origins.at(agent.init_intersection) += 1;
+  }
+
+  unsigned slots = movementQueueSlots_;
+  for (unsigned i = 0; i < intersections_.size(); ++i) {
+    auto &intersection = intersections_[i];
+    intersection.max_queue = 0;
+    intersection.queue_ptr = 0;
+    intersection.init_queue.offset = slots;
+    intersection.init_queue.capacity =
+        std::max<unsigned>(INIT_QUEUE_CAP, num_origins[i]);
+    intersection.init_queue.head = 0;
+    intersection.init_queue.size = 0;
+    slots += intersection.init_queue.capacity;
+  }
+  for (auto &movement : movements_) {
+    movement.queue.head = 0;
+    movement.queue.size = 0;
+  }
+  queuePool_.assign(slots, -1);
 }
 
 } // namespace LC
@@ -3,6 +3,7 @@
 
 #include "config.h"
 #include "edge_data.h"
+#include "agent.h"
 #include "traffic/sp/graph.h"
 #include <QVector3D>
 #include <set>
@@ -25,14 +26,37 @@ public:
     create_intersections_(graph);
   };
 
+  //! Data of every edge, indexed by lanemap id
   std::vector<EdgeData> &edgesData() { return edgesData_; }
 
+  //! First lanemap cell (kMaxMapWidthM_ meters) of every edge by lanemap id,
+  //! and the number of cells at the end. The lanes of an edge follow each
+  //! other, each ceil(length / kMaxMapWidthM_) cells long
+  std::vector<uint> &cell_offsets() { return cellOffsets_; }
+
   std::vector<uchar> &lanemap_array() { return laneMap_; }
 
+  //! One bit per lanemap byte, set where a vehicle is. The speed bytes are
+  //! only valid where the bit is set. Every word holds 32 bits and, in its
+  //! upper half, the simulation step that set them
+  std::vector<unsigned long long> &occupancy_array() { return laneOccupancy_; }
+
   std::vector<IntersectionData> &intersections() {
     return intersections_;
   }
 
+  std::vector<MovementData> &movements() { return movements_; }
+
+  std::vector<int> &queue_pool() { return queuePool_; }
+
+  //! Size the init queues from the agents' origins and empty all queues
+  //! \param[in] agents agents to be simulated
+  void init_queues(const std::vector<Agent> &agents);
+
+  //! Clear the vehicle counters of the edges and empty the lanemap (clears
+  //! the occupancy bits)
+  void reset();
+
   const std::map<uint, abm::graph::edge_id_t> &mid2eid() const {
     return mid2eid_;
   }
@@ -41,22 +65,38 @@ public:
     return eid2mid_;
   }
 
+  //! Lanemap id of every edge in edge id order, the edge order of
+  //! Network::heads and Network::tails the routing graphs are built from
+  const std::vector<uint> &edge_mids() const { return edge_mids_; }
+
 private:
   std::vector<uchar> laneMap_;
+  std::vector<unsigned long long> laneOccupancy_;
   std::vector<EdgeData> edgesData_;
+  std::vector<uint> cellOffsets_;
   std::vector<IntersectionData> intersections_;
+  //! Movements of all intersections (contiguous per intersection)
+  std::vector<MovementData> movements_;
+  //! Slots of every queue (movement queues first, then init queues)
+  std::vector<int> queuePool_;
+  //! Number of pool slots used by the movement queues
+  unsigned movementQueueSlots_{0};
 
   //! A map that maps lanemap number to the corresponding edge object
   std::map<uint, abm::graph::edge_id_t> mid2eid_;
   //! A map that maps lanemap number to the corresponding edge object
   std::map<abm::graph::edge_id_t, uint> eid2mid_;
+  //! Lanemap id of every edge in edge id order
+  std::vector<uint> edge_mids_;
 
   //! Helper function that creates the edgeData. It parses the edges from the
   //! network and record the parsing sequence (id maps)
   void create_edgesData_(const std::shared_ptr<abm::Graph> &graph);
   //! Helper function that creates an empty lanemap (elements initialized as 1)
+  //! and its occupancy bits (all cleared)
   void create_LaneMap_();
-  //! Helper function that creates intersections
+  //! Helper function that creates intersections and their movements. Each
+  //! movement queue gets a share of the entering edge's storage
   void create_intersections_(const std::shared_ptr<abm::Graph> &graph);
 };
 } // namespace LC
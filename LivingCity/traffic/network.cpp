@@ -1,5 +1,10 @@
 #include "network.h"
+#include "binary_cache.h"
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <numeric>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 
@@ -7,58 +12,194 @@ namespace LC {
 
 using namespace std::chrono;
 
-Network::Network(const std::string &networkPath) {
+Network::Network(const std::string &networkPath, bool use_cache) {
   edgeFileName_ = networkPath + "edges.csv";
   nodeFileName_ = networkPath + "nodes.csv";
-  street_graph_ = std::make_shared<abm::Graph>(true, networkPath);
+  cacheFileName_ = networkPath + "network.bin";
+  cachePath_ = use_cache ? networkPath : "";
+  street_graph_ = std::make_shared<abm::Graph>(true);
 
-  loadABMGraph_();
+  if (!use_cache || !loadCachedABMGraph_()) {
+    loadABMGraph_(use_cache);
+  }
   init_edge_weights_();
 }
 
-void Network::loadABMGraph_() {
-  // EDGES
-  street_graph_->read_graph_osm(edgeFileName_);
-  // NODES
-  street_graph_->read_vertices(nodeFileName_);
+void Network::loadABMGraph_(bool save_cache) {
+  try {
+    // EDGES
+    const auto edges = abm::Graph::parse_edges_osm(edgeFileName_);
+    street_graph_->add_edges(edges.data(), edges.size());
+    // NODES
+    const auto vertices = abm::Graph::parse_vertices(nodeFileName_);
+    street_graph_->add_vertices(vertices.data(), vertices.size());
+
+    if (save_cache &&
+        !BinaryCache::write(cacheFileName_, {edgeFileName_, nodeFileName_},
+                            edges, vertices)) {
+      std::cout << "Could not write network cache " << cacheFileName_ << "\n";
+    }
+  } catch (std::exception &exception) {
+    std::cout << "Read network: " << exception.what() << "\n";
+    abort();
+  }
+}
+
+bool Network::loadCachedABMGraph_() {
+  BinaryCache cache;
+  if (!cache.open(cacheFileName_, {edgeFileName_, nodeFileName_})) {
+    return false;
+  }
+  std::cout << "loading network from " << cacheFileName_ << "\n";
+  street_graph_->add_edges(cache.section<abm::graph::EdgeRecord>(0),
+                           cache.size(0));
+  street_graph_->add_vertices(cache.section<abm::graph::VertexRecord>(1),
+                              cache.size(1));
+  return true;
 }
 
 std::vector<std::vector<long>> Network::edge_vertices() {
   std::vector<std::vector<long>> edge_vertices;
-  for (auto const &x : street_graph_->edge_ids_to_vertices) {
-    auto vertices = x.second;
-    std::vector<long> v = {std::get<0>(vertices), std::get<1>(vertices)};
-    edge_vertices.emplace_back(v);
+  edge_vertices.reserve(street_graph_->nedges());
+  for (abm::graph::edge_id_t eid = 0; eid < street_graph_->edge_id_bound();
+       ++eid) {
+    const auto edge = street_graph_->edge_index(eid);
+    if (edge != abm::graph::kInvalidEdge) {
+      edge_vertices.push_back(
+          {street_graph_->source(edge), street_graph_->target(edge)});
+    }
   }
   return edge_vertices;
 }
 
 std::vector<unsigned int> Network::heads() {
   std::vector<unsigned int> heads;
-  for (auto const &x : street_graph_->edge_ids_to_vertices) {
-    auto vertices = x.second;
-    heads.emplace_back(std::get<0>(vertices));
+  heads.reserve(street_graph_->nedges());
+  for (abm::graph::edge_id_t eid = 0; eid < street_graph_->edge_id_bound();
+       ++eid) {
+    const auto edge = street_graph_->edge_index(eid);
+    if (edge != abm::graph::kInvalidEdge) {
+      heads.emplace_back(street_graph_->source(edge));
+    }
   }
   return heads;
 }
 
 std::vector<unsigned int> Network::tails() {
   std::vector<unsigned int> tails;
-  for (auto const &x : street_graph_->edge_ids_to_vertices) {
-    auto vertices = x.second;
-    tails.emplace_back(std::get<1>(vertices));
+  tails.reserve(street_graph_->nedges());
+  for (abm::graph::edge_id_t eid = 0; eid < street_graph_->edge_id_bound();
+       ++eid) {
+    const auto edge = street_graph_->edge_index(eid);
+    if (edge != abm::graph::kInvalidEdge) {
+      tails.emplace_back(street_graph_->target(edge));
+    }
   }
   return tails;
 }
 
 void Network::init_edge_weights_() {
   std::vector<double> weights;
-  weights.reserve(street_graph_->edges_.size());
+  weights.reserve(street_graph_->nedges());
+  for (abm::graph::edge_id_t eid = 0; eid < street_graph_->edge_id_bound();
+       ++eid) {
+    const auto edge = street_graph_->edge_index(eid);
+    if (edge != abm::graph::kInvalidEdge) {
+      weights.emplace_back(street_graph_->weight(edge));
+    }
+  }
+  edge_weights_.assign(1, weights);
+  profile_starts_.assign(1, 0);
+}
 
-  for (auto const &x : street_graph_->edge_costs_) {
-    weights.emplace_back(x.second);
+void Network::load_weight_profiles(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    std::cerr << "Error: cannot open weight profile file " << filename
+              << std::endl;
+    abort();
   }
-  edge_weights_.emplace_back(weights);
+
+  // position of every edge id in the weight vectors
+  std::vector<unsigned> positions(street_graph_->edge_id_bound(), 0);
+  unsigned position = 0;
+  for (abm::graph::edge_id_t eid = 0; eid < street_graph_->edge_id_bound();
+       ++eid) {
+    if (street_graph_->edge_index(eid) != abm::graph::kInvalidEdge) {
+      positions[eid] = position++;
+    }
+  }
+
+  auto split = [](const std::string &line) {
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, ',')) {
+      if (!field.empty() && field.back() == '\r') {
+        field.pop_back();
+      }
+      fields.emplace_back(field);
+    }
+    return fields;
+  };
+
+  std::string line;
+  std::getline(file, line);
+  const auto header = split(line);
+  if (header.size() < 2 || header[0] != "uniqueid") {
+    std::cerr << "Error: weight profile file " << filename
+              << " needs a uniqueid column followed by the profiles"
+              << std::endl;
+    abort();
+  }
+  // profiles sorted by start time
+  std::vector<float> starts;
+  for (std::size_t i = 1; i < header.size(); ++i) {
+    starts.emplace_back(std::stof(header[i]));
+  }
+  std::vector<std::size_t> columns(starts.size());
+  std::iota(columns.begin(), columns.end(), 0);
+  std::stable_sort(columns.begin(), columns.end(),
+                   [&starts](std::size_t a, std::size_t b) {
+                     return starts[a] < starts[b];
+                   });
+
+  init_edge_weights_();
+  std::vector<std::vector<double>> weights(starts.size(),
+                                           edge_weights_.front());
+  profile_starts_.clear();
+  for (const auto column : columns) {
+    profile_starts_.emplace_back(starts[column]);
+  }
+
+  while (std::getline(file, line)) {
+    const auto fields = split(line);
+    if (fields.size() < header.size()) {
+      continue;
+    }
+    const auto eid = std::stoul(fields[0]);
+    if (eid >= positions.size() ||
+        street_graph_->edge_index(eid) == abm::graph::kInvalidEdge) {
+      continue;
+    }
+    for (std::size_t p = 0; p < columns.size(); ++p) {
+      const double time = std::stod(fields[columns[p] + 1]);
+      // the CH needs positive weights
+      if (time > 0) {
+        weights[p][positions[eid]] = time;
+      }
+    }
+  }
+  edge_weights_.swap(weights);
+  std::cout << "Loaded " << edge_weights_.size() << " weight profiles from "
+            << filename << std::endl;
+}
+
+unsigned Network::profile(float time) const {
+  const auto next = std::upper_bound(profile_starts_.begin(),
+                                     profile_starts_.end(), time);
+  return next == profile_starts_.begin() ? 0
+                                         : next - profile_starts_.begin() - 1;
 }
 
 } // namespace LC
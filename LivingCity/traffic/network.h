@@ -9,7 +9,8 @@ class Network {
 public:
   // Constructor with network path
   //! \param[in] networkPath network file path
-  Network(const std::string &networkPath);
+  //! \param[in] use_cache load from / save to the binary network cache
+  Network(const std::string &networkPath, bool use_cache = true);
 
   //! Destructor
   ~Network() = default;
@@ -25,31 +26,65 @@ public:
   //! \retval edge id
   abm::graph::vertex_t edge_id(abm::graph::vertex_t v1,
                                abm::graph::vertex_t v2) {
-    return street_graph_->edge_ids_[v1][v2];
+    return street_graph_->edge_id(v1, v2);
   }
 
+  //! Edge weights for route finding, one vector (in edge id order) per
+  //! time-of-day profile. Without profiles the only weights are the free
+  //! flow travel times
   std::vector<std::vector<double>> edge_weights() { return edge_weights_; };
 
-  abm::graph::vertex_t num_edges() { return street_graph_->edges_.size(); }
+  //! Replace the edge weights by time-of-day profiles read from a csv file
+  //! with a uniqueid column followed by one travel time (s) column per
+  //! profile, named by the time (s) the profile starts at. Edges missing from
+  //! the file keep their free flow time
+  //! \param[in] filename profile file
+  void load_weight_profiles(const std::string &filename);
+
+  //! Number of weight profiles
+  unsigned num_profiles() const { return edge_weights_.size(); }
+
+  //! Profile used at a time: the last profile starting at or before it
+  //! \param[in] time time of day (s)
+  unsigned profile(float time) const;
+
+  //! directory for cached preprocessing of the network (empty when caching
+  //! is disabled)
+  const std::string &cache_path() const { return cachePath_; }
+
+  abm::graph::vertex_t num_edges() { return street_graph_->nedges(); }
 
   int num_vertices() { return street_graph_->vertices_data_.size(); }
 
+  //! Vertices of every edge, ordered by edge id
   std::vector<std::vector<long>> edge_vertices();
 
+  //! Source vertex of every edge, ordered by edge id
   std::vector<unsigned int> heads();
 
+  //! Target vertex of every edge, ordered by edge id
   std::vector<unsigned int> tails();
 
 private:
   std::string edgeFileName_;
   std::string nodeFileName_;
+  //! binary cache of the parsed edge and node files
+  std::string cacheFileName_;
+  //! directory of the cache files (empty when caching is disabled)
+  std::string cachePath_;
   //! abm street graph (base graph for the network, defined in the sp folder)
   std::shared_ptr<abm::Graph> street_graph_;
-  //! edge weights for route finding
+  //! edge weights for route finding (one vector per profile)
   std::vector<std::vector<double>> edge_weights_;
+  //! start time of every profile, ascending
+  std::vector<float> profile_starts_{0};
 
-  //! initialize abm graph (the base graph)
-  void loadABMGraph_();
+  //! initialize abm graph (the base graph) from the csv files
+  //! \param[in] save_cache write the parsed files to the binary cache
+  void loadABMGraph_(bool save_cache);
+  //! initialize abm graph from the binary cache
+  //! \retval status false if there is no valid cache
+  bool loadCachedABMGraph_();
   //! initialize edge weights (free flow time)
   void init_edge_weights_();
 };
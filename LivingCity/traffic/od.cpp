@@ -1,73 +1,205 @@
 #include "od.h"
-#include "network.h"
+#include "binary_cache.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace LC {
-LC::OD::OD(const std::string &odFileName) {
-  auto od_pairs = read_od_pairs_(odFileName);
-  auto dep_times = read_dep_times_(odFileName);
-  auto agent_types = read_agent_types_(odFileName);
-  num_agents_ = od_pairs.size();
-
-  for (int j = 0; j < num_agents_; ++j) {
-    auto od_pair = od_pairs[j];
-    auto agent_type = agent_types[j];
-    auto dep_time = dep_times[j];
-    Agent agent(od_pair[0], od_pair[1], agent_type, dep_time);
-    agents_.emplace_back(agent);
+
+namespace {
+//! Files smaller than this are parsed on a single thread
+const std::size_t kParallelParseBytes{1 << 20};
+
+//! Whether a line holds no data (empty or only a carriage return)
+bool blank_line(const char *begin, const char *end) {
+  return begin == end || (end - begin == 1 && *begin == '\r');
+}
+
+//! End of the line starting at begin (position of '\n' or end)
+const char *line_end(const char *begin, const char *end) {
+  return std::find(begin, end, '\n');
+}
+} // namespace
+
+LC::OD::OD(const std::string &odFileName, bool use_cache) {
+  if (!use_cache || !load_cached_agents_(odFileName)) {
+    load_agents_(odFileName, use_cache);
   }
+  num_agents_ = agents_.size();
 }
 
-std::vector<std::vector<unsigned int>>
-OD::read_od_pairs_(const std::string &odFileName) {
-  std::vector<std::vector<unsigned int>> od_pairs;
-  try {
-    csvio::CSVReader<2> in(odFileName);
-    in.read_header(csvio::ignore_extra_column, "origin", "destination");
-    abm::graph::vertex_t v1, v2;
-
-    while (in.read_row(v1, v2)) {
-      std::vector<unsigned int> od = {v1, v2};
-      od_pairs.emplace_back(od);
+void OD::load_agents_(const std::string &odFileName, bool save_cache) {
+  // read the whole file, rows are then parsed in place from the buffer
+  std::string buffer;
+  {
+    std::ifstream file(odFileName, std::ios::binary | std::ios::ate);
+    if (!file) {
+      std::cout << "Read OD file: cannot open " << odFileName << "\n";
+      abort();
+    }
+    buffer.resize(file.tellg());
+    file.seekg(0);
+    file.read(&buffer[0], buffer.size());
+  }
+  const char *begin = buffer.c_str();
+  const char *end = begin + buffer.size();
+
+  // header: origin, destination, dep_time and an optional type column
+  const char *body = line_end(begin, end);
+  const auto columns = read_columns_(begin, body);
+  if (body != end) {
+    ++body;
+  }
+
+  // split the body into chunks at line boundaries
+  int num_chunks = 1;
+#ifdef _OPENMP
+  if (buffer.size() >= kParallelParseBytes) {
+    num_chunks = 4 * omp_get_max_threads();
+  }
+#endif
+  std::vector<const char *> bounds(num_chunks + 1, end);
+  bounds[0] = body;
+  for (int c = 1; c < num_chunks; ++c) {
+    const char *split = body + (end - body) * c / num_chunks;
+    split = line_end(std::max(split, bounds[c - 1]), end);
+    bounds[c] = split == end ? end : split + 1;
+  }
+
+  // count the rows of every chunk to find where its agents start
+  std::vector<std::size_t> offsets(num_chunks + 1, 0);
+#pragma omp parallel for schedule(dynamic)
+  for (int c = 0; c < num_chunks; ++c) {
+    std::size_t rows = 0;
+    for (const char *line = bounds[c]; line < bounds[c + 1];) {
+      const char *eol = line_end(line, bounds[c + 1]);
+      rows += !blank_line(line, eol);
+      line = eol + 1;
+    }
+    offsets[c + 1] = rows;
+  }
+  for (int c = 0; c < num_chunks; ++c) {
+    offsets[c + 1] += offsets[c];
+  }
+
+  // construct the agents in place
+  agents_.resize(offsets[num_chunks]);
+#pragma omp parallel for schedule(dynamic)
+  for (int c = 0; c < num_chunks; ++c) {
+    std::size_t j = offsets[c];
+    for (const char *line = bounds[c]; line < bounds[c + 1];) {
+      const char *eol = line_end(line, bounds[c + 1]);
+      if (!blank_line(line, eol)) {
+        read_row_(line, eol, columns, agents_[j]);
+        ++j;
+      }
+      line = eol + 1;
+    }
+  }
+
+  if (save_cache) {
+    std::vector<ODRecord> records;
+    records.reserve(agents_.size());
+    for (const auto &agent : agents_) {
+      records.push_back({agent.init_intersection, agent.end_intersection,
+                         agent.time_departure,
+                         static_cast<unsigned int>(agent.agent_type)});
+    }
+    if (!BinaryCache::write(odFileName + ".bin", {odFileName}, records)) {
+      std::cout << "Could not write od cache " << odFileName << ".bin\n";
     }
-    return od_pairs;
-  } catch (std::exception &exception) {
-    std::cout << "Read OD pairs: " << exception.what() << "\n";
-    abort();
   }
 }
 
-std::vector<float> OD::read_dep_times_(const std::string &odFileName) {
-  std::vector<float> dep_times;
-  try {
-    csvio::CSVReader<1> in(odFileName);
-    in.read_header(csvio::ignore_extra_column, "dep_time");
-    float dep_time;
-    while (in.read_row(dep_time)) {
-      // printf("dep time %f\n", dep_time);
-      dep_times.emplace_back(dep_time);
+OD::Columns OD::read_columns_(const char *begin, const char *end) {
+  Columns columns;
+  int index = 0;
+  for (const char *field = begin; field <= end; ++index) {
+    const char *next = std::find(field, end, ',');
+    std::string name(field, next);
+    name.erase(std::remove_if(name.begin(), name.end(),
+                              [](char c) {
+                                return c == '"' || c == '\r' || c == ' ';
+                              }),
+               name.end());
+    if (name == "origin") {
+      columns.origin = index;
+    } else if (name == "destination") {
+      columns.destination = index;
+    } else if (name == "dep_time") {
+      columns.dep_time = index;
+    } else if (name == "type" || name == "agent_type") {
+      columns.type = index;
     }
-    return dep_times;
-  } catch (std::exception &exception) {
-    std::cout << "Read departure time: " << exception.what() << "\n";
+    field = next + 1;
+  }
+  columns.count = index;
+
+  if (columns.origin < 0 || columns.destination < 0 || columns.dep_time < 0) {
+    std::cout << "Read OD file: missing origin, destination or dep_time column"
+              << "\n";
     abort();
   }
+  return columns;
 }
 
-std::vector<AgentType> OD::read_agent_types_(const std::string &odFileName) {
-  std::vector<AgentType> types;
-  try {
-    csvio::CSVReader<1> in(odFileName);
-    in.read_header(csvio::ignore_extra_column, "dep_time");
-    float dep_time;
-    while (in.read_row(dep_time)) {
-      // printf("dep time %f\n", dep_time);
-      types.emplace_back(CAR);
+void OD::read_row_(const char *begin, const char *end, const Columns &columns,
+                   Agent &agent) {
+  unsigned int origin = 0, destination = 0;
+  float dep_time = 0;
+  int found = 0;
+  const char *field = begin;
+  for (int index = 0; index < columns.count && field <= end; ++index) {
+    char *parsed = const_cast<char *>(field);
+    if (index == columns.origin) {
+      origin = std::strtoull(field, &parsed, 10);
+    } else if (index == columns.destination) {
+      destination = std::strtoull(field, &parsed, 10);
+    } else if (index == columns.dep_time) {
+      dep_time = std::strtof(field, &parsed);
+    } else if (index == columns.type) {
+      // only cars have IDM parameters (see Agent)
+      const long value = std::strtol(field, &parsed, 10);
+      if (parsed != field && parsed <= end && value != CAR) {
+        std::cout << "Read OD file: unknown agent type " << value
+                  << " in row \"" << std::string(begin, end) << "\"\n";
+        abort();
+      }
+    }
+    // a value must be read from this row's field (strto* skip newlines)
+    if (parsed > end) {
+      break;
     }
-    return types;
-  } catch (std::exception &exception) {
-    std::cout << "Read agent type: " << exception.what() << "\n";
+    if (parsed != field && index != columns.type) {
+      ++found;
+    }
+    field = std::find(static_cast<const char *>(parsed), end, ',') + 1;
+  }
+  if (found != 3) {
+    std::cout << "Read OD file: malformed row \"" << std::string(begin, end)
+              << "\"\n";
     abort();
   }
+  agent = Agent(origin, destination, CAR, dep_time);
+}
+
+bool OD::load_cached_agents_(const std::string &odFileName) {
+  BinaryCache cache;
+  if (!cache.open(odFileName + ".bin", {odFileName})) {
+    return false;
+  }
+  const auto *records = cache.section<ODRecord>(0);
+  const std::size_t num_agents = cache.size(0);
+  agents_.reserve(num_agents);
+  for (std::size_t j = 0; j < num_agents; ++j) {
+    agents_.emplace_back(records[j].origin, records[j].destination,
+                         static_cast<AgentType>(records[j].type),
+                         records[j].dep_time);
+  }
+  return true;
 }
 
 } // namespace LC
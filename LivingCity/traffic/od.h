@@ -9,13 +9,22 @@
 #include "config.h"
 
 namespace LC {
+//! OD record as stored in the binary OD cache
+struct ODRecord {
+  unsigned int origin;
+  unsigned int destination;
+  float dep_time;
+  unsigned int type;
+};
+
 //! Origin Destination Class
 //! \brief Base class for origin and destination (encoded as agents)
 class OD {
 public:
   // Constructor with odfile path
   //! \param[in] odFileName od file path
-  explicit OD(const std::string &odFileName);
+  //! \param[in] use_cache load from / save to the binary od cache
+  explicit OD(const std::string &odFileName, bool use_cache = true);
 
   //! Destructor
   ~OD() = default;
@@ -32,21 +41,40 @@ private:
 
   unsigned int num_agents_;
 
-  //! Parse OD pairs from the input file
+  //! Create agents from the od file in a single parallel pass
   //! \param[in] odFileName od file path
-  //! \retval vector of od pairs
-  std::vector<std::vector<unsigned int>>
-  read_od_pairs_(const std::string &odFileName);
+  //! \param[in] save_cache write the parsed od pairs to the binary cache
+  void load_agents_(const std::string &odFileName, bool save_cache);
 
-  //! Parse departure times from the input file
+  //! Create agents from the binary od cache
   //! \param[in] odFileName od file path
-  //! \retval vector of departure times
-  std::vector<float> read_dep_times_(const std::string &odFileName);
+  //! \retval status false if there is no valid cache
+  bool load_cached_agents_(const std::string &odFileName);
 
-  //! Parse agent types from the input file
-  //! \param[in] odFileName od file path
-  //! \retval vector of agent types
-  std::vector<AgentType> read_agent_types_(const std::string &odFileName);
+  //! Position of the used columns in the od file
+  struct Columns {
+    int origin{-1};
+    int destination{-1};
+    int dep_time{-1};
+    //! optional agent type column (all agents are cars without it)
+    int type{-1};
+    //! number of columns in the header
+    int count{0};
+  };
+
+  //! Parse the header of the od file
+  //! \param[in] begin start of the header line
+  //! \param[in] end end of the header line
+  //! \retval columns position of the used columns
+  static Columns read_columns_(const char *begin, const char *end);
+
+  //! Parse one row of the od file into an agent
+  //! \param[in] begin start of the row
+  //! \param[in] end end of the row
+  //! \param[in] columns position of the used columns
+  //! \param[out] agent agent constructed from the row
+  static void read_row_(const char *begin, const char *end,
+                        const Columns &columns, Agent &agent);
 };
 
 } // namespace LC
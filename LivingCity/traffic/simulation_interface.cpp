@@ -20,6 +20,20 @@ void SimulationInterface::run_simulation() {
   const float end = settings.value("END", 12 * 3600).toFloat();
   const bool showBenchmarks = settings.value("SHOW_BENCHMARKS", false).toBool();
   const int save_interval = settings.value("SAVE_INTERVAL", 100).toInt();
+  const bool use_cpu = settings.value("USE_CPU", false).toBool();
+  const int cpu_threads = settings.value("CPU_THREADS", 0).toInt();
+  const bool use_binary_cache =
+      settings.value("USE_BINARY_CACHE", true).toBool();
+  std::string weight_profiles_path =
+      settings.value("WEIGHT_PROFILES", "").toString().toStdString();
+  const int assignment_iterations =
+      settings.value("ASSIGNMENT_ITERATIONS", 1).toInt();
+  const float reroute_fraction =
+      settings.value("REROUTE_FRACTION", 0.2).toFloat();
+  const int en_route_interval =
+      settings.value("EN_ROUTE_INTERVAL", 0).toInt();
+  const unsigned en_route_batch =
+      settings.value("EN_ROUTE_BATCH", 1000).toUInt();
   std::string od_path =
       settings
           .value("OD_PATH",
@@ -43,8 +57,11 @@ void SimulationInterface::run_simulation() {
   /************************************************************************************************
     Network Building
   ************************************************************************************************/
-  std::shared_ptr<Network> network = std::make_shared<LC::Network>(networkPath);
-  std::shared_ptr<OD> od = std::make_shared<LC::OD>(od_path);
+  std::shared_ptr<Network> network = std::make_shared<LC::Network>(networkPath, use_binary_cache);
+  if (!weight_profiles_path.empty()) {
+    network->load_weight_profiles(weight_profiles_path);
+  }
+  std::shared_ptr<OD> od = std::make_shared<LC::OD>(od_path, use_binary_cache);
   std::shared_ptr<Lanemap> lanemap =
       std::make_shared<LC::Lanemap>(network->street_graph());
 
@@ -52,6 +69,15 @@ void SimulationInterface::run_simulation() {
     Start Simulation
   ************************************************************************************************/
   TrafficSimulator simulator(network, od, lanemap, save_path);
-  simulator.simulateInGPU(start, end, save_interval);
+  simulator.set_en_route_rerouting(en_route_interval, en_route_batch);
+  if (assignment_iterations > 1) {
+    simulator.simulateAssignment(start, end, save_interval,
+                                 assignment_iterations, reroute_fraction,
+                                 use_cpu, cpu_threads);
+  } else if (use_cpu) {
+    simulator.simulateInCPU(start, end, save_interval, cpu_threads);
+  } else {
+    simulator.simulateInGPU(start, end, save_interval);
+  }
 }
 } // namespace LC
@@ -1,195 +1,119 @@
 #include "graph.h"
+#include <numeric>
 #include <string>
 
-// Add edge
-inline void
-abm::Graph::add_edge(abm::graph::vertex_t vertex1, abm::graph::vertex_t vertex2,
-                     std::vector<float> edge_vals,
-                     abm::graph::vertex_t edgeid) {
-  abm::graph::weight_t weight = edge_vals[0] / edge_vals[2]; // travel time
-  /*
-  abm::graph::weight_t weight = 1,
-  abm::graph::vertex_t edgeid =
-      std::numeric_limits<abm::graph::vertex_t>::max(), int lanes = 2, int
-  speed_mph = 30) {
-  */
-  // Create a map of vertices
-  if (vertices_.find(vertex1) == vertices_.end())
-    vertices_[vertex1] = vertices_.size();
-  if (vertices_.find(vertex2) == vertices_.end())
-    vertices_[vertex2] = vertices_.size();
-
-  // Create an edge
-  auto edge = std::make_shared<Graph::Edge>(
-      // std::make_pair(std::make_pair(std::make_pair(std::make_pair(vertex1,
-      // vertex2), weight), lanes), speed_mph));
-      std::make_pair(std::make_pair(vertex1, vertex2), edge_vals));
-  // printf("edge vertex 1 = %lld, vertex 2 = %lld, weight = %f\n",
-  // edge->first.first, edge->first.second, edge->second); std::cout << "weight =
-  // " << edge->second[0] << "lane_num = " << edge->second[1] << "speed = " <<
-  // edge->second[2] << "\n";
-  edges_[std::make_tuple(vertex1, vertex2)] = edge;
-  edge_pointer_to_vertices_[edge] = std::make_tuple(vertex1, vertex2);
-
-  // Add edge id
-  edge_ids_[vertex1][vertex2] = edgeid;
-  edge_ids_to_vertices[edgeid] = std::make_tuple(vertex1, vertex2);
-  // Add edge cost
-  edge_costs_[edgeid] = weight;
-
-  // Vertex 1
-  auto vertex1_edges = vertex_edges_[vertex1];
-  vertex1_edges.emplace_back(edge);
-  vertex_edges_[vertex1] =
-      std::vector<std::shared_ptr<Graph::Edge>>(vertex1_edges);
-
-  // Vertex 2
-  auto vertex2_edges = vertex_edges_[vertex2];
-  vertex2_edges.emplace_back(edge);
-  vertex_edges_[vertex2] =
-      std::vector<std::shared_ptr<Graph::Edge>>(vertex2_edges);
-
-  // out edges vertex 1
-  auto vertex1_out_edges = vertex_out_edges_[vertex1];
-  vertex1_out_edges.emplace_back(edge);
-  vertex_out_edges_[vertex1] =
-      std::vector<std::shared_ptr<Graph::Edge>>(vertex1_out_edges);
-  // in edges vertex 2
-  auto vertex2_in_edges = vertex_in_edges_[vertex2];
-  vertex2_in_edges.emplace_back(edge);
-  vertex_in_edges_[vertex2] =
-      std::vector<std::shared_ptr<Graph::Edge>>(vertex2_in_edges);
-}
-
-// Update edge
-void abm::Graph::update_edge(abm::graph::vertex_t vertex1,
-                             abm::graph::vertex_t vertex2,
-                             abm::graph::weight_t weight) {
-  // Get pointer to specified edge connecting vertex 1 and 2
-  auto edge = edges_.at(std::make_tuple(vertex1, vertex2));
-  // Update edge weight
-  edge->second[0] = weight;
-  // std::cout << "weight = " << std::get<1>(x) << "\n";
+// Parse OSM edge file
+std::vector<abm::graph::EdgeRecord>
+abm::Graph::parse_edges_osm(const std::string &filename) {
+  std::vector<graph::EdgeRecord> edges;
+  csvio::CSVReader<8> in(filename);
+  in.read_header(csvio::ignore_extra_column, "uniqueid", "osmid_u", "osmid_v",
+                 "edge_length", "lanes", "speed_mph", "u", "v");
+  graph::EdgeRecord edge;
+  abm::graph::vertex_t osmid_v1, osmid_v2;
+  while (in.read_row(edge.uniqueid, osmid_v1, osmid_v2, edge.length,
+                     edge.lanes, edge.speed_mph, edge.u, edge.v)) {
+    edges.emplace_back(edge);
+  }
+  return edges;
 }
 
-// Remove edge
-void abm::Graph::remove_edge(abm::graph::vertex_t vertex1,
-                             abm::graph::vertex_t vertex2) {
-  auto edge = edges_[std::make_tuple(vertex1, vertex2)];
-  edges_.erase(edges_.find(std::make_tuple(vertex1, vertex2)));
-
-  auto v1edge = vertex_edges_.at(vertex1);
-  auto v2edge = vertex_edges_.at(vertex2);
-
-  v1edge.erase(std::remove(v1edge.begin(), v1edge.end(), edge));
-  v2edge.erase(std::remove(v2edge.begin(), v2edge.end(), edge));
-
-  vertex_edges_[vertex1] = v1edge;
-  vertex_edges_[vertex2] = v2edge;
-}
-/*
-// Read MatrixMarket graph file format
-bool abm::Graph::read_graph_matrix_market(const std::string& filename) {
-  bool status = true;
-  try {
-    std::fstream file;
-    file.open(filename.c_str(), std::ios::in);
-    if (file.is_open() && file.good()) {
-      // Line
-      std::string line;
-      bool header = true;
-      double ignore;
-      while (std::getline(file, line)) {
-        std::istringstream istream(line);
-        int v1, v2;
-        double weight;
-        unsigned nvertices;
-        // ignore comment lines (# or !) or blank lines
-        if ((line.find('#') == std::string::npos) &&
-            (line.find('%') == std::string::npos) && (line != "")) {
-          if (header) {
-            // Ignore header
-            istream >> nvertices;
-            while (istream.good()) istream >> ignore;
-            header = false;
-            this->assign_nvertices(nvertices + 1);
-          }
-          while (istream.good()) {
-            // Read vertices edges and weights
-            istream >> v1 >> v2 >> weight;
-            this->add_edge(v1, v2, weight);
-          }
-        }
-      }
-      std::cout << "Graph summary #edges: " << this->edges_.size()
-                << " #vertices: " << this->nvertices_ << "\n";
-    } else {
-      throw std::runtime_error("Input file not found");
-    }
-  } catch (std::exception& exception) {
-    std::cout << "Read matrix market file: " << exception.what() << "\n";
-    status = false;
+// Parse node file
+std::vector<abm::graph::VertexRecord>
+abm::Graph::parse_vertices(const std::string &filename) {
+  std::vector<graph::VertexRecord> vertices;
+  csvio::CSVReader<6> in(filename);
+  in.read_header(csvio::ignore_extra_column, "osmid", "x", "y", "ref",
+                 "highway", "index");
+  graph::VertexRecord vertex;
+  std::string ref, highway;
+  while (in.read_row(vertex.osmid, vertex.x, vertex.y, ref, highway,
+                     vertex.index)) {
+    vertices.emplace_back(vertex);
   }
-  return status;
+  return vertices;
 }
-*/
-// Read MatrixMarket graph file format
-bool abm::Graph::read_graph_osm(const std::string &filename) {
-  bool status = true;
-  std::cout << "reading graph osm" << std::endl;
-  try {
-    csvio::CSVReader<8> in(filename);
-    in.read_header(csvio::ignore_extra_column, "uniqueid", "osmid_u", "osmid_v",
-                   "edge_length", "lanes", "speed_mph", "u", "v");
-    std::vector<float> edge_vals(3);
-    abm::graph::vertex_t nvertices = 0;
-    float length, lanes, speed_mph;
-    // int lanes, speed_mph;
-    // while (in.read_row(edgeid, v1, v2, weight, lanes, speed_mph)) {
-    // while (in.read_row(edgeid, v1, v2, edge_vals[0], edge_vals[1],
-    // edge_vals[2])) {
-    abm::graph::vertex_t index = 0;
-    abm::graph::edge_id_t edgeid;
-    abm::graph::vertex_t osmid_v1, osmid_v2, v1, v2;
-    while (in.read_row(edgeid, osmid_v1, osmid_v2, length, lanes, speed_mph, v1,
-                       v2)) {
-
-      edge_vals[0] = length;
-      edge_vals[1] = lanes;
-      edge_vals[2] =
-          (speed_mph / 3600) * 1609.34; // convert from mph to meters/second
-
-      // Don't add if there is already an edge with the same vertices
-      if (edges_.find(std::make_pair(v1, v2)) == edges_.end()) {
-        if (this->edge_ids_.size() <= v1) {
-          std::cout << v1 << " is bigger than the size, which is "
-                    << this->edge_ids_.size() << std::endl;
-        }
-        this->add_edge(v1, v2, edge_vals, edgeid);
-        if (!this->directed_)
-          this->add_edge(v2, v1, edge_vals, edgeid);
-      }
-      ++nvertices;
-
-      // map edge vertex ids to smaller values
-      edge_vertex_map_[v1] = index;
-      // std::cout << "v1 map = " << edge_vertex_map_[v1] << "\n";
-      ++index;
-    }
-    std::cout << "total edges = " << index << "\n";
 
-    this->assign_nvertices(nvertices);
-    std::cout << "# of edges: " << this->edges_.size() << "\n";
-
-  } catch (std::exception &exception) {
-    std::cout << "Read OSM file: " << exception.what() << "\n";
-    status = false;
+// Build CSR arrays from parsed edges
+void abm::Graph::add_edges(const abm::graph::EdgeRecord *edges,
+                           std::size_t nedges) {
+  // both directions of an undirected edge share the record
+  struct Arc {
+    graph::vertex_t u, v;
+    const graph::EdgeRecord *record;
+  };
+  std::vector<Arc> arcs;
+  arcs.reserve(this->directed_ ? nedges : 2 * nedges);
+  graph::vertex_t nvertices = 0;
+  graph::edge_id_t max_edge_id = -1;
+  for (std::size_t i = 0; i < nedges; ++i) {
+    const auto &edge = edges[i];
+    arcs.push_back({edge.u, edge.v, &edge});
+    if (!this->directed_)
+      arcs.push_back({edge.v, edge.u, &edge});
+    nvertices = std::max({nvertices, edge.u + 1, edge.v + 1});
+    max_edge_id = std::max(max_edge_id, edge.uniqueid);
   }
 
-  return status;
+  // a single sort by (u, v) orders the edges for the CSR, the sort is stable
+  // so the first of repeated (u, v) edges is kept
+  std::stable_sort(arcs.begin(), arcs.end(),
+                   [](const Arc &left, const Arc &right) {
+                     return std::tie(left.u, left.v) <
+                            std::tie(right.u, right.v);
+                   });
+  arcs.erase(std::unique(arcs.begin(), arcs.end(),
+                         [](const Arc &left, const Arc &right) {
+                           return left.u == right.u && left.v == right.v;
+                         }),
+             arcs.end());
+
+  const graph::edge_index_t narcs = arcs.size();
+  sources_.resize(narcs);
+  targets_.resize(narcs);
+  edge_ids_.resize(narcs);
+  lengths_.resize(narcs);
+  lanes_.resize(narcs);
+  speeds_.resize(narcs);
+  weights_.resize(narcs);
+  edge_index_.assign(max_edge_id + 1, graph::kInvalidEdge);
+  out_offsets_.assign(nvertices + 1, 0);
+  in_offsets_.assign(nvertices + 1, 0);
+  for (graph::edge_index_t e = 0; e < narcs; ++e) {
+    const auto &arc = arcs[e];
+    sources_[e] = arc.u;
+    targets_[e] = arc.v;
+    edge_ids_[e] = arc.record->uniqueid;
+    lengths_[e] = arc.record->length;
+    lanes_[e] = arc.record->lanes;
+    // convert from mph to meters/second
+    speeds_[e] = (arc.record->speed_mph / 3600) * 1609.34;
+    weights_[e] = lengths_[e] / speeds_[e]; // travel time
+    if (edge_index_[arc.record->uniqueid] == graph::kInvalidEdge)
+      edge_index_[arc.record->uniqueid] = e;
+    ++out_offsets_[arc.u + 1];
+    ++in_offsets_[arc.v + 1];
+  }
+  std::partial_sum(out_offsets_.begin(), out_offsets_.end(),
+                   out_offsets_.begin());
+  std::partial_sum(in_offsets_.begin(), in_offsets_.end(),
+                   in_offsets_.begin());
+
+  // in edges by target; edges are visited in (u, v) order, so the in edges
+  // of a vertex are sorted by source
+  in_edges_.resize(narcs);
+  std::vector<graph::edge_index_t> fill(in_offsets_.begin(),
+                                        in_offsets_.end() - 1);
+  for (graph::edge_index_t e = 0; e < narcs; ++e)
+    in_edges_[fill[targets_[e]]++] = e;
+
+  std::cout << "total edges = " << nedges << "\n";
+  std::cout << "# of edges: " << this->nedges() << "\n";
 }
 
-bool abm::Graph::read_vertices(const std::string &filename) {
+// Add parsed vertices
+void abm::Graph::add_vertices(const abm::graph::VertexRecord *vertices,
+                              std::size_t nvertices) {
   QVector2D minBox(FLT_MAX, FLT_MAX);
   QVector2D maxBox(-FLT_MAX, -FLT_MAX);
   float scale = 1.0f;
@@ -198,32 +122,71 @@ bool abm::Graph::read_vertices(const std::string &filename) {
                    scale * 0.5f; // half side
   QVector3D centerV(-minBox.x(), -minBox.y(), 0);
   QVector3D centerAfterSc(-sqSideSz, -sqSideSz, 0);
-  bool status = true;
-  csvio::CSVReader<6> in(filename);
-  in.read_header(csvio::ignore_extra_column, "osmid", "x", "y", "ref",
-                 "highway", "index");
-  float lat, lon;
-  abm::graph::vertex_t nodeIndex, osmid;
-  std::string ref, highway;
-
-  while (in.read_row(osmid, lat, lon, ref, highway, nodeIndex)) {
-    // std::cout << "osmid = " << osmid << "\n";
-    // std::cout << "nodeIndex = " << nodeIndex << "\n";
 
-    this->nodeIndex_to_osmid_[nodeIndex] = osmid;
-    QVector3D pos(lat, lon, 0);
+  for (std::size_t i = 0; i < nvertices; ++i) {
+    const auto &vertex = vertices[i];
+    if (this->nodeIndex_to_osmid_.size() <= vertex.index) {
+      this->nodeIndex_to_osmid_.resize(vertex.index + 1);
+      this->vertices_data_.resize(vertex.index + 1);
+    }
+    this->nodeIndex_to_osmid_[vertex.index] = vertex.osmid;
+    QVector3D pos(vertex.x, vertex.y, 0);
     pos += centerV; // center
     pos *= scale;
     pos += centerAfterSc;
     pos.setX(pos.x() * -1.0f); // seems vertically rotated
-    vertices_data_[nodeIndex] = pos;
+    vertices_data_[vertex.index] = pos;
   }
 
   std::cout << "# of vertices: " << vertices_data_.size() << "\n";
+}
+
+// Read OSM graph file format
+bool abm::Graph::read_graph_osm(const std::string &filename) {
+  bool status = true;
+  std::cout << "reading graph osm" << std::endl;
+  try {
+    const auto edges = parse_edges_osm(filename);
+    this->add_edges(edges.data(), edges.size());
+  } catch (std::exception &exception) {
+    std::cout << "Read OSM file: " << exception.what() << "\n";
+    status = false;
+  }
 
   return status;
 }
 
+bool abm::Graph::read_vertices(const std::string &filename) {
+  const auto vertices = parse_vertices(filename);
+  this->add_vertices(vertices.data(), vertices.size());
+  return true;
+}
+
+// Find the edge connecting two vertices (out edges are sorted by target)
+abm::graph::edge_index_t
+abm::Graph::find_edge(abm::graph::vertex_t vertex1,
+                      abm::graph::vertex_t vertex2) const {
+  if (vertex1 < 0 || vertex1 >= this->nvertices())
+    return graph::kInvalidEdge;
+  const auto begin = targets_.begin() + out_begin(vertex1);
+  const auto end = targets_.begin() + out_end(vertex1);
+  const auto itr = std::lower_bound(begin, end, vertex2);
+  if (itr == end || *itr != vertex2)
+    return graph::kInvalidEdge;
+  return itr - targets_.begin();
+}
+
+// Update edge
+void abm::Graph::update_edge(abm::graph::vertex_t vertex1,
+                             abm::graph::vertex_t vertex2,
+                             abm::graph::weight_t weight) {
+  const auto edge = find_edge(vertex1, vertex2);
+  if (edge == graph::kInvalidEdge)
+    throw std::out_of_range("Edge not found");
+  // Update edge weight
+  weights_[edge] = weight;
+}
+
 // Dijktra shortest paths from src to a vertex
 std::vector<abm::graph::vertex_t>
 abm::Graph::dijkstra(abm::graph::vertex_t source,
@@ -245,20 +208,20 @@ abm::Graph::dijkstra(abm::graph::vertex_t source,
 
   // Create a vector for distances and initialize all to max
   std::vector<graph::weight_t> distances;
-  distances.resize(this->vertices_.size(),
+  distances.resize(this->nvertices(),
                    std::numeric_limits<abm::graph::weight_t>::max());
   // Parent array to store shortest path tree
   std::vector<graph::vertex_t> parent;
-  parent.resize(this->vertices_.size(), -1);
+  parent.resize(this->nvertices(), -1);
 
   std::vector<abm::graph::vertex_t> path;
-  if (vertices_.find(source) == vertices_.end() ||
-      vertices_.find(destination) == vertices_.end())
+  if (source < 0 || source >= this->nvertices() || destination < 0 ||
+      destination >= this->nvertices())
     return path;
 
   // Insert source itself in priority queue & initialize its distance as 0.
   priority_queue.push(std::make_pair(0., source));
-  distances[vertices_.at(source)] = 0.;
+  distances[source] = 0.;
 
   // Looping till priority queue becomes empty (or all
   // distances are not finalized)
@@ -272,23 +235,20 @@ abm::Graph::dijkstra(abm::graph::vertex_t source,
       break;
 
     // Get all adjacent vertices of a vertex
-    for (const auto &edge : vertex_edges_[u]) {
+    for (auto edge = out_begin(u); edge < out_end(u); ++edge) {
       // Get vertex label and weight of neighbours of u.
-      const abm::graph::vertex_t neighbour = edge->first.second;
-      const abm::graph::weight_t weight = edge->second[0];
+      const abm::graph::vertex_t neighbour = targets_[edge];
+      const abm::graph::weight_t weight = weights_[edge];
 
       // Distance from source to neighbour
       // distance_u = distance to current node + weight of edge u to
       // neighbour
-      const abm::graph::vertex_t uidx = vertices_.at(u);
-      const abm::graph::vertex_t nidx = vertices_.at(neighbour);
-
-      const abm::graph::weight_t distance_u = distances.at(uidx) + weight;
+      const abm::graph::weight_t distance_u = distances[u] + weight;
       // If there is shorted path to neighbour vertex through u.
-      if (distances.at(nidx) > distance_u) {
-        parent[nidx] = u;
+      if (distances[neighbour] > distance_u) {
+        parent[neighbour] = u;
         // Update distance of the vertex
-        distances.at(nidx) = distance_u;
+        distances[neighbour] = distance_u;
         priority_queue.push(std::make_pair(distance_u, neighbour));
       }
     }
@@ -297,7 +257,7 @@ abm::Graph::dijkstra(abm::graph::vertex_t source,
   path.emplace_back(destination);
   // Iterate until source has been reached
   while (destination != source && destination != -1) {
-    destination = parent.at(vertices_.at(destination));
+    destination = parent.at(destination);
     if (destination != source && destination != -1)
       path.emplace_back(destination);
   }
@@ -362,9 +322,9 @@ abm::Graph::dijkstra_edges(abm::graph::vertex_t source,
     for (auto itr = path.begin(); itr != path.end() - 1; ++itr) {
       auto nitr = itr + 1;
       if (itr != path.end()) {
-        auto map_itr = edge_ids_[*itr].find(*nitr);
-        if (map_itr != edge_ids_[*itr].end())
-          route_edges.emplace_back((*map_itr).second);
+        const auto edge = find_edge(*itr, *nitr);
+        if (edge != graph::kInvalidEdge)
+          route_edges.emplace_back(edge_ids_[edge]);
       }
     }
   }
@@ -377,7 +337,7 @@ abm::graph::weight_t abm::Graph::path_cost(
     const std::vector<std::array<abm::graph::vertex_t, 2>> &path) {
   abm::graph::weight_t cost = 0.;
   for (const auto &vertices : path)
-    cost += (edges_.at(std::make_tuple(vertices[0], vertices[1])))->second[0];
+    cost += weights_.at(find_edge(vertices[0], vertices[1]));
   return cost;
 }
 
@@ -386,6 +346,6 @@ abm::graph::weight_t
 abm::Graph::path_cost(const std::vector<abm::graph::vertex_t> &path) {
   abm::graph::weight_t cost = 0.;
   for (const auto &edge : path)
-    cost += edge_costs_.at(edge);
+    cost += weights_.at(edge_index(edge));
   return cost;
 }
\ No newline at end of file
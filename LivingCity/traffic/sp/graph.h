@@ -21,100 +21,165 @@
 #include <vector>
 
 #include "external/csv.h"
-#include "tsl/robin_map.h"
 
 #include "traffic/config.h"
 
 namespace abm {
 
+namespace graph {
+//! Edge record as parsed from the OSM edge file
+struct EdgeRecord {
+  edge_id_t uniqueid;
+  vertex_t u;
+  vertex_t v;
+  float length;
+  float lanes;
+  float speed_mph;
+};
+
+//! Vertex record as parsed from the node file
+struct VertexRecord {
+  vertex_t osmid;
+  vertex_t index;
+  float x;
+  float y;
+};
+
+//! Index of an edge in the CSR arrays
+using edge_index_t = unsigned int;
+//! Returned when an edge is not in the graph
+const edge_index_t kInvalidEdge{std::numeric_limits<edge_index_t>::max()};
+} // namespace graph
+
 //! \brief Graph class to store vertices and edge and compute shortest path
-//! \details Graph class has Priority Queue Dijkstra algorithm for SSSP
+//! \details Edges are kept in compressed sparse row (CSR) form: the out edges
+//! of vertex v are the edge indices out_offsets_[v] to out_offsets_[v + 1],
+//! sorted by target. Edge attributes are stored as arrays indexed by edge
+//! index, and a second offset array lists the in edges of every vertex.
+//! Graph class has Priority Queue Dijkstra algorithm for SSSP
 class Graph {
 public:
-  //! Edge {{v1, v2}, weight}
-  using Edge = std::pair<std::pair<graph::vertex_t, graph::vertex_t>,
-                         std::vector<float>>;
-
-  //! Construct directed / undirected graph
+  //! Construct an empty directed / undirected graph
   //! \param[in] directed Defines if the graph is directed or not
-  explicit Graph(bool directed, std::string networkPath) {
-    this->directed_ = directed;
-
-    // --- we get the max vertex id
-    const std::string &nodeFileName = networkPath + "nodes.csv";
-    csvio::CSVReader<1> inMaxVertexIndex(nodeFileName);
-    inMaxVertexIndex.read_header(csvio::ignore_extra_column, "index");
-    abm::graph::vertex_t osmid, nodeIndex;
-    std::string ref;
-    std::string highway;
-    float lat, lon;
-    abm::graph::vertex_t maxVertexIndexFound = 0;
-    while (inMaxVertexIndex.read_row(nodeIndex)) {
-      maxVertexIndexFound = std::max(nodeIndex, maxVertexIndexFound);
-    }
-    this->nodeIndex_to_osmid_ =
-        std::vector<graph::vertex_t>(maxVertexIndexFound + 1);
-
-    // --- we get the max edge id
-    const std::string &edgeFileName = networkPath + "edges.csv";
-    csvio::CSVReader<1> inMaxEdgeIndex(edgeFileName);
-    inMaxEdgeIndex.read_header(csvio::ignore_extra_column, "uniqueid");
-    abm::graph::vertex_t edgeIndex;
-    abm::graph::vertex_t maxEdgeIndexFound = 0;
-    while (inMaxEdgeIndex.read_row(edgeIndex)) {
-      maxEdgeIndexFound = std::max(edgeIndex, maxEdgeIndexFound);
-    }
-
-    this->edge_ids_ =
-        std::vector<tsl::robin_map<graph::vertex_t, graph::edge_id_t>>(
-            maxEdgeIndexFound + 1);
-  }
+  explicit Graph(bool directed) : directed_{directed} {}
 
-  //! Return number of vertices
-  unsigned nvertices() const { return nvertices_; }
+  //! Return number of vertices (largest vertex id in the edges + 1)
+  graph::vertex_t nvertices() const { return out_offsets_.size() - 1; }
 
   //! Number of edges
-  graph::vertex_t nedges() const { return edges_.size(); }
+  graph::edge_index_t nedges() const { return targets_.size(); }
 
-  //! Add edge to graph
-  //! \param[in] vertex1 ID of vertex1
-  //! \param[in] vertex2 ID of vertex2
-  //! \param[in] weight Weight of edge connecting vertex 1 and 2
-  //! \param[in] edge_id ID of edge
-  // void add_edge(graph::vertex_t vertex1, graph::vertex_t vertex2,
-  //              graph::weight_t weight, graph::vertex_t edgeid, int lanes, int
-  //              speed_mph);
-  void add_edge(graph::vertex_t vertex1, graph::vertex_t vertex2,
-                std::vector<float> edge_vals, graph::vertex_t edgeid);
-  //! Update edge of a graph
+  //! Read OSM graph file format
+  //! \param[in] filename Name of input edge file
+  //! \retval status File read status
+  bool read_graph_osm(const std::string &filename);
+
+  //! Read node file
+  //! \param[in] filename Name of input node file
+  //! \retval status File read status
+  bool read_vertices(const std::string &filename);
+
+  //! Parse the edges of an OSM graph file
+  //! \param[in] filename Name of input edge file
+  //! \retval edges Edge records in file order
+  static std::vector<graph::EdgeRecord>
+  parse_edges_osm(const std::string &filename);
+
+  //! Parse the vertices of a node file
+  //! \param[in] filename Name of input node file
+  //! \retval vertices Vertex records in file order
+  static std::vector<graph::VertexRecord>
+  parse_vertices(const std::string &filename);
+
+  //! Build the CSR arrays from parsed edges (replaces existing edges). Edges
+  //! repeating the vertices of an earlier edge are skipped
+  //! \param[in] edges Edge records
+  //! \param[in] nedges Number of edge records
+  void add_edges(const graph::EdgeRecord *edges, std::size_t nedges);
+
+  //! Add parsed vertices to the graph
+  //! \param[in] vertices Vertex records
+  //! \param[in] nvertices Number of vertex records
+  void add_vertices(const graph::VertexRecord *vertices,
+                    std::size_t nvertices);
+
+  //! First out edge of a vertex
+  graph::edge_index_t out_begin(graph::vertex_t vertex) const {
+    return out_offsets_[vertex];
+  }
+  //! One past the last out edge of a vertex
+  graph::edge_index_t out_end(graph::vertex_t vertex) const {
+    return out_offsets_[vertex + 1];
+  }
+  //! Number of out edges of a vertex
+  graph::edge_index_t out_degree(graph::vertex_t vertex) const {
+    return out_end(vertex) - out_begin(vertex);
+  }
+
+  //! In edges of a vertex are in_edges(i) for i in [in_begin, in_end)
+  graph::edge_index_t in_begin(graph::vertex_t vertex) const {
+    return in_offsets_[vertex];
+  }
+  graph::edge_index_t in_end(graph::vertex_t vertex) const {
+    return in_offsets_[vertex + 1];
+  }
+  //! Edge index of the i-th entry of the in edge lists
+  graph::edge_index_t in_edge(graph::edge_index_t i) const {
+    return in_edges_[i];
+  }
+
+  //! Edge attributes (by edge index)
+  graph::vertex_t source(graph::edge_index_t edge) const {
+    return sources_[edge];
+  }
+  graph::vertex_t target(graph::edge_index_t edge) const {
+    return targets_[edge];
+  }
+  graph::edge_id_t edge_id(graph::edge_index_t edge) const {
+    return edge_ids_[edge];
+  }
+  float length(graph::edge_index_t edge) const { return lengths_[edge]; }
+  float lanes(graph::edge_index_t edge) const { return lanes_[edge]; }
+  //! Free flow speed in meters/second
+  float speed(graph::edge_index_t edge) const { return speeds_[edge]; }
+  //! Free flow travel time
+  graph::weight_t weight(graph::edge_index_t edge) const {
+    return weights_[edge];
+  }
+
+  //! Edge index of the edge connecting two vertices
   //! \param[in] vertex1 ID of vertex1
   //! \param[in] vertex2 ID of vertex2
-  //! \param[in] weight Weight of edge connecting vertex 1 and 2
-  void update_edge(graph::vertex_t vertex1, graph::vertex_t vertex2,
-                   graph::weight_t weight);
+  //! \retval edge edge index or graph::kInvalidEdge
+  graph::edge_index_t find_edge(graph::vertex_t vertex1,
+                                graph::vertex_t vertex2) const;
 
-  //! Remove edge from graph
+  //! Edge id of the edge connecting two vertices
   //! \param[in] vertex1 ID of vertex1
   //! \param[in] vertex2 ID of vertex2
-  void remove_edge(graph::vertex_t vertex1, graph::vertex_t vertex2);
-
-  //! Generate a simple graph
-  void generate_simple_graph();
+  graph::edge_id_t edge_id(graph::vertex_t vertex1,
+                           graph::vertex_t vertex2) const {
+    return edge_ids_[find_edge(vertex1, vertex2)];
+  }
 
-  //! Read MatrixMarket graph file format
-  //! \param[in] filename Name of input MatrixMarket file
-  //! \retval status File read status
-  bool read_graph_matrix_market(const std::string &filename);
+  //! Edge index from an edge id
+  //! \param[in] edgeid ID of the edge (uniqueid of the input file)
+  //! \retval edge edge index or graph::kInvalidEdge
+  graph::edge_index_t edge_index(graph::edge_id_t edgeid) const {
+    return edgeid >= 0 && std::size_t(edgeid) < edge_index_.size()
+               ? edge_index_[edgeid]
+               : graph::kInvalidEdge;
+  }
 
-  //! Read OSM graph file format
-  //! \param[in] filename Name of input MatrixMarket file
-  //! \retval status File read status
-  bool read_graph_osm(const std::string &filename);
+  //! Largest edge id + 1 (edge ids of the input file need not be dense)
+  graph::edge_id_t edge_id_bound() const { return edge_index_.size(); }
 
-  //! Read OSM graph file format
-  //! \param[in] filename Name of input MatrixMarket file
-  //! \retval status File read status
-  bool read_vertices(const std::string &filename);
+  //! Update edge of a graph
+  //! \param[in] vertex1 ID of vertex1
+  //! \param[in] vertex2 ID of vertex2
+  //! \param[in] weight Weight of edge connecting vertex 1 and 2
+  void update_edge(graph::vertex_t vertex1, graph::vertex_t vertex2,
+                   graph::weight_t weight);
 
   //! Compute the shortest path using priority queue
   //! \param[in] source ID of source vertex1
@@ -155,53 +220,33 @@ public:
   //! \retval cost Cost of traversed path
   abm::graph::weight_t path_cost(const std::vector<graph::vertex_t> &path);
 
-  // private:
-  //! Assign number of vertices
-  //! \param[in] nvertices Number of vertices in graph
-  void assign_nvertices(unsigned nvertices) { this->nvertices_ = nvertices; }
+  // Vertex data (by node index)
+  std::vector<QVector3D> vertices_data_;
+  // nodeIndex to osmid
+  std::vector<graph::vertex_t> nodeIndex_to_osmid_;
 
+private:
   // Directed / undirected
   bool directed_{false};
-  // Number of graph vertices
-  unsigned nvertices_{std::numeric_limits<unsigned>::max()};
-  // Edge id
-  graph::vertex_t edgeid_{0}; // deprecated, use eids from the input file
-  // Max id of vertex
-  graph::vertex_t max_vertex_id_{std::numeric_limits<graph::vertex_t>::min()};
-  // Vertex data
-  std::map<graph::vertex_t, QVector3D> vertices_data_;
-  // nodeIndex to osmid
-  std::vector<graph::vertex_t> nodeIndex_to_osmid_;
-  // Edges - vertices to edge pointer
-  std::map<std::tuple<graph::vertex_t, graph::vertex_t>, std::shared_ptr<Edge>>
-      edges_;
-  // Edges - edge pointer to vertices
-  std::map<std::shared_ptr<Edge>, std::tuple<graph::vertex_t, graph::vertex_t>>
-      edge_pointer_to_vertices_;
-  // Edges to an index
-  std::map<graph::edge_id_t, graph::vertex_t> edge_vertex_map_;
-  // adjacency list with iteration over each edge
-  tsl::robin_map<graph::vertex_t, std::vector<std::shared_ptr<Edge>>>
-      vertex_edges_;
-
-  tsl::robin_map<graph::vertex_t, std::vector<std::shared_ptr<Edge>>>
-      vertex_in_edges_;
-
-  tsl::robin_map<graph::vertex_t, std::vector<std::shared_ptr<Edge>>>
-      vertex_out_edges_;
-  // Vertices and counts
-  tsl::robin_map<graph::vertex_t, graph::vertex_t> vertices_;
-
-  // Global edges
-  std::vector<tsl::robin_map<graph::vertex_t, graph::edge_id_t>> edge_ids_;
-
-  // person to their initial edge
-  std::map<graph::vertex_t, graph::edge_id_t> person_to_init_edge_;
-
-  std::map<graph::edge_id_t, std::tuple<graph::vertex_t, graph::vertex_t>>
-      edge_ids_to_vertices;
-  // Vertices and counts
-  tsl::robin_map<graph::edge_id_t, graph::weight_t> edge_costs_;
+
+  // CSR offsets of the out edges of every vertex (nvertices + 1)
+  std::vector<graph::edge_index_t> out_offsets_{0};
+  // CSR offsets into in_edges_ of every vertex (nvertices + 1)
+  std::vector<graph::edge_index_t> in_offsets_{0};
+  // Edge indices grouped by target vertex
+  std::vector<graph::edge_index_t> in_edges_;
+
+  // Edge attributes by edge index
+  std::vector<graph::vertex_t> sources_;
+  std::vector<graph::vertex_t> targets_;
+  std::vector<graph::edge_id_t> edge_ids_;
+  std::vector<float> lengths_;
+  std::vector<float> lanes_;
+  std::vector<float> speeds_;
+  std::vector<graph::weight_t> weights_;
+
+  // Edge id to edge index
+  std::vector<graph::edge_index_t> edge_index_;
 };
 
 } // namespace abm
@@ -19,43 +19,104 @@ TrafficSimulator::TrafficSimulator(std::shared_ptr<Network> network,
 }
 
 void TrafficSimulator::route_finding_() {
-  // compute routes use contraction hierarchy
-  auto graph_ch = std::make_shared<MTC::accessibility::Accessibility>(
-      network_->num_vertices(), network_->edge_vertices(),
-      network_->edge_weights(), false);
-
+  // compute routes use contraction hierarchy (reloaded from the network's
+  // cache directory when the network did not change), its nodes reordered
+  // for the batch queries
+  MTC::accessibility::Accessibility graph_ch(
+      network_->num_vertices(), network_->heads(), network_->tails(),
+      network_->edge_weights(), false, network_->cache_path(), false, true);
+
+  // route every distinct (origin, destination) pair once per profile,
+  // agents with the same pair and profile share its route
+  // agents are routed on the weight profile of their departure time
   auto &agents = od_->agents();
-  std::vector<long> sources, targets;
-  for (const auto &agent : agents) {
-    sources.emplace_back(agent.init_intersection);
-    targets.emplace_back(agent.end_intersection);
+  std::vector<unsigned> agent_profiles(agents.size());
+  for (std::size_t i = 0; i < agents.size(); ++i) {
+    agent_profiles[i] = network_->profile(agents[i].time_departure);
   }
+  std::vector<unsigned> agent_pairs;
+  std::vector<std::size_t> route_offsets;
+  find_pair_routes_(graph_ch, agent_profiles, agent_pairs, routes_,
+                    route_offsets);
 
-  auto node_sequence = graph_ch->Routes(sources, targets, 0);
-  auto &eid2mid = lanemap_->eid2mid();
-  //  std::cout << "# of paths = " << all_paths_ch.size() << " \n";
-
-  // add routes to each agent
-  for (int i = 0; i < node_sequence.size(); i++) {
+  for (std::size_t i = 0; i < agents.size(); ++i) {
     auto &agent = agents[i];
-    if (node_sequence[i].size() > 100) {
+    const auto p = agent_pairs[i];
+    agent.route_offset = route_offsets[p];
+    agent.route_size = route_offsets[p + 1] - route_offsets[p];
+    if (agent.route_size > 100) {
       std::cerr << "Warning: Agent " << i << " need to go through "
-                << node_sequence[i].size() << " edges!" << std::endl;
+                << agent.route_size << " edges!" << std::endl;
     }
-    if (node_sequence[i].size() == 0) {
+    if (agent.route_size == 0) {
       std::cerr << "Warning: Agent " << i << " has no route! " << std::endl;
-    } else {
-      //        std::cout<<"route: ";
-      for (int j = 0; j < node_sequence[i].size() - 1; j++) {
-        auto vertex_from = node_sequence[i][j];
-        auto vertex_to = node_sequence[i][j + 1];
-        auto eid = network_->edge_id(vertex_from, vertex_to);
-        //        std::cout<<vertex_from<<","<<vertex_to<<";";
-        auto mid = eid2mid.at(eid);
-        agent.route[agent.route_size] = mid;
-        agent.route_size++;
-      }
-      //        std::cout<<std::endl;
+    }
+  }
+}
+
+void TrafficSimulator::find_pair_routes_(
+    MTC::accessibility::Accessibility &graph_ch,
+    const std::vector<unsigned> &agent_graphs,
+    std::vector<unsigned> &agent_pairs, std::vector<uint> &routes,
+    std::vector<std::size_t> &route_offsets) {
+  const auto &agents = od_->agents();
+  const unsigned num_graphs =
+      agent_graphs.empty()
+          ? 1
+          : *std::max_element(agent_graphs.begin(), agent_graphs.end()) + 1;
+
+  // distinct (origin, destination) pairs of every graph
+  std::vector<std::vector<long>> sources(num_graphs), targets(num_graphs);
+  std::vector<std::unordered_map<uint64_t, unsigned>> pair_ids(num_graphs);
+  agent_pairs.resize(agents.size());
+  for (std::size_t i = 0; i < agents.size(); ++i) {
+    const unsigned graph = agent_graphs.empty() ? 0 : agent_graphs[i];
+    const uint64_t key = (uint64_t(agents[i].init_intersection) << 32) |
+                         agents[i].end_intersection;
+    const auto pair = pair_ids[graph].emplace(key, sources[graph].size());
+    if (pair.second) {
+      sources[graph].emplace_back(agents[i].init_intersection);
+      targets[graph].emplace_back(agents[i].end_intersection);
+    }
+    agent_pairs[i] = pair.first->second;
+  }
+
+  // pairs are numbered graph by graph, each graph is routed in one batch
+  std::vector<unsigned> first_pair(num_graphs + 1, 0);
+  for (unsigned graph = 0; graph < num_graphs; ++graph) {
+    first_pair[graph + 1] = first_pair[graph] + sources[graph].size();
+  }
+  for (std::size_t i = 0; i < agents.size(); ++i) {
+    agent_pairs[i] += first_pair[agent_graphs.empty() ? 0 : agent_graphs[i]];
+  }
+  std::cout << "# of distinct od pairs = " << first_pair.back() << " for "
+            << agents.size() << " agents\n";
+
+  // the CH gives the paths as edge indices in edge id order
+  std::vector<std::vector<int>> edge_sequence;
+  edge_sequence.reserve(first_pair.back());
+  for (unsigned graph = 0; graph < num_graphs; ++graph) {
+    if (sources[graph].empty()) {
+      continue;
+    }
+    auto graph_routes =
+        graph_ch.EdgeRoutes(sources[graph], targets[graph], graph);
+    std::move(graph_routes.begin(), graph_routes.end(),
+              std::back_inserter(edge_sequence));
+  }
+  const auto &edge_mids = lanemap_->edge_mids();
+
+  // routes of the pairs in lanemap ids, stored back to back
+  route_offsets.assign(edge_sequence.size() + 1, 0);
+  for (std::size_t p = 0; p < edge_sequence.size(); ++p) {
+    route_offsets[p + 1] = route_offsets[p] + edge_sequence[p].size();
+  }
+  routes.assign(route_offsets.back(), 0);
+#pragma omp parallel for schedule(guided)
+  for (int p = 0; p < edge_sequence.size(); ++p) {
+    const auto &edges = edge_sequence[p];
+    for (std::size_t j = 0; j < edges.size(); ++j) {
+      routes[route_offsets[p] + j] = edge_mids[edges[j]];
     }
   }
 }
@@ -66,7 +127,12 @@ void TrafficSimulator::route_finding_() {
 ////////////////////////////////////////////////////////
 void TrafficSimulator::simulateInGPU(float startTime, float endTime,
                                      int save_interval) {
-
+#ifndef MICROSIM_CUDA
+  std::cerr << "Warning: microsim was built without CUDA, running the "
+               "simulation on the CPU instead."
+            << std::endl;
+  simulateInCPU(startTime, endTime, save_interval);
+#else
   Benchmarker passesBench("Simulation passes");
   Benchmarker finishCudaBench("Cuda finish");
 
@@ -85,14 +151,24 @@ void TrafficSimulator::simulateInGPU(float startTime, float endTime,
   auto &agents = od_->agents();
   auto &edgesData = lanemap_->edgesData();
   auto &lanemap_data = lanemap_->lanemap_array();
+  auto &occupancy = lanemap_->occupancy_array();
+  auto &cell_offsets = lanemap_->cell_offsets();
   auto &intersections = lanemap_->intersections();
 
   std::cout << "Traffic person vec size = " << agents.size() << std::endl;
+  std::cout << "Routes size = " << routes_.size() << std::endl;
   std::cout << "EdgesData size = " << edgesData.size() << std::endl;
   std::cout << "LaneMap size = " << lanemap_data.size() << std::endl;
   std::cout << "Intersections size = " << intersections.size() << std::endl;
 
-  init_cuda(true, agents, edgesData, lanemap_data, intersections);
+  lanemap_->init_queues(agents);
+  auto &movements = lanemap_->movements();
+  auto &queue_pool = lanemap_->queue_pool();
+  std::cout << "Movements size = " << movements.size() << std::endl;
+  std::cout << "Queue pool size = " << queue_pool.size() << std::endl;
+
+  init_cuda(true, agents, routes_, edgesData, lanemap_data, occupancy,
+            cell_offsets, intersections, movements, queue_pool);
 
   initCudaBench.stopAndEndBenchmark();
 
@@ -111,6 +187,26 @@ void TrafficSimulator::simulateInGPU(float startTime, float endTime,
             << std::endl;
 
   unsigned int simulations_steps = 0;
+  num_en_route_reroutes_ = 0;
+  compacted_routes_size_ = routes_.size();
+  RerouteBackend reroute_backend;
+  reroute_backend.stage_data = []() {
+    cuda_stage_reroute(CUDAThreadsPerBlock);
+  };
+  reroute_backend.get_data = cuda_get_reroute_data;
+  reroute_backend.check_routes = [](const std::vector<RouteUpdate> &updates,
+                                    std::vector<uchar> &valid) {
+    cuda_check_route_updates(updates, valid, CUDAThreadsPerBlock);
+  };
+  reroute_backend.update_routes =
+      [this](const std::vector<RouteUpdate> &updates) {
+        return cuda_update_routes(routes_, updates, CUDAThreadsPerBlock);
+      };
+  reroute_backend.set_routes = [this, &agents]() {
+    cuda_set_routes(routes_, agents, CUDAThreadsPerBlock);
+  };
+  // step whose output is being copied back (0: none)
+  unsigned int staged_step = 0;
   // 2. Run GPU Simulation
   while (startTime < endTime) {
     cuda_simulate(startTime, agents.size(), intersections.size(), deltaTime_,
@@ -119,12 +215,21 @@ void TrafficSimulator::simulateInGPU(float startTime, float endTime,
     simulations_steps += 1;
     startTime += deltaTime_;
 
-    cuda_get_data(agents, edgesData, intersections); // Get data from cuda
-    if (simulations_steps % save_interval == 0) {
+    // the copy of the last output step overlaps the step just launched
+    if (staged_step > 0) {
+      getDataBench.startMeasuring();
+      cuda_get_staged_data(agents, edgesData);
+      getDataBench.stopMeasuring();
       // Store data to local disk
-      save_edges(simulations_steps);
-      save_agents(simulations_steps);
+      save_edges(staged_step);
+      save_agents(staged_step);
+      staged_step = 0;
     }
+    if (simulations_steps % save_interval == 0) {
+      cuda_stage_data(CUDAThreadsPerBlock);
+      staged_step = simulations_steps;
+    }
+    reroute_step_(simulations_steps, reroute_backend);
 
     //
     //    int max_queue_size = 0;
@@ -178,8 +283,483 @@ void TrafficSimulator::simulateInGPU(float startTime, float endTime,
     //        save_agents(simulations_steps);
     //    }
   }
+  finish_rerouting_();
+  if (staged_step > 0) {
+    cuda_get_staged_data(agents, edgesData);
+    save_edges(staged_step);
+    save_agents(staged_step);
+  }
+  // final state (including the intersection queues) back to the host
+  cuda_get_data(agents, edgesData, intersections);
 
   finish_cuda(); // free cuda memory
+  if (num_en_route_reroutes_ > 0) {
+    compact_routes_();
+  }
+#endif
+}
+
+//
+////////////////////////////////////////////////////////
+//////// CPU Simulation
+////////////////////////////////////////////////////////
+void TrafficSimulator::simulateInCPU(float startTime, float endTime,
+                                     int save_interval, int num_threads) {
+
+  Benchmarker microsimulationInCPU("Microsimulation_in_CPU", true);
+  microsimulationInCPU.startMeasuring();
+
+  Benchmarker initCPUBench("Init CPU step");
+
+  /////////////////////////////////////
+  // 1. Init CPU buffers
+  initCPUBench.startMeasuring();
+  auto &agents = od_->agents();
+  auto &edgesData = lanemap_->edgesData();
+  auto &lanemap_data = lanemap_->lanemap_array();
+  auto &occupancy = lanemap_->occupancy_array();
+  auto &cell_offsets = lanemap_->cell_offsets();
+  auto &intersections = lanemap_->intersections();
+
+  std::cout << "Traffic person vec size = " << agents.size() << std::endl;
+  std::cout << "Routes size = " << routes_.size() << std::endl;
+  std::cout << "EdgesData size = " << edgesData.size() << std::endl;
+  std::cout << "LaneMap size = " << lanemap_data.size() << std::endl;
+  std::cout << "Intersections size = " << intersections.size() << std::endl;
+
+  lanemap_->init_queues(agents);
+  auto &movements = lanemap_->movements();
+  auto &queue_pool = lanemap_->queue_pool();
+  std::cout << "Movements size = " << movements.size() << std::endl;
+  std::cout << "Queue pool size = " << queue_pool.size() << std::endl;
+
+  init_cpu(true, agents, routes_, edgesData, lanemap_data, occupancy,
+           cell_offsets, intersections, movements, queue_pool);
+
+  initCPUBench.stopAndEndBenchmark();
+
+  std::cerr << "Running main loop from " << (startTime / 3600.0f) << " to "
+            << (endTime / 3600.0f) << " with " << agents.size() << "person... "
+            << std::endl;
+
+  unsigned int simulations_steps = 0;
+  num_en_route_reroutes_ = 0;
+  compacted_routes_size_ = routes_.size();
+  RerouteBackend reroute_backend;
+  reroute_backend.stage_data = cpu_stage_reroute;
+  reroute_backend.get_data = cpu_get_reroute_data;
+  reroute_backend.check_routes = cpu_check_route_updates;
+  reroute_backend.update_routes =
+      [this](const std::vector<RouteUpdate> &updates) {
+        return cpu_update_routes(routes_, updates);
+      };
+  reroute_backend.set_routes = [this]() { cpu_set_routes(routes_); };
+  // 2. Run CPU Simulation
+  while (startTime < endTime) {
+    cpu_simulate(startTime, agents.size(), intersections.size(), deltaTime_,
+                 num_threads);
+
+    simulations_steps += 1;
+    startTime += deltaTime_;
+
+    if (simulations_steps % save_interval == 0) {
+      cpu_get_data(agents, edgesData, intersections);
+      // Store data to local disk
+      save_edges(simulations_steps);
+      save_agents(simulations_steps);
+    }
+    reroute_step_(simulations_steps, reroute_backend);
+  }
+  finish_rerouting_();
+  cpu_get_data(agents, edgesData, intersections);
+
+  finish_cpu();
+  if (num_en_route_reroutes_ > 0) {
+    compact_routes_();
+  }
+  microsimulationInCPU.stopAndEndBenchmark();
+}
+
+//
+////////////////////////////////////////////////////////
+//////// Iterative assignment
+////////////////////////////////////////////////////////
+void TrafficSimulator::simulateAssignment(float start_time, float end_time,
+                                          int save_interval, int iterations,
+                                          float reroute_fraction,
+                                          bool use_cpu, int num_threads) {
+  // a simulation observes one travel time per edge, there is nothing to
+  // update the time-of-day profiles with
+  if (network_->num_profiles() > 1) {
+    std::cerr << "Error! The iterative assignment routes on the observed "
+                 "travel times and does not support weight profiles ("
+              << network_->num_profiles() << " loaded)." << std::endl;
+    abort();
+  }
+  Benchmarker assignmentBench("Assignment", true);
+  assignmentBench.startMeasuring();
+
+  std::ofstream gap_file(save_path_ + "assignment.csv");
+  gap_file << "iteration,relative_gap,total_route_time(s),rerouted_agents\n";
+  relative_gaps_.clear();
+  // fixed seed: the same inputs give the same assignment
+  std::mt19937 rng(2020);
+  std::bernoulli_distribution reroute(reroute_fraction);
+
+  auto &agents = od_->agents();
+  // every iteration departs like the first one
+  initial_agents_ = agents;
+  // customizable CH: new weights only recompute the shortcut weights
+  MTC::accessibility::Accessibility graph_ch(
+      network_->num_vertices(), network_->heads(), network_->tails(),
+      {network_->edge_weights().front()}, false, "", true, true);
+  for (int iteration = 0; iteration < iterations; ++iteration) {
+    if (iteration > 0) {
+      reset_simulation_();
+    }
+    if (use_cpu) {
+      simulateInCPU(start_time, end_time, save_interval, num_threads);
+    } else {
+      simulateInGPU(start_time, end_time, save_interval);
+    }
+
+    // shortest paths with the observed travel times as weights
+    const auto travel_times = observed_travel_times_();
+    std::vector<unsigned> agent_pairs;
+    std::vector<uint> pair_routes;
+    std::vector<std::size_t> pair_offsets;
+    graph_ch.updateEdgeWeights(edge_weights_(travel_times));
+    find_pair_routes_(graph_ch, {}, agent_pairs, pair_routes, pair_offsets);
+
+    auto route_time = [&travel_times](const uint *route, std::size_t size) {
+      double time = 0;
+      for (std::size_t j = 0; j < size; ++j) {
+        time += travel_times[route[j]];
+      }
+      return time;
+    };
+    std::vector<double> pair_times(pair_offsets.size() - 1);
+#pragma omp parallel for schedule(guided)
+    for (int p = 0; p < pair_times.size(); ++p) {
+      pair_times[p] = route_time(pair_routes.data() + pair_offsets[p],
+                                 pair_offsets[p + 1] - pair_offsets[p]);
+    }
+    std::vector<double> agent_times(agents.size());
+#pragma omp parallel for schedule(guided)
+    for (int i = 0; i < agents.size(); ++i) {
+      agent_times[i] = route_time(routes_.data() + agents[i].route_offset,
+                                  agents[i].route_size);
+    }
+
+    // relative gap: share of the route time above the shortest path time
+    double total_time = 0, shortest_time = 0;
+    for (std::size_t i = 0; i < agents.size(); ++i) {
+      total_time += agent_times[i];
+      shortest_time += pair_times[agent_pairs[i]];
+    }
+    const double gap =
+        total_time > 0 ? (total_time - shortest_time) / total_time : 0;
+    relative_gaps_.emplace_back(gap);
+
+    // the agents that switch keep their pair's new route, the others keep
+    // theirs; both are copied into a new flat route array
+    std::size_t rerouted = 0;
+    if (iteration + 1 < iterations) {
+      std::vector<uint> routes;
+      std::unordered_map<std::size_t, std::size_t> old_offsets, new_offsets;
+      auto append = [&routes](const uint *route, std::size_t size) {
+        const std::size_t offset = routes.size();
+        routes.insert(routes.end(), route, route + size);
+        return offset;
+      };
+      for (std::size_t i = 0; i < agents.size(); ++i) {
+        auto &agent = agents[i];
+        const auto p = agent_pairs[i];
+        if (agent_times[i] > pair_times[p] && reroute(rng)) {
+          auto offset = new_offsets.find(p);
+          if (offset == new_offsets.end()) {
+            offset = new_offsets
+                         .emplace(p, append(pair_routes.data() + pair_offsets[p],
+                                            pair_offsets[p + 1] -
+                                                pair_offsets[p]))
+                         .first;
+          }
+          agent.route_offset = offset->second;
+          agent.route_size = pair_offsets[p + 1] - pair_offsets[p];
+          ++rerouted;
+        } else {
+          auto offset = old_offsets.find(agent.route_offset);
+          if (offset == old_offsets.end()) {
+            offset = old_offsets
+                         .emplace(agent.route_offset,
+                                  append(routes_.data() + agent.route_offset,
+                                         agent.route_size))
+                         .first;
+          }
+          agent.route_offset = offset->second;
+        }
+      }
+      routes_.swap(routes);
+    }
+
+    std::cout << "Assignment iteration " << iteration
+              << ": relative gap = " << gap << ", rerouted " << rerouted
+              << " agents" << std::endl;
+    gap_file << iteration << "," << gap << "," << total_time << ","
+             << rerouted << "\n";
+  }
+  std::vector<Agent>().swap(initial_agents_);
+  assignmentBench.stopAndEndBenchmark();
+}
+
+std::vector<double> TrafficSimulator::observed_travel_times_() const {
+  const auto &edgesData = lanemap_->edgesData();
+  std::vector<EdgeTravel> edges(edgesData.size());
+  for (std::size_t mid = 0; mid < edgesData.size(); ++mid) {
+    edges[mid].downstream_veh_count = edgesData[mid].downstream_veh_count;
+    edges[mid].period_cum_travel_steps =
+        edgesData[mid].period_cum_travel_steps;
+  }
+  return observed_travel_times_(edges);
+}
+
+std::vector<double> TrafficSimulator::observed_travel_times_(
+    const std::vector<EdgeTravel> &edges) const {
+  // only the lengths and speed limits are read from the edge data
+  const auto &edgesData = lanemap_->edgesData();
+  std::vector<double> travel_times(edgesData.size(), 0);
+  for (std::size_t mid = 0; mid < edgesData.size(); ++mid) {
+    const auto &edge_data = edgesData[mid];
+    const auto &travel = edges[mid];
+    const double free_flow = edge_data.length / edge_data.maxSpeedMperSec;
+    double time = free_flow;
+    if (travel.downstream_veh_count > 0) {
+      time = double(travel.period_cum_travel_steps) /
+             travel.downstream_veh_count * deltaTime_;
+    }
+    // edges nobody left recently take at least as long as their vehicles
+    // have been on them
+    time = std::max(time, travel.wait_steps * deltaTime_);
+    // never faster than free flow, the CH needs positive weights
+    travel_times[mid] = std::max(time, free_flow);
+  }
+  return travel_times;
+}
+
+void TrafficSimulator::reset_simulation_() {
+  auto &agents = od_->agents();
+  for (std::size_t i = 0; i < agents.size(); ++i) {
+    const auto route_offset = agents[i].route_offset;
+    const auto route_size = agents[i].route_size;
+    agents[i] = initial_agents_[i];
+    agents[i].route_offset = route_offset;
+    agents[i].route_size = route_size;
+  }
+  lanemap_->reset();
+}
+
+std::vector<double> TrafficSimulator::edge_weights_(
+    const std::vector<double> &travel_times) const {
+  const auto &edge_mids = lanemap_->edge_mids();
+  std::vector<double> weights;
+  weights.reserve(edge_mids.size());
+  for (const auto mid : edge_mids) {
+    weights.emplace_back(travel_times[mid]);
+  }
+  return weights;
+}
+
+//
+////////////////////////////////////////////////////////
+//////// En-route rerouting
+////////////////////////////////////////////////////////
+void TrafficSimulator::reroute_step_(unsigned step,
+                                     const RerouteBackend &backend) {
+  if (reroute_interval_ <= 0) {
+    return;
+  }
+  if (reroute_task_.valid()) {
+    // the step loop only waits for a round if asked to
+    if (!reroute_wait_ && reroute_task_.wait_for(std::chrono::seconds(0)) !=
+                              std::future_status::ready) {
+      return;
+    }
+    // only the agents that did not move on get their new route stored,
+    // which keeps the entries of the old one before the splice
+    auto reroutes = reroute_task_.get();
+    std::vector<uchar> valid;
+    backend.check_routes(reroutes.updates, valid);
+    std::size_t num_valid = 0;
+    for (std::size_t k = 0; k < reroutes.updates.size(); ++k) {
+      if (!valid[k]) {
+        continue;
+      }
+      auto update = reroutes.updates[k];
+      const auto tail = reroutes.routes.begin() + update.route_offset;
+      const std::size_t offset = routes_.size();
+      for (unsigned j = 0; j < update.splice; ++j) {
+        routes_.push_back(routes_[update.old_offset + j]);
+      }
+      routes_.insert(routes_.end(), tail,
+                     tail + (update.route_size - update.splice));
+      update.route_offset = offset;
+      reroutes.updates[num_valid++] = update;
+    }
+    reroutes.updates.resize(num_valid);
+    num_en_route_reroutes_ += backend.update_routes(reroutes.updates);
+    // the host agents follow the routes of the backend
+    auto &agents = od_->agents();
+    for (const auto &update : reroutes.updates) {
+      agents[update.agent].route_offset = update.route_offset;
+      agents[update.agent].route_size = update.route_size;
+    }
+    // the replaced routes are dropped once routes_ doubled, no round refers
+    // to the old offsets until the next one is staged
+    if (routes_.size() > 2 * compacted_routes_size_) {
+      compact_routes_();
+      backend.set_routes();
+    }
+    return;
+  }
+  if (reroute_staged_) {
+    // the copy of the staged data overlapped the last step
+    std::vector<RerouteCandidate> candidates;
+    std::vector<EdgeTravel> edges;
+    backend.get_data(candidates, edges);
+    reroute_staged_ = false;
+    start_rerouting_(std::move(candidates), edges);
+    return;
+  }
+  if (step % reroute_interval_ == 0) {
+    backend.stage_data();
+    reroute_staged_ = true;
+  }
+}
+
+void TrafficSimulator::start_rerouting_(
+    std::vector<RerouteCandidate> candidates,
+    const std::vector<EdgeTravel> &edges) {
+  // only the fixed destinations and edge vertices are read from the host
+  // agents and edges
+  const auto &agents = od_->agents();
+  const auto &edgesData = lanemap_->edgesData();
+  auto travel_times = observed_travel_times_(edges);
+
+  // the agents waiting longest
+  if (candidates.size() > reroute_batch_) {
+    std::nth_element(candidates.begin(), candidates.begin() + reroute_batch_,
+                     candidates.end(),
+                     [](const RerouteCandidate &a, const RerouteCandidate &b) {
+                       return a.steps_on_edge != b.steps_on_edge
+                                  ? a.steps_on_edge > b.steps_on_edge
+                                  : a.agent > b.agent;
+                     });
+    candidates.resize(reroute_batch_);
+  }
+
+  RerouteRound round;
+  round.updates.reserve(candidates.size());
+  for (const auto &candidate : candidates) {
+    RouteUpdate update;
+    update.agent = candidate.agent;
+    update.old_offset = candidate.route_offset;
+    update.route_ptr = candidate.route_ptr;
+    update.splice = candidate.route_ptr + (candidate.in_queue ? 2 : 1);
+    update.route_offset = candidate.route_offset;
+    update.route_size = candidate.route_size;
+    round.updates.emplace_back(update);
+    // the new route starts where the kept part of the route ends
+    const uint *route = routes_.data() + update.route_offset;
+    const auto &last_kept = edgesData[route[update.splice - 1]];
+    round.sources.emplace_back(last_kept.vertex[1]);
+    round.targets.emplace_back(agents[candidate.agent].end_intersection);
+    round.kept_vertices.emplace_back(last_kept.vertex[0]);
+    double old_time = 0;
+    for (unsigned j = update.splice; j < update.route_size; ++j) {
+      old_time += travel_times[route[j]];
+    }
+    round.old_times.emplace_back(old_time);
+  }
+  round.weights = edge_weights_(travel_times);
+  round.edge_mids = lanemap_->edge_mids();
+  round.edge_targets.reserve(round.edge_mids.size());
+  for (const auto mid : round.edge_mids) {
+    round.edge_targets.emplace_back(edgesData[mid].vertex[1]);
+  }
+  round.travel_times = std::move(travel_times);
+  reroute_task_ = std::async(std::launch::async, &TrafficSimulator::reroute_,
+                             this, std::move(round));
+}
+
+TrafficSimulator::Reroutes
+TrafficSimulator::reroute_(RerouteRound round) {
+  Reroutes reroutes;
+  if (round.updates.empty()) {
+    return reroutes;
+  }
+  // customizable CH: contracted in the first round, later rounds only
+  // update its weights
+  if (reroute_ch_ == nullptr) {
+    reroute_ch_.reset(new MTC::accessibility::Accessibility(
+        network_->num_vertices(), network_->heads(), network_->tails(),
+        {round.weights}, false, "", true, true));
+  } else {
+    reroute_ch_->updateEdgeWeights(round.weights);
+  }
+  const auto paths = reroute_ch_->EdgeRoutes(round.sources, round.targets);
+
+  for (std::size_t k = 0; k < round.updates.size(); ++k) {
+    auto &update = round.updates[k];
+    const auto &edges = paths[k];
+    if (edges.empty()) {
+      continue;
+    }
+    if (round.edge_targets[edges.front()] == round.kept_vertices[k]) {
+      continue; // intersections have no movement turning around
+    }
+    double new_time = 0;
+    for (const auto edge : edges) {
+      new_time += round.travel_times[round.edge_mids[edge]];
+    }
+    if (new_time >= round.old_times[k]) {
+      continue;
+    }
+    update.route_offset = reroutes.routes.size();
+    update.route_size = update.splice + edges.size();
+    for (const auto edge : edges) {
+      reroutes.routes.emplace_back(round.edge_mids[edge]);
+    }
+    reroutes.updates.emplace_back(update);
+  }
+  return reroutes;
+}
+
+void TrafficSimulator::finish_rerouting_() {
+  reroute_staged_ = false;
+  if (reroute_task_.valid()) {
+    reroute_task_.get();
+  }
+}
+
+void TrafficSimulator::compact_routes_() {
+  // agents with the same route keep sharing it; a route is identified by its
+  // offset and size (an empty route may start where the next one starts)
+  auto &agents = od_->agents();
+  std::vector<uint> routes;
+  std::unordered_map<uint64_t, std::size_t> offsets;
+  for (auto &agent : agents) {
+    const uint64_t key =
+        (uint64_t(agent.route_offset) << 32) | agent.route_size;
+    auto offset = offsets.find(key);
+    if (offset == offsets.end()) {
+      offset = offsets.emplace(key, routes.size()).first;
+      routes.insert(routes.end(), routes_.begin() + agent.route_offset,
+                    routes_.begin() + agent.route_offset + agent.route_size);
+    }
+    agent.route_offset = offset->second;
+  }
+  routes_.swap(routes);
+  compacted_routes_size_ = routes_.size();
 }
 
 void TrafficSimulator::save_edges(int current_time) {
@@ -3,14 +3,20 @@
 #define LC_B18_TRAFFIC_SIMULATOR_H
 
 #include <boost/filesystem.hpp>
+#include <functional>
+#include <future>
+#include <memory>
 #include <qt5/QtCore/QSettings>
 #include <qt5/QtCore/qcoreapplication.h>
+#include <random>
 #include <thread>
 #include <unistd.h>
 #include <string>
+#include <unordered_map>
 
 #include "traffic/traffic_simulator.h"
 #include "agent.h"
+#include "cpu_simulator.h"
 #include "cuda_simulator.h"
 #include "lanemap.h"
 #include "network.h"
@@ -39,6 +45,53 @@ public:
 
   void simulateInGPU(float start_time, float end_time,int save_interval);
 
+  //! Run the same simulation on the host with OpenMP threads
+  //! \param[in] num_threads number of threads (0: use all available cores)
+  void simulateInCPU(float start_time, float end_time, int save_interval,
+                     int num_threads = 0);
+
+  //! Iterative assignment: simulate, set the edge weights to the observed
+  //! travel times, reroute a fraction of the agents whose route is slower
+  //! than the new shortest path, and repeat. The relative gap of every
+  //! iteration is written to assignment.csv in the save path. Every
+  //! iteration starts from the agents as they are when it is called. The
+  //! network must not have weight profiles
+  //! \param[in] iterations number of simulations
+  //! \param[in] reroute_fraction share of the agents on a slower route that
+  //! switch to the shortest path after each iteration
+  //! \param[in] use_cpu simulate with simulateInCPU instead of simulateInGPU
+  //! \param[in] num_threads number of CPU threads (0: use all available cores)
+  void simulateAssignment(float start_time, float end_time, int save_interval,
+                          int iterations, float reroute_fraction,
+                          bool use_cpu = false, int num_threads = 0);
+
+  //! Relative gap of each iteration of the last simulateAssignment
+  const std::vector<double> &relative_gaps() const { return relative_gaps_; }
+
+  //! Reroute agents stuck in queues during the simulation. Every interval
+  //! steps the queued or stopped agents that have been on their edge the
+  //! longest (at most batch_size) are routed on a background thread with the
+  //! travel times observed so far, and switch to the new route once it is
+  //! found if it is faster than the rest of theirs
+  //! \param[in] interval steps between two rerouting rounds (0: disabled)
+  //! \param[in] batch_size maximum number of agents of a round
+  //! \param[in] wait the step loop waits for every round to finish, so the
+  //! same inputs give the same routes
+  void set_en_route_rerouting(int interval, unsigned batch_size,
+                              bool wait = false) {
+    reroute_interval_ = interval;
+    reroute_batch_ = batch_size;
+    reroute_wait_ = wait;
+  }
+
+  //! Agents switched to a new route during the last simulation
+  std::size_t en_route_reroutes() const { return num_en_route_reroutes_; }
+
+  //! Flat route array (lanemap ids) shared by all agents, indexed by
+  //! agent.route_offset. Agents with the same origin and destination share
+  //! one route
+  std::vector<uint> &routes() { return routes_; }
+
   //! save edge data
   void save_edges(int current_time);
   //! save agent data
@@ -48,12 +101,139 @@ public:
   //  B18GridPollution gridPollution;
 
 private:
-  //! Find shortest path for each agent
+  //! Find shortest path for each distinct od pair of the agents, on the
+  //! weight profile of their departure time
   void route_finding_();
 
+  //! Route the distinct od pairs of the agents
+  //! \param[in] graph_ch contraction hierarchies of the network
+  //! \param[in] agent_graphs graph (graphno of graph_ch) to route every agent
+  //! on (empty: all agents on graph 0)
+  //! \param[out] agent_pairs od pair index of every agent
+  //! \param[out] routes routes of the pairs (lanemap ids) back to back
+  //! \param[out] route_offsets first entry of every pair's route in routes
+  //! (number of pairs + 1)
+  void find_pair_routes_(MTC::accessibility::Accessibility &graph_ch,
+                         const std::vector<unsigned> &agent_graphs,
+                         std::vector<unsigned> &agent_pairs,
+                         std::vector<uint> &routes,
+                         std::vector<std::size_t> &route_offsets);
+
+  //! Average travel time of every edge in the last simulation (free flow
+  //! time for edges no vehicle left), indexed by lanemap id
+  std::vector<double> observed_travel_times_() const;
+
+  //! Average travel time of every edge from its travel counters, at least
+  //! the time its vehicles have waited on it so far
+  //! \param[in] edges travel counters by lanemap id
+  std::vector<double>
+  observed_travel_times_(const std::vector<EdgeTravel> &edges) const;
+
+  //! Restore the agents' departure state (keeping their routes) and clear
+  //! the lanemap for another simulation
+  void reset_simulation_();
+
+  //! Routing weights (in edge id order) from travel times by lanemap id
+  std::vector<double>
+  edge_weights_(const std::vector<double> &travel_times) const;
+
+  //! Everything a rerouting round reads, copied on the simulation thread: the
+  //! background thread touches neither the lanemap nor routes_
+  struct RerouteRound {
+    //! agents to reroute with their current route
+    std::vector<RouteUpdate> updates;
+    //! vertex every new route starts at and destination of every agent
+    std::vector<long> sources, targets;
+    //! first vertex of the last kept edge of every agent (no U-turns)
+    std::vector<uint> kept_vertices;
+    //! travel time of the replaced part of every agent's route
+    std::vector<double> old_times;
+    //! travel time of every edge by lanemap id
+    std::vector<double> travel_times;
+    //! routing weights, lanemap id and last vertex of every edge (edge id
+    //! order)
+    std::vector<double> weights;
+    std::vector<uint> edge_mids;
+    std::vector<uint> edge_targets;
+  };
+
+  //! New parts of the routes of a rerouting round stored back to back, and
+  //! the agents switching to them (route_offset into routes; route_size also
+  //! counts the splice entries kept from the old route)
+  struct Reroutes {
+    std::vector<uint> routes;
+    std::vector<RouteUpdate> updates;
+  };
+
+  //! Rerouting entry points of a simulation backend
+  struct RerouteBackend {
+    //! start copying the rerouting data
+    std::function<void()> stage_data;
+    //! wait for the staged rerouting data
+    std::function<void(std::vector<RerouteCandidate> &,
+                       std::vector<EdgeTravel> &)>
+        get_data;
+    //! flag the updates of agents that did not move on
+    std::function<void(const std::vector<RouteUpdate> &,
+                       std::vector<uchar> &)>
+        check_routes;
+    //! switch agents to the new routes appended to routes_, returns the
+    //! number of agents switched
+    std::function<unsigned(const std::vector<RouteUpdate> &)> update_routes;
+    //! replace the routes after routes_ was rebuilt
+    std::function<void()> set_routes;
+  };
+
+  //! En-route rerouting between two steps: switch the agents of a finished
+  //! round, or stage the rerouting data every reroute_interval_ steps and
+  //! start a round with it after the next step
+  //! \param[in] step number of steps simulated
+  //! \param[in] backend rerouting entry points of the running simulation
+  void reroute_step_(unsigned step, const RerouteBackend &backend);
+
+  //! Pick the agents to reroute and route them on a background thread
+  //! \param[in] candidates agents that can be rerouted
+  //! \param[in] edges travel counters of the edges by lanemap id
+  void start_rerouting_(std::vector<RerouteCandidate> candidates,
+                        const std::vector<EdgeTravel> &edges);
+
+  //! Find the new routes of a rerouting round (background thread)
+  //! \param[in] round agents to reroute and the state they are routed on
+  Reroutes reroute_(RerouteRound round);
+
+  //! Wait for a running rerouting round and drop its routes
+  void finish_rerouting_();
+
+  //! Rebuild routes_ from the routes of the agents, dropping the routes
+  //! nobody follows any more
+  void compact_routes_();
+
   std::shared_ptr<Network> network_;
   std::shared_ptr<OD> od_;
   std::shared_ptr<Lanemap> lanemap_;
+  //! Routes of all distinct od pairs stored back to back
+  std::vector<uint> routes_;
+  //! Agents as simulateAssignment found them, restored before each of its
+  //! iterations (empty outside of it)
+  std::vector<Agent> initial_agents_;
+  //! Relative gap of each assignment iteration
+  std::vector<double> relative_gaps_;
+  //! Steps between two en-route rerouting rounds (0: disabled)
+  int reroute_interval_{0};
+  //! Maximum number of agents rerouted in one round
+  unsigned reroute_batch_{0};
+  //! The step loop waits for every rerouting round
+  bool reroute_wait_{false};
+  //! Agents switched to a new route during the last simulation
+  std::size_t num_en_route_reroutes_{0};
+  //! Size of routes_ when it was last rebuilt
+  std::size_t compacted_routes_size_{0};
+  //! Rerouting data staged in the backend for the next round
+  bool reroute_staged_{false};
+  //! Rerouting round running in the background
+  std::future<Reroutes> reroute_task_;
+  //! Customizable CH the rerouting rounds route on
+  std::unique_ptr<MTC::accessibility::Accessibility> reroute_ch_;
   //! simulation time resolution
   double deltaTime_ = 0.5;
   std::string save_path_ = "./";